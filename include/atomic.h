@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ATOMIC_H
+#define ATOMIC_H
+
+#include <stdint.h>
+
+/* Atomic operations that return the old value, which the libos
+ * atomic_or() and friends do not.
+ */
+
+/* Atomically OR val into *ptr, returning the previous contents. */
+static inline uint32_t atomic_fetch_or32(uint32_t *ptr, uint32_t val)
+{
+	uint32_t old, tmp;
+
+	asm volatile("1: lwarx %0, 0, %2;"
+	             "or %1, %0, %3;"
+	             "stwcx. %1, 0, %2;"
+	             "bne- 1b;"
+	             : "=&r" (old), "=&r" (tmp)
+	             : "r" (ptr), "r" (val)
+	             : "cc", "memory");
+
+	return old;
+}
+
+/* As atomic_fetch_or32(), for a long such as one atomic_or() uses. */
+static inline unsigned long atomic_fetch_or(unsigned long *ptr,
+                                            unsigned long val)
+{
+#ifdef CONFIG_LIBOS_64BIT
+	unsigned long old, tmp;
+
+	asm volatile("1: ldarx %0, 0, %2;"
+	             "or %1, %0, %3;"
+	             "stdcx. %1, 0, %2;"
+	             "bne- 1b;"
+	             : "=&r" (old), "=&r" (tmp)
+	             : "r" (ptr), "r" (val)
+	             : "cc", "memory");
+
+	return old;
+#else
+	return atomic_fetch_or32((uint32_t *)ptr, val);
+#endif
+}
+
+#endif
@@ -45,12 +45,31 @@
 
 #define MAX_MUX_CHANNELS 32
 
+/* Framed mode: each frame is MUX_FRAME_SOF, a channel number, a
+ * payload length from 1 to MUX_FRAME_MAX, and the payload, unescaped.
+ */
+#define MUX_FRAME_SOF 0x1e
+#define MUX_FRAME_HDR 3
+#define MUX_FRAME_MAX 255
+
+/* Transmit scheduling: each backlogged channel may send its weight
+ * times MUX_QUANTUM bytes per turn.
+ */
+#define MUX_QUANTUM 32
+#define MUX_MAX_WEIGHT 64
+
+/* Output is not queued for the UART beyond this many bytes, so that a
+ * channel's turn comes up without waiting for a full queue to drain.
+ */
+#define MUX_TX_BACKLOG 512
+
 typedef struct mux_complex {
 	byte_chan_handle_t *byte_chan;
 	struct connected_bc *current_tx_bc;
 	struct connected_bc *next_tx_pull_bc;
 	struct connected_bc *current_rx_bc;
 	struct connected_bc *first_bc;
+	struct connected_bc *channels[MAX_MUX_CHANNELS];
 	int current_tx;
 	int current_rx;
 	int rx_flag_state;
@@ -59,6 +78,14 @@ typedef struct mux_complex {
 	int rx_discarded;
 	int num_of_channels;
 	int rx_count;
+
+	int framed;          /**< non-zero once framed mode is in use */
+	int rx_framed;       /**< incoming data is framed */
+	int framed_ack;      /**< the framed mode ack is still to be queued */
+	int rx_frame_state;  /**< position in the frame being received */
+	int rx_frame_left;   /**< payload bytes left in that frame */
+	uint8_t rx_frame[MUX_FRAME_MAX];
+	uint8_t tx_frame[MUX_FRAME_HDR + MUX_FRAME_MAX];
 } mux_complex_t;
 
 typedef struct connected_bc {
@@ -66,11 +93,19 @@ typedef struct connected_bc {
 	mux_complex_t *mux_complex; 
 	struct connected_bc *next;
 	char num;
+
+	int weight;                 /**< share of the stream when backlogged */
+	int deficit;                /**< bytes left in the current turn */
+	unsigned long tx_bytes;   /**< bytes sent into the stream */
+	unsigned long rx_bytes;   /**< bytes delivered from the stream */
+	unsigned long rx_dropped; /**< bytes dropped because the channel was full */
 } connected_bc_t;
 
 int mux_complex_add(mux_complex_t *mux_complex, 
                     byte_chan_t *byte_chan,
                     char multiplexing_id);
+int mux_complex_set_weight(mux_complex_t *mux, char multiplexing_id,
+                           int weight);
 
 void create_muxes(void);
 
@@ -29,6 +29,7 @@
 #define BENCHMARK_H
 
 #include <stdint.h>
+#include <stddef.h>
 #include <libos/core-regs.h>
 #include <libos/trapframe.h>
 
@@ -54,6 +55,8 @@ typedef enum benchmark_num {
 	bm_stat_emulated_other, /**< emulated instruction overhead -- other */
 	/* hcalls start here */
 	bm_stat_vmpic_eoi, /**< vmpic eoi hcall */
+	bm_stat_bc_sendv, /**< vectored byte channel send hcall */
+	bm_stat_bc_receivev, /**< vectored byte channel receive hcall */
 	bm_stat_hcall, /**< other hcalls not explicitly tracked */
 	/* other tracked exceptions go here */
 	bm_stat_mcheck, /**< Machine check */
@@ -73,6 +76,10 @@ typedef enum benchmark_num {
 	bm_stat_tlb_miss_count, /**< TLB miss exceptions */
 	bm_stat_tlb_miss_reflect, /**< TLB misses reflected to guest in case of TLBCache */
 	bm_stat_tlb_miss, /**< TLB miss exceptions */
+	bm_stat_tlb1_refill, /**< TLB misses filled from the guest TLB1 */
+	bm_stat_tlb1_evict, /**< TLB1 entries evicted by a refill */
+	bm_stat_xlate_hit, /**< vptbl_xlate() served from the translation cache */
+	bm_stat_xlate_miss, /**< vptbl_xlate() page table walks */
 	bm_stat_altivecunavail, /**< altivec unavailable */
 	bm_stat_altivecassist, /**< altivec assist */
 	bm_stat_lrat_miss, /**< lrat miss */
@@ -81,6 +88,7 @@ typedef enum benchmark_num {
 	bm_tlb0_inv_all,
 	bm_tlb1_inv,
 	bm_tlbwe,
+	bm_copy_gphys, /**< bulk copies to or from guest physical memory */
 	num_benchmarks
 } benchmark_num_t;
 
@@ -88,8 +96,33 @@ typedef struct benchmark {
 	uint64_t accum; /* Accumulated time */
 	unsigned long min, max; /* Record fast/slow */
 	unsigned long num; /* number of instances */
+	uint64_t bytes; /* data moved, for throughput benchmarks */
 } benchmark_t;
 
+/* Number of hypervisor events, the EV_* numbers in events.h */
+#define NUM_EVENTS 8
+
+/* What setevent() did with the events raised against a gcpu */
+typedef struct event_stat {
+	unsigned long raised; /* setevent() calls */
+	unsigned long coalesced; /* folded into an already pending event */
+	unsigned long local; /* run from return_hook(), no doorbell */
+	unsigned long remote; /* doorbell sent to the target core */
+} event_stat_t;
+
+/* Latency histogram of one hcall, indexed by the hcall's slot in the
+ * dispatch tables (see hcall_stat_name()).  hist[n] counts the calls
+ * that took [2^n, 2^(n+1)) timebase ticks; the first bucket also holds
+ * calls under a tick and the last one everything slower.
+ */
+#define HCALL_HIST_BUCKETS 16
+
+typedef struct hcall_stat {
+	uint64_t accum; /* Accumulated time */
+	unsigned long num, max;
+	unsigned long hist[HCALL_HIST_BUCKETS];
+} hcall_stat_t;
+
 #ifdef CONFIG_STATISTICS
 static inline void set_stat(int stat, struct trapframe *regs)
 {
@@ -97,15 +130,48 @@ static inline void set_stat(int stat, struct trapframe *regs)
 
 }
 
+static inline uint32_t statistics_start(void)
+{
+	return mfspr(SPR_TBL);
+}
+
 void statistics_stop(uint32_t start, int bmnum);
+void statistics_stop_bytes(uint32_t start, int bmnum, size_t bytes);
+void statistics_count(int bmnum);
+void hcall_stat_init(void);
+void hcall_stat_stop(uint32_t start, int index);
+int hcall_stat_count(void);
+const char *hcall_stat_name(int index);
 #else
 static inline void set_stat(int stat, struct trapframe *regs)
 {
 }
 
+static inline uint32_t statistics_start(void)
+{
+	return 0;
+}
+
 static inline void statistics_stop(uint32_t start, int bmnum)
 {
 }
+
+static inline void statistics_stop_bytes(uint32_t start, int bmnum,
+                                         size_t bytes)
+{
+}
+
+static inline void statistics_count(int bmnum)
+{
+}
+
+static inline void hcall_stat_init(void)
+{
+}
+
+static inline void hcall_stat_stop(uint32_t start, int index)
+{
+}
 #endif
 
 #ifdef CONFIG_BENCHMARKS
@@ -118,6 +184,11 @@ static inline void bench_stop(register_t start, int bm)
 {
 	statistics_stop(start, bm);
 }
+
+static inline void bench_stop_bytes(register_t start, int bm, size_t bytes)
+{
+	statistics_stop_bytes(start, bm, bytes);
+}
 #else
 static inline register_t bench_start(void)
 {
@@ -127,6 +198,10 @@ static inline register_t bench_start(void)
 static inline void bench_stop(register_t start, int bm)
 {
 }
+
+static inline void bench_stop_bytes(register_t start, int bm, size_t bytes)
+{
+}
 #endif
 
 #endif /* BENCHMARK_H */
@@ -34,6 +34,69 @@
 #include <percpu.h>
 #include <devtree.h>
 #include <handle.h>
+#include <coalesce.h>
+
+/** Header of a shared byte-channel ring.
+ *
+ * A guest may register a region of its memory with a byte-channel
+ * handle, consisting of this header followed by a tx data area and
+ * an rx data area of equal, power-of-two size.  The indices are
+ * free-running byte counts; each is written only by its owner.
+ */
+typedef struct byte_chan_ring_hdr {
+	uint32_t tx_prod; /**< written by guest: bytes placed in tx area */
+	uint32_t tx_cons; /**< written by hv: bytes taken from tx area */
+	uint32_t rx_prod; /**< written by hv: bytes placed in rx area */
+	uint32_t rx_cons; /**< written by guest: bytes taken from rx area */
+	uint32_t reserved[4];
+} byte_chan_ring_hdr_t;
+
+#define BYTE_CHAN_RING_MIN 64
+#define BYTE_CHAN_RING_MAX (1024 * 1024)
+
+/** Descriptor for the vectored send and receive hcalls
+ *
+ * The guest passes an array of these; len and status are written
+ * back for each.
+ */
+typedef struct byte_chan_vec {
+	uint64_t buf;      /**< guest physical address of the data */
+	uint32_t handle;   /**< byte channel handle */
+	uint32_t len;      /**< in: bytes to send or room; out: bytes moved */
+	uint32_t status;   /**< out: zero or an EV_ error code */
+	uint32_t reserved;
+} byte_chan_vec_t;
+
+/* Most descriptors processed by one vectored hcall */
+#define BYTE_CHAN_VEC_MAX 64
+
+/** One direction of a direct byte channel's ring
+ *
+ * prod and want_space are written by the sender, cons by the
+ * receiver; they are kept in separate cache lines.  prod and cons
+ * are free-running byte counts.  A sender that finds the data area
+ * full sets want_space before checking cons again, and gets a tx
+ * interrupt when the receiver next kicks.
+ */
+typedef struct byte_chan_direct_dir {
+	uint32_t prod;
+	uint32_t want_space;
+	uint32_t reserved0[14];
+	uint32_t cons;
+	uint32_t reserved1[15];
+} byte_chan_direct_dir_t;
+
+/** Header of a direct byte channel's ring
+ *
+ * A byte channel connecting two partitions may carry its data in a
+ * ring allocated by the hypervisor and mapped into both partitions:
+ * a page holding this header, then data area 0 and data area 1, each
+ * a power-of-two number of pages.  dir[n] describes data area n, which
+ * carries data sent through handle n.
+ */
+typedef struct byte_chan_direct_hdr {
+	byte_chan_direct_dir_t dir[2];
+} byte_chan_direct_hdr_t;
 
 typedef struct byte_chan_handle {
 	queue_t *tx;      /**< queue for transmitting data */
@@ -42,6 +105,31 @@ typedef struct byte_chan_handle {
 	uint32_t rx_lock; /**< lock for receiving data */
 	int attached;     /**< non-zero if something has attached to this endpoint. */
 	handle_t user;    /**< user handle */
+
+	/* Shared ring, if registered; protected by both tx_lock and rx_lock */
+	phys_addr_t ring;      /**< guest physical address of ring header */
+	uint32_t ring_size;    /**< size of each data area, 0 if none */
+	uint32_t ring_tx_cons; /**< hv copy of tx_cons */
+	uint32_t ring_rx_prod; /**< hv copy of rx_prod */
+
+	unsigned long tx_contended; /**< tx_lock acquisitions that had to wait */
+	unsigned long rx_contended; /**< rx_lock acquisitions that had to wait */
+
+	size_t tx_hwm; /**< most bytes seen queued in tx */
+	size_t rx_hwm; /**< most bytes seen queued in rx */
+
+	/* Direct ring, shared with the other handle; the queues then
+	 * only carry notifications.
+	 */
+	byte_chan_direct_hdr_t *direct; /**< ring header, NULL if none */
+	uint32_t direct_size;           /**< size of each data area */
+	int direct_tx;                  /**< data area sent through */
+
+	/* Interrupt coalescing, if configured; the queues' consumer
+	 * and producer then point to the handle rather than the irqs.
+	 */
+	struct vpic_interrupt *rx_irq, *tx_irq;
+	coalesce_t rx_coalesce, tx_coalesce;
 } byte_chan_handle_t;
 
 /** byte_chan_t - This is a generic byte_chan device description  */
@@ -53,12 +141,73 @@ typedef struct byte_chan {
 void byte_chan_partition_init(guest_t *guest);
 
 byte_chan_t *byte_chan_alloc(void);
+byte_chan_t *byte_chan_alloc_sized(size_t size0, size_t size1);
+
+extern unsigned long byte_chan_queue_bytes;
+
+/** Record the fill level of a queue in a high-water mark
+ *
+ * Updated by whoever writes or reads the queue on behalf of a handle,
+ * so the mark is a lower bound on the true peak.
+ */
+static inline void byte_chan_note_fill(queue_t *q, size_t *hwm)
+{
+	size_t fill = queue_get_avail(q);
+
+	if (fill > *hwm)
+		*hwm = fill;
+}
 
 ssize_t byte_chan_send(byte_chan_handle_t *bc,
                        const uint8_t *buf, size_t length);
 ssize_t byte_chan_receive(byte_chan_handle_t *bc,
                           uint8_t *buf, size_t length);
 
+/** Take a byte channel lock on behalf of the guest owning the handle
+ *
+ * The queues are safe for one producer and one consumer without
+ * locking.  A guest with a single vcpu is the only producer on its
+ * handle's tx queue and the only consumer on its rx queue, so for such
+ * a guest, only interrupts are disabled.  Otherwise, the lock is taken,
+ * counting in *contended the acquisitions that found it held.
+ */
+static inline register_t byte_chan_guest_lock(guest_t *guest, uint32_t *lock,
+                                              unsigned long *contended)
+{
+	register_t saved;
+	int busy;
+
+	if (guest->cpucnt == 1)
+		return disable_int_save();
+
+	busy = *(volatile uint32_t *)lock != 0;
+	saved = spin_lock_intsave(lock);
+	if (busy)
+		(*contended)++;
+
+	return saved;
+}
+
+static inline void byte_chan_guest_unlock(guest_t *guest, uint32_t *lock,
+                                          register_t saved)
+{
+	if (guest->cpucnt == 1)
+		restore_int(saved);
+	else
+		spin_unlock_intsave(lock, saved);
+}
+
+int byte_chan_ring_register(byte_chan_handle_t *bc, guest_t *guest,
+                            phys_addr_t ring, uint32_t size);
+int byte_chan_ring_kick(byte_chan_handle_t *bc, guest_t *guest,
+                        uint32_t *tx_left, uint32_t *rx_pending);
+void byte_chan_direct_status(byte_chan_handle_t *bc,
+                             uint32_t *rx_avail, uint32_t *tx_space);
+int byte_chan_send_gphys(byte_chan_handle_t *bc, guest_t *guest,
+                         phys_addr_t buf, uint32_t *len);
+int byte_chan_receive_gphys(byte_chan_handle_t *bc, guest_t *guest,
+                            phys_addr_t buf, uint32_t *len);
+
 byte_chan_handle_t *byte_chan_claim(byte_chan_t *bc);
 int byte_chan_attach_chardev(byte_chan_t *bc, chardev_t *cd);
 
@@ -0,0 +1,67 @@
+
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COALESCE_H
+#define COALESCE_H
+
+#include <stdint.h>
+#include <timers.h>
+
+struct dt_node;
+
+/* An interrupt coalescer holds back notifications until enough has
+ * built up to be worth an interrupt, or until the oldest notification
+ * held back has waited long enough.
+ *
+ * The level passed to coalesce_notify() is whatever the notifications
+ * are measured in -- bytes waiting in a queue, doorbell rings -- and
+ * is compared with the threshold.
+ */
+typedef struct coalesce {
+	hv_timer_t timer;
+	void (*deliver)(struct coalesce *c);
+	uint32_t threshold; /**< level that is delivered right away */
+	uint32_t delay;     /**< longest hold, in timebase ticks */
+	uint32_t lock;
+	int held;           /**< a notification is being held back */
+	int timer_pending;  /**< the current hold is being timed */
+	int timer_queued;   /**< timer is on a timer wheel */
+
+	const char *name;      /**< config node name */
+	const char *kind;      /**< what is notified */
+	struct coalesce *next; /**< in the list of all coalescers */
+	unsigned long delivered;  /**< interrupts delivered */
+	unsigned long suppressed; /**< notifications held back */
+} coalesce_t;
+
+int coalesce_init(coalesce_t *c, struct dt_node *node, const char *prop,
+                  const char *kind, void (*deliver)(coalesce_t *c));
+void coalesce_notify(coalesce_t *c, uint32_t level);
+void coalesce_reset(coalesce_t *c, int flush);
+
+/* First of the list of coalescers, for the shell */
+extern coalesce_t *coalesce_list;
+
+#endif
@@ -0,0 +1,106 @@
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef COPY_ENGINE_H
+#define COPY_ENGINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <percpu.h>
+#include <timers.h>
+
+struct pte;
+struct ipi_doorbell;
+
+/**
+ * Structure definition for the hcall_partition_memcpy scatter-gather list
+ *
+ * This structure must be aligned on 32-byte boundary
+ *
+ * @source: guest physical address to copy from
+ * @destination: guest physical address to copy to
+ * @size: number of bytes to copy
+ * @reserved: reserved, must be zero
+ */
+struct hcall_sg_list {
+	uint64_t source;
+	uint64_t target;
+	uint64_t size;
+	uint64_t reserved;
+} __attribute__ ((aligned (32)));
+
+/* Most entries one asynchronous copy may have */
+#define COPY_MAX_SG 1024
+
+/* Asynchronous copies that may be outstanding, in all and per caller */
+#define COPY_MAX_REQS 32
+#define COPY_MAX_PENDING 8
+
+/** A way of copying between guest physical address spaces
+ *
+ * Each backend has a worker thread, which takes asynchronous copies
+ * off a queue shared by all backends and hands them to copy() a
+ * chunk at a time.  copy() returns the number of bytes copied; fewer
+ * than len means an address could not be translated.  It is only
+ * called from the worker thread, so it may block -- for instance in
+ * copy_engine_sleep() while hardware is busy.
+ */
+typedef struct copy_backend {
+	const char *name;
+	size_t (*copy)(struct copy_backend *be, struct pte *dtbl,
+	               phys_addr_t dest, struct pte *stbl, phys_addr_t src,
+	               size_t len);
+	size_t chunk; /**< most bytes handed to copy() at once */
+	void *priv;
+
+	struct thread *worker;
+	struct copy_req *cur; /**< request being copied, under the queue lock */
+	hv_timer_t timer;    /**< for copy_engine_sleep() */
+	int timer_pending;
+	struct copy_backend *next;
+
+	unsigned long requests, faults;
+	uint64_t bytes;
+	uint64_t busy_tb;   /**< timebase ticks spent in copy() */
+} copy_backend_t;
+
+void copy_engine_register(copy_backend_t *be);
+void copy_engine_init(void);
+
+int copy_engine_submit(guest_t *caller, guest_t *source, guest_t *target,
+                       phys_addr_t sg_gphys, unsigned int num,
+                       struct ipi_doorbell *done, unsigned int *id);
+int copy_engine_status(guest_t *caller, unsigned int id);
+void copy_engine_reset(guest_t *caller);
+
+int copy_engine_run(copy_backend_t *be);
+void copy_engine_sleep(copy_backend_t *be, uint64_t ticks);
+size_t copy_engine_soft_copy(copy_backend_t *be, struct pte *dtbl,
+                             phys_addr_t dest, struct pte *stbl,
+                             phys_addr_t src, size_t len);
+
+/* First of the list of registered backends, for the shell */
+extern copy_backend_t *copy_backends;
+
+#endif
@@ -65,6 +65,7 @@ void sync_nap(trapframe_t *regs);
 #define EV_DUMP_HV_QUEUE          5
 #define EV_DELIVER_MPIC_ERRINT    6
 #define EV_SYNC_NAP               7 /* must run on boot core */
+/* NUM_EVENTS in benchmark.h must follow the last event */
 
 extern int gev_stop; /**< Stop guest on this core */
 extern int gev_start; /**< Start guest on this core */
@@ -26,6 +26,7 @@
 #include <percpu.h>
 #include <vpic.h>
 #include <handle.h>
+#include <coalesce.h>
 
 #define IPI_DOORBELL_TYPE_NORMAL 1
 #define IPI_DOORBELL_TYPE_FAST   2
@@ -48,6 +49,10 @@ typedef struct ipi_doorbell {
 	ipi_normal_doorbell_t *normal_dbell;
 	ipi_fast_doorbell_t *fast_dbell;
 	uint32_t dbell_lock;
+
+	/* Coalescing of normal doorbells, if configured */
+	coalesce_t coalesce;
+	uint32_t rings; /**< rings held back, under dbell_lock */
 } ipi_doorbell_t;
 
 typedef struct ipi_doorbell_handle {
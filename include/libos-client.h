@@ -58,6 +58,26 @@ static inline uint64_t virt_to_phys(void *ptr)
 	return (uintptr_t)ptr - PHYSBASE + text_phys;
 }
 
+/* Number of entries in the per-CPU guest physical translation cache.
+ * Must be a power of two.
+ */
+#define XLATE_CACHE_SIZE 16
+
+/* A leaf PTE remembered by vptbl_xlate() */
+typedef struct xlate_cache_entry {
+	void *tbl;
+	unsigned long epn, pages; /* range of pages covered by the PTE */
+	unsigned long page, attr;
+	unsigned long gen;
+} xlate_cache_entry_t;
+
+/* Number of slots in the per-CPU hypervisor timer wheel, see timers.c.
+ * Must be a power of two.
+ */
+#define TIMER_WHEEL_SLOTS 64
+
+struct hv_timer;
+
 typedef struct {
 	/** Fast exception save area
 	 * The entire cache line will be clobbered.  This may not be used
@@ -75,6 +95,18 @@ typedef struct {
 	 */
 	unsigned int tlbcache_bits;
 
+	/* Associativity of the TLB cache, and its log2 */
+	unsigned int tlbcache_ways;
+	unsigned int tlbcache_way_bits;
+
+	/* Per-PID-bucket bitmaps of possibly occupied TLB cache sets */
+	unsigned long *tlbcache_pidmap;
+
+	/* Generation of the TLB cache.  Bumping it invalidates every
+	 * entry without touching the cache itself.
+	 */
+	unsigned int tlbcache_gen;
+
 	/* Indicates if the TLB cache for TLB 0 is enabled */
 	int tlbcache_enable;
 
@@ -84,6 +116,12 @@ typedef struct {
 
 	uint64_t previous_tb; // The previous value of tb
 
+	/* Hypervisor timers, hashed by the tick they expire in */
+	struct hv_timer *timer_wheel[TIMER_WHEEL_SLOTS];
+	uint64_t timer_wheel_tick; /* next tick to be run */
+	uint64_t timer_next; /* earliest expiry pending */
+	int timers_pending;
+
 	/** When set, sync_nap() will put the core into nap state.  When
 	 * clear, sync_nap() will wake the core from nap state.
 	 */
@@ -93,6 +131,20 @@ typedef struct {
 	struct cpu *primary;
 	/* points to the shared cpu data */
 	struct shared_cpu *shared;
+
+	/* Recent vptbl_xlate() results, see paging.c */
+	xlate_cache_entry_t xlate_cache[XLATE_CACHE_SIZE];
+
+	/* What this thread's TEMPTLB1 and TEMPTLB2 entries map, so that
+	 * map_gphys() and map_phys() can skip rewriting an entry that
+	 * already holds the mapping.  tsize is zero if unknown.
+	 */
+	struct {
+		uintptr_t vaddr;
+		uint64_t paddr;
+		unsigned long mas2, mas3;
+		int tsize;
+	} temp_tlb[2];
 } client_cpu_t;
 
 extern unsigned long CCSRBAR_VA; /**< Deprecated virtual base of CCSR */
@@ -125,6 +125,12 @@ unsigned long vptbl_xlate(pte_t *tbl, unsigned long epn,
 void vptbl_map(pte_t *tbl, unsigned long epn, unsigned long rpn,
                unsigned long npages, unsigned long attr, int levels);
 
+/* Discard the translations that vptbl_xlate() has cached on all CPUs.
+ * vptbl_map() does this itself; it must also be done when a page table
+ * is torn down or reused.
+ */
+void vptbl_xlate_flush(void);
+
 
 void guest_set_tlb1(unsigned int entry, unsigned long mas1,
                     unsigned long epn, unsigned long grpn,
@@ -194,9 +200,11 @@ extern void *temp_mapping[2 * CONFIG_LIBOS_MAX_HW_THREADS];
 void *map_gphys(int tlbentry, pte_t *tbl, phys_addr_t addr,
                 void *vpage, size_t *len, int maxtsize, register_t mas2flags,
                 int write);
+phys_addr_t xlate_gphys(pte_t *tbl, phys_addr_t addr, size_t *len, int write);
 void *map_phys(int tlbentry, phys_addr_t paddr, void *vpage,
                size_t *len, int maxtsize, register_t mas2flags,
                register_t mas3flags);
+void clear_temp_tlb(int tlbentry);
 
 size_t copy_to_gphys(pte_t *tbl, phys_addr_t dest, void *src, size_t len,
                      int cache_sync);
@@ -52,6 +52,7 @@ void hv_pamu_partition_init(guest_t *guest);
 
 int hv_pamu_enable_liodn(unsigned int liodn);
 int hv_pamu_disable_liodn(unsigned int liodn);
+int hv_pamu_config_hv_liodn(uint32_t liodn);
 int hv_pamu_config_liodn(guest_t *guest, uint32_t liodn, dt_node_t *hwnode, dt_node_t *cfgnode, dt_node_t *gnode);
 int hv_pamu_reconfig_liodn(guest_t *guest, uint32_t liodn, dt_node_t *hwnode);
 
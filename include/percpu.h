@@ -161,6 +161,11 @@ typedef struct guest {
 	/** Partition-scope -- opt out of the feature completely */
 	int no_dma_disable;
 
+	/** Timebase ticks spent building the guest physical page tables
+	 *  for memory and for device ranges during partition init.
+	 */
+	uint64_t map_mem_tb, map_ranges_tb;
+
 	/** The doorbell handle to use to signal a state change in the
 	 *  this partition.  The receivers are the managers of this partition.
 	 */
@@ -207,6 +212,12 @@ typedef struct guest {
 	/** phandle of the guest vmpic node */
 	uint32_t vmpic_phandle;
 
+	/** Interrupt balancer, or NULL if "irq-balance" is not set */
+	struct vmpic_balance *irq_balance;
+
+	/** A reset waiting for the copy workers, see copy_engine_reset() */
+	struct thread *copy_waiter;
+
 	/** If !0, then don't load images from image-table on start */
 	int no_auto_load;
 
@@ -237,6 +248,7 @@ extern unsigned long active_guests;
 #define GCPU_PEND_MSGSND   0x00000004 /* Guest OS msgsnd */
 #define GCPU_PEND_VIRQ     0x00000040 /* Virtual IRQ pending */
 #define GCPU_PEND_PERFMON  0x00000200 /* Performance monitor interrupt */
+#define GCPU_PEND_POSTED   0x00000400 /* Posted virtual IRQs, see vpic.c */
 
 /* The following flags correspond to crit_gdbell_pending */
 #define GCPU_PEND_MSGSNDC  0x00000008 /* Guest OS critical doorbell msgsnd */
@@ -254,6 +266,14 @@ typedef struct gcpu {
 	thread_t thread;
 	tlbmap_t tlb1_map[TLB1_GSIZE];
 	tlb_entry_t gtlb1[TLB1_GSIZE];
+
+	/* Index of gtlb1 for guest_tlb1_miss(): entry numbers sorted by
+	 * starting EPN, and for each position, the highest ending EPN of
+	 * the entries up to and including it.  Rebuilt by guest_set_tlb1().
+	 */
+	uint8_t gtlb1_sorted[TLB1_GSIZE];
+	unsigned long gtlb1_maxend[TLB1_GSIZE];
+	unsigned int gtlb1_nsorted;
 	unsigned long split_gtlb1_map;
 
 #ifdef CONFIG_FAST_TLB1
@@ -264,6 +284,18 @@ typedef struct gcpu {
 	unsigned long dbell_pending;
 	unsigned long gevent_pending;
 	unsigned int gcpu_num;
+
+	/* Scatter-gather buffer for hcall_partition_memcpy(), allocated
+	 * on first use.  Private to this vcpu, so copies issued from
+	 * different vcpus do not serialize on a common buffer.
+	 */
+	struct hcall_sg_list *memcpy_sg;
+#ifdef CONFIG_STATISTICS
+	/* hcall_stat_count() entries, allocated by hcall_stat_init().
+	 * Cleared rather than freed on partition reset.
+	 */
+	hcall_stat_t *hcall_stats;
+#endif
 	/* lpid used by this cpu / thread */
 	uint32_t lpid;
 	vpic_cpu_t vpic;
@@ -297,6 +329,7 @@ typedef struct gcpu {
 
 #ifdef CONFIG_STATISTICS
 	struct benchmark benchmarks[num_benchmarks];
+	event_stat_t event_stats[NUM_EVENTS];
 #endif
 } gcpu_t;
 
@@ -309,7 +342,9 @@ typedef struct shared_cpu {
 
 	tlbmap_t tlb1_inuse;
 
+	/** Clock hand and reference bits for replacing guest TLB1 entries */
 	int evict_tlb1;
+	tlbmap_t tlb1_ref;
 
 	/* lrat entries are allocated in a round robin fashion */
 	int lrat_next_entry;
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* A slab pool hands out fixed-size objects of a single type.  Objects
+ * are carved from chunks of objs_per_slab objects, and freed objects go
+ * back on the pool's free list rather than to the general allocator, so
+ * allocation is O(1) and repeated allocate/free cycles (for example,
+ * across partition restarts) do not fragment the heap.
+ *
+ * Chunks are never returned to the heap.
+ */
+typedef struct slab_pool {
+	const char *name;
+	size_t objsize;
+	size_t align;
+	unsigned int objs_per_slab;
+
+	uint32_t lock;
+	void *free;             /**< free objects, linked through their first word */
+	unsigned long slabs;    /**< chunks allocated */
+	unsigned long bytes;    /**< total size of the chunks */
+	unsigned long avail;    /**< objects on the free list */
+	unsigned long inuse;    /**< objects handed out */
+	unsigned long peak;     /**< maximum of inuse */
+	unsigned long failed;   /**< allocations that could not be satisfied */
+} slab_pool_t;
+
+/** Define a pool for objects of the given type.
+ *
+ * The pool is listed by the "slabs" shell command.
+ */
+#define SLAB_POOL(x, type, nobj) \
+	slab_pool_t x = { \
+		.name = #type, \
+		.objsize = sizeof(type), \
+		.align = __alignof__(type), \
+		.objs_per_slab = (nobj), \
+	}; \
+	static __attribute__((used,section(".slabpools"))) \
+	slab_pool_t *_##x##_PTR = &x
+
+/** Like SLAB_POOL(), for objects that are not described by a type. */
+#define SLAB_POOL_SIZED(x, pname, size, alignment, nobj) \
+	slab_pool_t x = { \
+		.name = (pname), \
+		.objsize = (size), \
+		.align = (alignment), \
+		.objs_per_slab = (nobj), \
+	}; \
+	static __attribute__((used,section(".slabpools"))) \
+	slab_pool_t *_##x##_PTR = &x
+
+extern slab_pool_t *slab_pool_begin, *slab_pool_end;
+
+void *slab_alloc(slab_pool_t *pool);
+void slab_free(slab_pool_t *pool, void *obj);
+int slab_reserve(slab_pool_t *pool, unsigned long count);
+
+#endif
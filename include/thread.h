@@ -33,6 +33,9 @@
 #include <libos/list.h>
 #include <libos/io.h>
 
+/* Higher numbers are higher priority.  The run queues are indexed by
+ * a 32-bit bitmap, so there can be at most 32 priorities.
+ */
 #define NUM_PRIOS 2
 
 struct sched;
@@ -55,9 +58,20 @@ enum {
 typedef struct thread {	
 	libos_thread_t libos_thread; 
 	list_t rq_node; /* Run queue node */
+	list_t sched_node; /* Node in the scheduler's list of all threads */
 	struct sched *sched; /* Scheduler of CPU to which this thread is bound */
+	const char *name;
 	int prio, state;
 
+	/* Accounting, in timebase ticks.  runtime is brought up to date
+	 * when the thread is switched out.
+	 */
+	uint64_t runtime;
+	uint64_t last_run;    /* when the thread was last switched in */
+	uint64_t ready_since; /* when it became runnable, or 0 if running */
+	uint64_t wait_total, wait_max; /* time runnable but not running */
+	unsigned long runs, wakeups;
+
 	/* Can take gevents from hv-space -- set on the idle thread after init */
 	int can_take_gevent:1;
 } thread_t;
@@ -65,10 +79,29 @@ typedef struct thread {
 typedef struct sched {
 	cpu_t *sched_cpu; /* CPU which this scheduler controls */
 	list_t rq[NUM_PRIOS]; /* FIFO run queue per priority */
+	uint32_t rq_mask; /* bit n is set if rq[n] is not empty */
+	list_t threads; /* all threads bound to this CPU */
 	thread_t idle;
+	thread_t *cur; /* thread chosen by the last reschedule */
+	int slice_pending; /* time slice timer is on the wheel */
+	unsigned long switches, remote_wakeups, slices;
 	uint32_t lock;
 } sched_t;
 
+/* A copy of one thread's accounting, taken for the shell */
+typedef struct thread_stat {
+	const char *name;
+	int prio;
+	int state; /* sched_running means runnable but not current */
+	int current;
+	uint64_t runtime, wait_total, wait_max;
+	unsigned long runs, wakeups;
+} thread_stat_t;
+
+typedef struct sched_stat {
+	unsigned long switches, remote_wakeups, slices;
+} sched_stat_t;
+
 static inline thread_t *thread_from_libos(libos_thread_t *libos_thread)
 {
 	return to_container(libos_thread, thread_t, libos_thread);
@@ -89,14 +122,18 @@ static inline int is_idle(void)
 	return thread == &thread->sched->idle;
 }
 
-thread_t *new_thread(void (*func)(trapframe_t *regs, void *arg),
+thread_t *new_thread(const char *name,
+                     void (*func)(trapframe_t *regs, void *arg),
                      void *arg, int prio);
-void new_thread_inplace(thread_t *thread, uint8_t *stack,
+void new_thread_inplace(thread_t *thread, const char *name, uint8_t *stack,
                         void (*func)(trapframe_t *regs, void *arg),
                         void *arg, int prio);
  
 void sched_core_init(cpu_t *sched_cpu);
 void sched_init(void);
+void sched_set_timeslice(uint64_t ticks);
+int sched_snapshot(unsigned int coreid, sched_stat_t *ss,
+                   thread_stat_t *ts, int max);
 
 void unblock(thread_t *thread);
 void schedule(trapframe_t *regs);
@@ -28,6 +28,24 @@
 #include <stdint.h>
 #include <percpu.h>
 
+/* log2 of the timer wheel tick, in timebase ticks */
+#define TIMER_WHEEL_SHIFT 12
+
+/** A one-shot hypervisor timer
+ *
+ * The callback runs in FIT interrupt context on the CPU the timer
+ * was added on, no earlier than expires and up to one wheel tick
+ * later.
+ */
+typedef struct hv_timer {
+	struct hv_timer *next;
+	uint64_t expires;                     /**< timebase value */
+	void (*fn)(struct hv_timer *timer);
+} hv_timer_t;
+
+void hv_timer_add(hv_timer_t *timer, uint64_t expires);
+unsigned int timer_wheel_fp(void);
+
 void run_deferred_decrementer(void);
 void run_deferred_fit(void);
 void enable_tcr_die(void);
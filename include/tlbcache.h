@@ -29,9 +29,36 @@
 
 #include <paging.h>
 
-#define TLBC_WAYS 4
+/* The number of ways and index bits are selected per partition with
+ * the tlb-cache-ways and tlb-cache-index-bits properties.
+ */
+#define TLBC_MIN_WAYS 2
+#define TLBC_MAX_WAYS 8
+#define TLBC_DEFAULT_WAYS 4
 
 #define TLBC_MIN_IDX_BITS 10
+#define TLBC_MAX_IDX_BITS 14
+#define TLBC_DEFAULT_IDX_BITS 12
+
+/* A set consists of the tags for all ways, followed by the entries
+ * for all ways.  Each way takes 16 bytes (with padding on 32-bit), so
+ * a 4-way set is one cache line.
+ */
+#define TLBC_WAY_SHIFT 4
+
+/* PIDs are hashed into this many buckets, each of which has a bitmap
+ * of the sets that may hold a translation for a PID in that bucket.
+ * This lets a PID invalidation skip sets that cannot match.
+ */
+#define TLBC_PID_BUCKETS 64
+
+/* Size in bytes of the PID bitmaps for a cache with 1 << bits sets */
+#define TLBC_PIDMAP_SIZE(bits) ((TLBC_PID_BUCKETS << (bits)) / 8)
+
+/* Number of generations before the cache must really be cleared;
+ * this is limited by the size of tlbcentry_t.gen.
+ */
+#define TLBC_GENERATIONS 256
 
 /* Do not touch these structures without updating the TLB miss handler. */
 typedef union tlbctag {
@@ -42,9 +69,8 @@ typedef union tlbctag {
 	 */
 	struct {
 
-		/* This assumes 10 bits of TLB index, corresponding to a
-		 * 64KiB TLB cache.  For larger caches, the high-order bits
-		 * are zero.
+		/* This assumes at least TLBC_MIN_IDX_BITS bits of TLB
+		 * index.  With more index bits, the high-order bits are zero.
 		 */
 #ifndef CONFIG_LIBOS_64BIT
 		uintptr_t vaddr:10;
@@ -70,14 +96,51 @@ typedef struct tlbcentry {
 			uint32_t tsize:4;
 			uint32_t mas8:2; /* TGS/VF only */
 			uint32_t gmas3:6; /* guest rwx bits */
+			uint32_t gen:8; /* see tlbcache_gen */
 		};
 	};
 } tlbcentry_t;
 
-typedef struct __attribute__((aligned(64))) tlbcset {
-	tlbctag_t tag[TLBC_WAYS];
-	tlbcentry_t entry[TLBC_WAYS];
-} tlbcset_t;
+/* Opaque, as the layout depends on the number of ways.
+ * Use the accessors below, which take the CPU that owns the cache.
+ */
+typedef struct tlbcset tlbcset_t;
+
+static inline tlbcset_t *tlbc_get_set(cpu_t *c, unsigned int index)
+{
+	unsigned int shift = TLBC_WAY_SHIFT + c->client.tlbcache_way_bits;
+
+	return (tlbcset_t *)((uintptr_t)c->client.tlbcache +
+	                     ((uintptr_t)index << shift));
+}
+
+static inline unsigned int tlbc_set_index(cpu_t *c, tlbcset_t *set)
+{
+	unsigned int shift = TLBC_WAY_SHIFT + c->client.tlbcache_way_bits;
+
+	return ((uintptr_t)set - (uintptr_t)c->client.tlbcache) >> shift;
+}
+
+static inline tlbctag_t *tlbc_tag(tlbcset_t *set, unsigned int way)
+{
+	return &((tlbctag_t *)set)[way];
+}
+
+static inline tlbcentry_t *tlbc_entry(cpu_t *c, tlbcset_t *set,
+                                      unsigned int way)
+{
+	tlbctag_t *tags = (tlbctag_t *)set;
+
+	return &((tlbcentry_t *)&tags[c->client.tlbcache_ways])[way];
+}
+
+/* Size in bytes of a TLB cache with the given geometry */
+#define TLBC_SIZE(ways, bits) ((uintptr_t)(ways) << (TLBC_WAY_SHIFT + (bits)))
+
+/* MAS0_GET_TLB0ESEL() is sized for the hardware TLB0, which may have
+ * fewer ways than the TLB cache.
+ */
+#define TLBC_GET_ESEL(mas0) MAS0_GET_TLB1ESEL(mas0)
 
 static inline tlbctag_t make_tag(uintptr_t vaddr, unsigned int pid, unsigned int space)
 {
@@ -92,11 +155,30 @@ static inline tlbctag_t make_tag(uintptr_t vaddr, unsigned int pid, unsigned int
 	return tag;
 }
 
-void tlbcache_init(void);
+/* Entries written before the last tlbcache_inv_all() have a stale
+ * generation, and are treated as invalid.
+ */
+static inline int tlbc_valid(cpu_t *c, tlbcset_t *set, unsigned int way)
+{
+	return tlbc_tag(set, way)->valid &&
+	       tlbc_entry(c, set, way)->gen == c->client.tlbcache_gen;
+}
+
+void tlbcache_init(unsigned int ways, unsigned int bits);
+void gtlb0_to_mas(unsigned int index, unsigned int way, struct gcpu *gcpu);
+
+/* These only operate on the cache contents, not on the hardware TLB.
+ * See tlbcache.c.
+ */
 int find_gtlb_entry(uintptr_t vaddr, tlbctag_t tag, tlbcset_t **setp,
                     unsigned int *way);
-void gtlb0_to_mas(unsigned int index, unsigned int way, struct gcpu *gcpu);
 int check_tlb1_conflict(uintptr_t epn, unsigned int tsize,
                         unsigned int pid, unsigned int space);
+int tlbcache_insert(uintptr_t vaddr, tlbctag_t tag, unsigned int esel,
+                    const tlbcentry_t *entry,
+                    uintptr_t *oldvaddr, unsigned int *oldpid);
+void tlbcache_inv_all(void);
+void tlbcache_inv_pid(unsigned int pid);
+void tlbcache_inv_va(uintptr_t vaddr, int pid);
 
 #endif
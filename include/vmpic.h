@@ -28,6 +28,8 @@
 #include <libos/trapframe.h>
 #include <percpu.h>
 #include <handle.h>
+#include <slab.h>
+#include <timers.h>
 
 struct dev_owner;
 
@@ -44,17 +46,56 @@ typedef struct vmpic_interrupt {
 
 	int config;
 
+	/* Set when the guest has chosen a destination itself, which the
+	 * balancer then leaves alone.
+	 */
+	int pinned;
+
+	/* EOIs seen, and per-second rate at the last balancer sample */
+	unsigned long count, last_count;
+	unsigned long rate;
+
 #ifdef CONFIG_CLAIMABLE_DEVICES
 	claim_action_t claim_action;
 	int claimed;
 #endif
 } vmpic_interrupt_t;
 
+typedef enum {
+	balance_none,    /* only sample rates */
+	balance_spread,  /* spread busy sources over all vcpus */
+	balance_isolate, /* spread them over all vcpus but the first */
+} balance_policy_t;
+
+/* Hypervisor-side balancing of a partition's physical interrupts,
+ * configured by "irq-balance" and friends in the partition node.
+ * Sampling and moving are done by a thread of its own, which the
+ * timer only wakes.
+ */
+typedef struct vmpic_balance {
+	hv_timer_t timer;
+	struct thread *thread;
+	guest_t *guest;
+	balance_policy_t policy;
+	uint64_t interval;        /* timebase ticks between samples */
+	uint64_t last_sample;     /* timebase at the last sample, or 0 */
+	unsigned long threshold;  /* interrupts/s to count as busy */
+	unsigned long moves;      /* retargets done so far */
+	unsigned int idle;        /* samples in a row with nothing busy */
+	int timer_pending;        /* timer is on the wheel */
+} vmpic_balance_t;
+
+/* vmpic_interrupt_t objects come from this pool */
+extern slab_pool_t vmpic_irq_pool;
+
 vmpic_interrupt_t *vmpic_alloc_handle(guest_t *guest, interrupt_t *irq,
                                       int config, int standby);
 int vmpic_alloc_mpic_handle(struct dev_owner *owner, interrupt_t *irq, int standby);
 void vmpic_global_init(void);
 void vmpic_partition_init(guest_t *guest);
+void vmpic_balance_start(guest_t *guest);
+int vmpic_irq_target(vmpic_interrupt_t *vmirq);
+const char *vmpic_balance_policy_name(balance_policy_t policy);
 void hcall_int_set_config(trapframe_t *regs);
 void hcall_int_get_config(trapframe_t *regs);
 void hcall_int_set_mask(trapframe_t *regs);
@@ -29,29 +29,82 @@
 #include <libos/trapframe.h>
 #include <stdint.h>
 
-#define MAX_VINT_CNT 64
+/* A partition gets DEFAULT_VINT_CNT virtual interrupts unless its
+ * config node asks for more with "vpic-irqs".  Two levels of bitmap
+ * must cover MAX_VINT_CNT, so it may not exceed LONG_BITS squared.
+ */
+#define DEFAULT_VINT_CNT 64
+#define MAX_VINT_CNT 1024
 #define MAX_VINT_INDEX ((MAX_VINT_CNT + LONG_BITS - 1) / LONG_BITS)
 
+/* Number of virtual interrupt priorities; higher numbers win. */
+#define VPIC_PRIOS 16
+
+/* Vector reported in GEPR when the only thing to deliver is posted
+ * interrupts, see vpic.c.
+ */
+#define VPIC_POST_VECTOR 0xfffe
+#define VPIC_POST_WORDS 32 /* enough for MAX_HANDLES */
+
+/* Interrupt posting page shared with a vcpu.  All fields are written
+ * by both sides, with atomic operations for summary and posted.
+ */
+typedef struct vpic_post_page {
+	uint32_t enable;    /* set by the guest to have interrupts posted */
+	uint32_t summary;   /* bit n set if posted[n] may be non-zero */
+	uint32_t need_iack; /* other interrupts are waiting for iack */
+	uint32_t reserved[13];
+	uint32_t posted[VPIC_POST_WORDS]; /* indexed by vmpic handle */
+} vpic_post_page_t;
+
 struct guest;
+struct gcpu;
 struct queue;
 
 typedef struct vpic_interrupt {
 	interrupt_t irq;
 	struct guest *guest;
 	uint32_t destcpu;
-	uint8_t enable, irqnum, pending, active, config;
+	uint16_t irqnum;
+	uint8_t enable, pending, active, config;
+	uint8_t priority;
+	uint8_t active_prio; /* priority it was made active at */
 	void (*eoi_callback)(struct vpic_interrupt *virq);
 } vpic_interrupt_t;
 
+/* The guest-wide lock only covers allocation, retargeting and
+ * reprioritizing interrupts.  An interrupt's pending and enable state
+ * is protected by the vpic_cpu_t lock of the vcpu it is routed to, and
+ * a vcpu's pending and active state by its own lock.
+ */
 typedef struct vpic {
-	vpic_interrupt_t ints[MAX_VINT_CNT];
-	int alloc_next;
+	vpic_interrupt_t *ints; /* allocated on first vpic_alloc_irq() */
+	int alloc_next, max_ints;
+	void *post; /* posting pages, one per vcpu, or NULL */
 	uint32_t lock;
+	unsigned long lock_contended;
 } vpic_t;
 
+/* Pending interrupts are kept in a two-level bitmap per priority:
+ * bit n of summary[prio] is set if pending[prio][n] is non-zero, and
+ * bit prio of prio_pending is set if summary[prio] is.  Finding the
+ * highest-priority pending interrupt takes three bit scans.
+ *
+ * An interrupt is only delivered if its priority is above that of
+ * every interrupt already active on the vcpu, so at most one
+ * interrupt is active at each priority.
+ */
 typedef struct vpic_cpu {
-	unsigned long active[MAX_VINT_INDEX];
-	unsigned long pending[MAX_VINT_INDEX];
+	unsigned long pending[VPIC_PRIOS][MAX_VINT_INDEX];
+	unsigned long summary[VPIC_PRIOS];
+	uint32_t prio_pending;
+
+	struct vpic_interrupt *active[VPIC_PRIOS];
+	uint32_t prio_active;
+
+	uint32_t lock;
+	unsigned long lock_contended; /* lock found held by another core */
+	unsigned long posted; /* interrupts delivered through the post page */
 } vpic_cpu_t;
 
 vpic_interrupt_t *vpic_alloc_irq(struct guest *guest, int config);
@@ -67,6 +120,10 @@ interrupt_t *vpic_iack(void);
 
 void vpic_unmask_parent(vpic_interrupt_t *virq);
 
+void vpic_init_posting(struct guest *guest);
+void vpic_reset_posting(struct guest *guest);
+int vpic_posted(struct gcpu *gcpu);
+
 extern int_ops_t vpic_ops;
 
 #endif
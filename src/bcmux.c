@@ -36,21 +36,34 @@
 #include <bcmux.h>
 #include <errors.h>
 #include <devtree.h>
+#include <slab.h>
 
 #include <string.h>
+#include <limits.h>
 
-static connected_bc_t *channel_find(mux_complex_t *mux, char id)
+static connected_bc_t *channel_find(mux_complex_t *mux, int id)
 {
-	connected_bc_t *bc = mux->first_bc;
+	if ((unsigned int)id >= MAX_MUX_CHANNELS)
+		return NULL;
 
-	while (bc) {
-		if (bc->num == id)
-			return bc;
+	return mux->channels[id];
+}
 
-		bc = bc->next;
-	}
+static int mux_quantum(connected_bc_t *cbc)
+{
+	return cbc->weight * MUX_QUANTUM;
+}
 
-	return NULL;
+/* Room for output, keeping within MUX_TX_BACKLOG */
+static size_t mux_tx_room(mux_complex_t *mux)
+{
+	queue_t *txq = mux->byte_chan->tx;
+	size_t avail = queue_get_avail(txq);
+
+	if (avail >= MUX_TX_BACKLOG)
+		return 0;
+
+	return min(queue_get_space(txq), MUX_TX_BACKLOG - avail);
 }
 
 /* Ctrl-X introduces a command, double Ctrl-X for a literal Ctrl-X */
@@ -64,6 +77,168 @@ static connected_bc_t *channel_find(mux_complex_t *mux, char id)
  */
 #define TX_RESET 0x01
 
+/* After Ctrl-X, Ctrl-B from the remote end asks to switch to framed
+ * mode.  We acknowledge with the same sequence.  Everything the remote
+ * end sends after its request is framed, and everything we send after
+ * the acknowledgement.
+ */
+#define FRAMED_REQ 0x02
+
+/* Receive state within a frame */
+#define RX_FRAME_SOF     0
+#define RX_FRAME_CHANNEL 1
+#define RX_FRAME_LEN     2
+#define RX_FRAME_PAYLOAD 3
+
+/* Limit on bytes moved per pull, to limit latency */
+#define PULL_LIMIT        64
+#define PULL_LIMIT_FRAMED (4 * MUX_FRAME_MAX)
+
+/** Demultiplex incoming frames
+ *
+ * Called with the mux's rx_lock held.  Payloads are moved a run at a
+ * time, rather than a character at a time.
+ *
+ * @param[in] notify a connected channel's tx queue that has had data
+ * written but its consumer not yet notified, or NULL
+ * @return the queue still to be notified, or NULL
+ */
+static queue_t *mux_get_frames(mux_complex_t *mux, int blocking,
+                               queue_t *notify)
+{
+	queue_t *rxq = mux->byte_chan->rx;
+	int ch, len, ret;
+
+	while (1) {
+		if (mux->rx_frame_state == RX_FRAME_PAYLOAD) {
+			len = min(mux->rx_frame_left, MUX_FRAME_MAX);
+			len = queue_read(rxq, mux->rx_frame, len, 0);
+			if (len <= 0)
+				break;
+
+			mux->rx_count += len;
+			mux->rx_frame_left -= len;
+			if (!mux->rx_frame_left)
+				mux->rx_frame_state = RX_FRAME_SOF;
+
+			connected_bc_t *cbc = mux->current_rx_bc;
+			if (!cbc) {
+				mux->rx_discarded += len;
+				continue;
+			}
+
+			queue_t *txq = cbc->byte_chan->tx;
+
+			/* As with unframed data, discard what does not fit
+			 * rather than stall the other channels.
+			 */
+			ret = max(queue_write(txq, mux->rx_frame, len), 0);
+			if (ret < len) {
+				mux->rx_discarded += len - ret;
+				cbc->rx_dropped += len - ret;
+			}
+
+			if (ret > 0) {
+				cbc->rx_bytes += ret;
+				byte_chan_note_fill(txq, &cbc->byte_chan->tx_hwm);
+				notify = txq;
+			}
+
+			continue;
+		}
+
+		ch = queue_readchar(rxq, 0);
+		if (ch < 0)
+			break;
+
+		mux->rx_count++;
+
+		switch (mux->rx_frame_state) {
+		case RX_FRAME_SOF:
+			if (ch == MUX_FRAME_SOF)
+				mux->rx_frame_state = RX_FRAME_CHANNEL;
+			else
+				mux->rx_discarded++;
+
+			break;
+
+		case RX_FRAME_CHANNEL:
+			if (notify) {
+				queue_notify_consumer(notify, blocking);
+				notify = NULL;
+			}
+
+			mux->current_rx_bc = channel_find(mux, ch);
+			mux->rx_frame_state = RX_FRAME_LEN;
+			break;
+
+		case RX_FRAME_LEN:
+			mux->rx_frame_left = ch;
+			mux->rx_frame_state = ch ? RX_FRAME_PAYLOAD : RX_FRAME_SOF;
+			break;
+		}
+	}
+
+	return notify;
+}
+
+/* Queue the framed mode acknowledgement, if it is owed, and frame
+ * what is sent from then on.  Called with the mux's tx_lock held.
+ * Returns zero if there is still no room for it.
+ */
+static int mux_send_framed_ack(mux_complex_t *mux)
+{
+	queue_t *txq = mux->byte_chan->tx;
+	int ret;
+
+	if (!mux->framed_ack)
+		return 1;
+
+	if (queue_get_space(txq) < 2)
+		return 0;
+
+	ret = queue_writechar(txq, CH_SWITCH_ESCAPE);
+	assert(ret == 0);
+	ret = queue_writechar(txq, FRAMED_REQ);
+	assert(ret == 0);
+
+	mux->current_tx_bc = NULL;
+	mux->framed_ack = 0;
+	smp_mbar();
+	mux->framed = 1;
+
+	printlog(LOGTYPE_BCMUX, LOGLEVEL_NORMAL,
+	         "bcmux: switched to framed mode\n");
+	return 1;
+}
+
+static void mux_send_data_pull(queue_t *q);
+
+/* Switch to framed mode at the remote end's request.  Called with
+ * the mux's rx_lock held.
+ *
+ * What follows the request is framed already.  What we send stays
+ * unframed until the acknowledgement is queued; if the stream is full,
+ * mux_send_data_pull() queues it once there is room.
+ */
+static void mux_enter_framed(mux_complex_t *mux)
+{
+	mux->rx_frame_state = RX_FRAME_SOF;
+	mux->rx_framed = 1;
+
+	spin_lock(&mux->byte_chan->tx_lock);
+
+	mux->framed_ack = 1;
+	if (!mux_send_framed_ack(mux)) {
+		printlog(LOGTYPE_BCMUX, LOGLEVEL_DEBUG,
+		         "%s: no room to acknowledge framed mode yet\n",
+		         __func__);
+		mux->byte_chan->tx->space_avail = mux_send_data_pull;
+	}
+
+	spin_unlock(&mux->byte_chan->tx_lock);
+}
+
 /** Demultiplex incoming data
  *
  * This function reads data from multiplexed channel and writes it
@@ -82,6 +257,12 @@ static void mux_get_data(queue_t *q, int blocking)
 	}
 
 	register_t saved = spin_lock_intsave(&mux->byte_chan->rx_lock);
+	int ack = 0;
+
+	if (mux->rx_framed) {
+		notify = mux_get_frames(mux, blocking, NULL);
+		goto out;
+	}
 
 	/* Add a string to byte channel */
 	while ((ch = queue_readchar(mux->byte_chan->rx, 0)) >= 0) {
@@ -94,6 +275,13 @@ static void mux_get_data(queue_t *q, int blocking)
 				continue;
 			}
 
+			if (ch == FRAMED_REQ) {
+				mux_enter_framed(mux);
+				notify = mux_get_frames(mux, blocking, notify);
+				ack = 1;
+				break;
+			}
+
 			if (ch >= CHAN0_MUX_CHAR) {
 				if (notify) {
 					queue_notify_consumer(notify, blocking);
@@ -130,15 +318,24 @@ static void mux_get_data(queue_t *q, int blocking)
 			 * rather than stop processing input that could be
 			 * for another channel.
 			 */
-			if (ret < 0)
+			if (ret < 0) {
 				mux->rx_discarded++;
-			else
+				mux->current_rx_bc->rx_dropped++;
+			} else {
+				mux->current_rx_bc->rx_bytes++;
+				byte_chan_note_fill(txq,
+					&mux->current_rx_bc->byte_chan->tx_hwm);
 				notify = txq;
+			}
 		}
 	}
 
+out:
 	spin_unlock_intsave(&mux->byte_chan->rx_lock, saved);
 
+	if (ack)
+		queue_notify_consumer(mux->byte_chan->tx, blocking);
+
 	if (notify)
 		queue_notify_consumer(notify, blocking);
 };
@@ -165,19 +362,72 @@ static int mux_tx_switch(mux_complex_t *mux, connected_bc_t *cbc)
 	return 0;
 }
 
-static int __mux_send_data(mux_complex_t *mux, connected_bc_t *cbc)
+/* Send one frame of at most limit bytes of a connected channel's
+ * pending data.  Returns the payload length, or -1 if there is no
+ * room for a frame.
+ */
+static int __mux_send_frame(mux_complex_t *mux, connected_bc_t *cbc,
+                            int limit)
+{
+	queue_t *txq = mux->byte_chan->tx;
+	size_t space = mux_tx_room(mux);
+	int len, ret;
+
+	if (space <= MUX_FRAME_HDR)
+		return -1;
+
+	len = min(space - MUX_FRAME_HDR, (size_t)MUX_FRAME_MAX);
+	len = min(len, limit);
+	len = queue_read(cbc->byte_chan->rx, mux->tx_frame + MUX_FRAME_HDR,
+	                 len, 0);
+	if (len <= 0)
+		return 0;
+
+	mux->tx_frame[0] = MUX_FRAME_SOF;
+	mux->tx_frame[1] = cbc->num;
+	mux->tx_frame[2] = len;
+
+	ret = queue_write(txq, mux->tx_frame, len + MUX_FRAME_HDR);
+	assert(ret == len + MUX_FRAME_HDR);
+
+	return len;
+}
+
+/** Send up to limit bytes of a connected channel's pending data
+ *
+ * @return the number of the channel's bytes sent, or -1 if there
+ * was no room in the multiplexed stream to send anything
+ */
+static int __mux_send_data(mux_complex_t *mux, connected_bc_t *cbc,
+                           int limit)
 {
-	int ret, c, sent;
+	int ret = 0, c, sent = 0;
 
 	if (queue_empty(cbc->byte_chan->rx))
 		return 0;
 
-	if (queue_get_space(mux->byte_chan->tx) < 2)
+	if (mux->framed) {
+		while (sent < limit) {
+			ret = __mux_send_frame(mux, cbc, limit - sent);
+			if (ret <= 0)
+				break;
+
+			sent += ret;
+		}
+
+		if (ret < 0 && !sent)
+			return -1;
+
+		cbc->tx_bytes += sent;
+		return sent;
+	}
+
+	if (mux_tx_room(mux) < 2)
 		return -1;
 
-	sent = mux_tx_switch(mux, cbc);
+	mux_tx_switch(mux, cbc);
 
-	while (queue_get_space(mux->byte_chan->tx) >= 2) {
+	while (sent < limit && mux_tx_room(mux) >= 2) {
 		c = queue_readchar(cbc->byte_chan->rx, 0);
 		if (c < 0)
 			break;
@@ -191,21 +441,30 @@ static int __mux_send_data(mux_complex_t *mux, connected_bc_t *cbc)
 			assert(ret >= 0);
 			ret = queue_writechar(mux->byte_chan->tx, c);
 			assert(ret >= 0);
-			sent += 2;
 		} else {
 			ret = queue_writechar(mux->byte_chan->tx, c);
 			assert(ret >= 0);
-			sent++;
 		}
+
+		sent++;
 	}
 
+	cbc->tx_bytes += sent;
 	return sent;
 };
 
+/** Send backlogged data when the multiplexed stream has room
+ *
+ * Channels are served by deficit round robin: each backlogged channel
+ * may send mux_quantum() bytes per turn, so a busy channel cannot
+ * starve the others.  A turn interrupted by lack of room resumes on
+ * the next call.
+ */
 static void mux_send_data_pull(queue_t *q)
 {
 	mux_complex_t *mux = q->producer;
-	int ret, total = 0;
+	connected_bc_t *cbc;
+	int ret, total = 0, idle = 0, limit;
 
 	if (spin_lock_held(&mux->byte_chan->tx_lock)) {
 		printlog(LOGTYPE_BCMUX, LOGLEVEL_ERROR,
@@ -215,36 +474,56 @@ static void mux_send_data_pull(queue_t *q)
 
 	register_t saved = spin_lock_intsave(&mux->byte_chan->tx_lock);
 
-	connected_bc_t *first_cbc = mux->next_tx_pull_bc;
-	if (!first_cbc)
-		first_cbc = mux->first_bc;
+	/* Nothing else goes out before a pending acknowledgement. */
+	if (!mux_send_framed_ack(mux))
+		goto out;
+
+	limit = mux->framed ? PULL_LIMIT_FRAMED : PULL_LIMIT;
 
-	connected_bc_t *cbc = first_cbc;
+	cbc = mux->next_tx_pull_bc;
+	if (!cbc)
+		cbc = mux->first_bc;
 
-	do {
-		ret = __mux_send_data(mux, cbc);
-		if (ret > 0)
-			queue_notify_producer(cbc->byte_chan->rx);
+	/* Limit total work per invocation to limit latency. */
+	while (total < limit && idle < mux->num_of_channels) {
+		if (queue_empty(cbc->byte_chan->rx)) {
+			cbc->deficit = 0;
+			idle++;
+		} else {
+			idle = 0;
 
-		/* If the output queue is full, the current channel did not have
-		 * the chance to send any data, so start with this channel next time
-		 */
-		if (ret < 0) /* no more room */
-			break;
+			if (cbc->deficit <= 0)
+				cbc->deficit += mux_quantum(cbc);
+
+			ret = __mux_send_data(mux, cbc, cbc->deficit);
+			if (ret < 0) /* no more room */
+				break;
+
+			if (ret > 0) {
+				cbc->deficit -= ret;
+				total += ret;
+				queue_notify_producer(cbc->byte_chan->rx);
+			}
+
+			/* Out of room part way through the turn: finish
+			 * it next time.
+			 */
+			if (cbc->deficit > 0 && !queue_empty(cbc->byte_chan->rx))
+				break;
+		}
 
 		cbc = cbc->next;
 		if (!cbc)
 			cbc = mux->first_bc;
-
-		/* Limit total work per invocation to limit latency. */
-		total += ret;
-	} while (cbc != first_cbc && total < 64);
+	}
 
 	/* If there was no data to be sent, remove the pull callback. */
-	if (ret == 0 && total == 0)
+	if (idle >= mux->num_of_channels)
 		q->space_avail = NULL;
 
 	mux->next_tx_pull_bc = cbc;
+
+out:
 	spin_unlock_intsave(&mux->byte_chan->tx_lock, saved);
 }
 
@@ -253,6 +532,7 @@ static void mux_send_data_push(queue_t *q, int blocking)
 	connected_bc_t *cbc = q->consumer;
 	mux_complex_t *mux = cbc->mux_complex;
 	int lock = !unlikely(cpu->crashing);
+	int fair = lock && !blocking;
 	register_t saved = disable_int_save();
 	int ret;
 
@@ -269,30 +549,48 @@ static void mux_send_data_push(queue_t *q, int blocking)
 	if (blocking)
 		queue_notify_consumer(mux->byte_chan->tx, 1);
 
+	/* If channels are already waiting for room, take a turn with
+	 * them in mux_send_data_pull() rather than jumping the queue.
+	 * Blocking and crash output goes straight out.
+	 */
+	if (fair && mux->byte_chan->tx->space_avail)
+		goto out;
+
+	if (!mux_send_framed_ack(mux)) {
+		mux->byte_chan->tx->space_avail = mux_send_data_pull;
+		goto out;
+	}
+
 again: 
-	ret = __mux_send_data(mux, cbc);
+	ret = __mux_send_data(mux, cbc, fair ? mux_quantum(cbc) : INT_MAX);
 	if (ret > 0)
 		queue_notify_consumer(mux->byte_chan->tx, blocking);
 
 	if (!queue_empty(cbc->byte_chan->rx)) {
-		/* If we ran out of space, arm the pull callback. */
+		/* If we ran out of space or quantum, arm the pull callback. */
 		mux->byte_chan->tx->space_avail = mux_send_data_pull;
 		smp_sync();
 
-		/* Check again to see if there was a race, and space was
-		 * alredy made available.  We assume the queue size is
-		 * larger than 16.
+		/* Check again to see if there was a race, and the stream
+		 * was already drained, so that the pull callback will not
+		 * be called.  For unfair sends, we assume MUX_TX_BACKLOG
+		 * and the queue size are larger than 16.
 		 */
-		if (queue_get_space(mux->byte_chan->tx) >= 16)
+		if (fair ? queue_empty(mux->byte_chan->tx) :
+		           mux_tx_room(mux) >= 16)
 			goto again;
 	}
 
+out:
 	if (lock)
 		spin_unlock(&mux->byte_chan->tx_lock);
 
 	restore_int(saved);
 }
 
+static SLAB_POOL(mux_complex_pool, mux_complex_t, 8);
+static SLAB_POOL(connected_bc_pool, connected_bc_t, 32);
+
 /** Create a byte channel multiplexer.
  *
  * @param[in] bc byte channel handle of multiplexed stream
@@ -304,7 +602,7 @@ static mux_complex_t *mux_complex_init(byte_chan_t *bc)
 	if (!handle)
 		return NULL;
 
-	mux_complex_t *mux = alloc_type(mux_complex_t);
+	mux_complex_t *mux = slab_alloc(&mux_complex_pool);
 	if (!mux)
 		return NULL;
 
@@ -333,18 +631,22 @@ int mux_complex_add(mux_complex_t *mux, byte_chan_t *bc,
 	if ((unsigned char)multiplexing_id >= MAX_MUX_CHANNELS)
 		return ERR_RANGE;
 
+	if (mux->channels[(unsigned char)multiplexing_id])
+		return ERR_BUSY;
+
 	byte_chan_handle_t *handle = byte_chan_claim(bc);
 	if (!handle)
 		return ERR_BUSY;
 
 	connected_bc_t *cbc;
-	cbc = alloc_type(connected_bc_t);
+	cbc = slab_alloc(&connected_bc_pool);
 	if (!cbc)
 		return ERR_NOMEM;
 
 	cbc->num = multiplexing_id;
 	cbc->byte_chan = handle;
 	cbc->mux_complex = mux;
+	cbc->weight = 1;
 
 	handle->tx->producer = cbc;
 	handle->rx->consumer = cbc;
@@ -366,13 +668,16 @@ int mux_complex_add(mux_complex_t *mux, byte_chan_t *bc,
 		bc_chain->next = cbc;
 	}
 
+	mux->channels[(unsigned char)multiplexing_id] = cbc;
 	mux->num_of_channels++;
 
 	/* Not much we can easily do if these fail -- but it's init time,
 	 * so they shouldn't.
 	 */
-	queue_writechar(mux->byte_chan->tx, CH_SWITCH_ESCAPE);
-	queue_writechar(mux->byte_chan->tx, TX_RESET);
+	if (!mux->framed) {
+		queue_writechar(mux->byte_chan->tx, CH_SWITCH_ESCAPE);
+		queue_writechar(mux->byte_chan->tx, TX_RESET);
+	}
 
 	spin_unlock(&mux->byte_chan->tx_lock);
 	spin_unlock_intsave(&mux->byte_chan->rx_lock, saved);
@@ -381,6 +686,27 @@ int mux_complex_add(mux_complex_t *mux, byte_chan_t *bc,
 	return 0;
 }
 
+/** Set a connected channel's share of the multiplexed stream
+ *
+ * @param[in] mux multiplexer the channel is registered with
+ * @param[in] multiplexing_id channel descriptor
+ * @param[in] weight relative share, from 1 to MUX_MAX_WEIGHT
+ */
+int mux_complex_set_weight(mux_complex_t *mux, char multiplexing_id,
+                           int weight)
+{
+	connected_bc_t *cbc = channel_find(mux, (unsigned char)multiplexing_id);
+
+	if (!cbc)
+		return ERR_NOTFOUND;
+
+	if (weight < 1 || weight > MUX_MAX_WEIGHT)
+		return ERR_RANGE;
+
+	cbc->weight = weight;
+	return 0;
+}
+
 static byte_chan_t *mux_attach_byte_chan(dt_node_t *muxnode, dt_node_t *bcnode)
 {
 	if (dt_node_is_compatible(bcnode, "byte-channel"))
@@ -453,6 +779,12 @@ static int create_mux(dt_node_t *node, void *arg)
 	if (!mux)
 		return ERR_NOMEM;
 
+	/* The remote end is configured for frames from the start,
+	 * rather than asking for them.
+	 */
+	if (dt_get_prop(node, "framed", 0))
+		mux->framed = mux->rx_framed = 1;
+
 	node->bcmux = mux;
 	return 0;
 }
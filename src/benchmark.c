@@ -27,6 +27,8 @@
 #include <libos/queue.h>
 #include <libos/bitops.h>
 #include <libos/alloc.h>
+#include <libos/libos.h>
+#include <libos/printlog.h>
 
 #include <benchmark.h>
 #include <percpu.h>
@@ -55,6 +57,8 @@ const char *benchmark_names[num_benchmarks] = {
 	"emulated inst - other",
 	/* hcalls start here */
 	"vmpic eoi",
+	"byte channel sendv",
+	"byte channel receivev",
 	"hcall - other",
 	/* other tracked exceptions go here */
 	"machine check",
@@ -74,6 +78,10 @@ const char *benchmark_names[num_benchmarks] = {
 	"tlb miss count",
 	"tlb miss reflected",
 	"tlb miss",
+	"tlb1 refill",
+	"tlb1 eviction",
+	"gphys xlate hit",
+	"gphys xlate miss",
 	"altivec unavail",
 	"altivec assist",
 	"lrat miss",
@@ -82,6 +90,7 @@ const char *benchmark_names[num_benchmarks] = {
 	"tlbcache inv all",
 	"tlb1 inv",
 	"tlb write",
+	"gphys copy",
 };
 
 void statistics_stop(uint32_t start, int bmnum)
@@ -99,3 +108,69 @@ void statistics_stop(uint32_t start, int bmnum)
 	if (bm->max < diff)
 		bm->max = diff;
 }
+
+/* Like statistics_stop(), also accounting for the amount of data
+ * moved.  Like statistics_count(), this tolerates a CPU that is not
+ * running a guest, as copies are also done while loading partitions.
+ */
+void statistics_stop_bytes(uint32_t start, int bmnum, size_t bytes)
+{
+	gcpu_t *gcpu = get_gcpu();
+
+	if (!gcpu)
+		return;
+
+	statistics_stop(start, bmnum);
+	gcpu->benchmarks[bmnum].bytes += bytes;
+}
+
+/* Count an event that is not timed.  Events on a CPU that
+ * is not running a guest are not counted.
+ */
+void statistics_count(int bmnum)
+{
+	gcpu_t *gcpu = get_gcpu();
+
+	if (gcpu)
+		gcpu->benchmarks[bmnum].num++;
+}
+
+/* Allocate the current gcpu's per-hcall statistics.  Called from
+ * core_init(); if the allocation fails, hcalls on this CPU are not
+ * counted.
+ */
+void hcall_stat_init(void)
+{
+	gcpu_t *gcpu = get_gcpu();
+
+	gcpu->hcall_stats = alloc(hcall_stat_count() * sizeof(hcall_stat_t),
+	                          __alignof__(hcall_stat_t));
+	if (!gcpu->hcall_stats)
+		printlog(LOGTYPE_MISC, LOGLEVEL_ERROR,
+		         "Couldn't allocate hcall statistics\n");
+}
+
+/* Account one hcall in the current gcpu's per-hcall statistics. */
+void hcall_stat_stop(uint32_t start, int index)
+{
+	gcpu_t *gcpu = get_gcpu();
+	hcall_stat_t *hs = gcpu->hcall_stats;
+	uint32_t diff = mfspr(SPR_TBL) - start;
+	int bucket;
+
+	if (unlikely(!hs))
+		return;
+
+	hs += index;
+	hs->accum += diff;
+	hs->num++;
+
+	if (hs->max < diff)
+		hs->max = diff;
+
+	bucket = diff > 1 ? ilog2(diff) : 0;
+	if (bucket >= HCALL_HIST_BUCKETS)
+		bucket = HCALL_HIST_BUCKETS - 1;
+
+	hs->hist[bucket]++;
+}
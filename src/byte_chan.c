@@ -33,6 +33,7 @@
 #include <libos/alloc.h>
 #include <libos/bitops.h>
 #include <libos/ns16550.h>
+#include <libos/epapr_hcalls.h>
 
 #include <byte_chan.h>
 #include <bcmux.h>
@@ -40,49 +41,301 @@
 #include <devtree.h>
 #include <vpic.h>
 #include <vmpic.h>
+#include <slab.h>
+#include <paging.h>
 
-/* Must be a power of two. */
+/* Default queue size, used when the config tree does not give one.
+ * Must be a power of two.
+ */
 #define QUEUE_SIZE 4096
 /* PS: Change QUEUE_SIZE back to 256 once we get to real hardware where the
  *     serial port is running at a reasonable speed with respect to the
- *     cores - 4096 bytes shouldn't be needed anymore. We increased this to
- *     4096 bytes now as we have 256 registers that in all ammount to 1156
- *     bytes. Given that in the Remote Serial Protocol, two bytes are
- *     transmitted per byte (upper and lower nibble); we need to be able to
- *     receive at least 2312 bytes using byte_channel_receive() for the G
- *     packet's (i.e. write registers) payload.
+ *     cores - 4096 bytes shouldn't be needed anymore.  The gdb stub does
+ *     not depend on the default: see GDB_STUB_QUEUE_MIN.
  */
 
-/* Allocate a byte channel. */
-byte_chan_t *byte_chan_alloc(void)
+/* Limits on tx-queue-size/rx-queue-size from the config tree */
+#define QUEUE_SIZE_MIN 64
+#define QUEUE_SIZE_MAX (1024 * 1024)
+
+/* We have 256 registers that in all amount to 1156 bytes.  In the
+ * Remote Serial Protocol, two bytes are transmitted per byte (upper and
+ * lower nibble), so the gdb stub must be able to receive at least 2312
+ * bytes for the G packet's (i.e. write registers) payload.  Queues to
+ * and from a gdb-stub node are never made smaller than this power of
+ * two, whatever the config tree asks for.
+ */
+#define GDB_STUB_QUEUE_MIN 4096
+
+/* Most bytes moved between guest memory and a queue or ring per lock
+ * hold, so that a large transfer does not hold off interrupts for its
+ * whole length.
+ */
+#define GPHYS_CHUNK 4096
+
+static SLAB_POOL(byte_chan_pool, byte_chan_t, 16);
+
+/** Total bytes of queue buffer allocated for byte channels */
+unsigned long byte_chan_queue_bytes;
+
+/* A direct ring outlives a partition reset, and the other partition
+ * may be using it throughout, so only the indices the resetting side
+ * writes are touched.  Data sent to the resetting partition that it
+ * had not read is dropped: its cons is advanced to prod, so the peer
+ * sees its data area drain and gets a tx interrupt if it was waiting
+ * for room.  Data the resetting partition had sent stays for the peer
+ * to read, as it would in a queue; prod cannot be pulled back under a
+ * reader.  The partition's next incarnation therefore finds the area
+ * it receives into empty, but the area it sends from may still hold
+ * data the peer has yet to read.  It must take its starting indices
+ * for both from the header rather than assume zero.
+ */
+static void byte_chan_direct_reset(byte_chan_handle_t *bc)
+{
+	byte_chan_direct_dir_t *tx = &bc->direct->dir[bc->direct_tx];
+	byte_chan_direct_dir_t *rx = &bc->direct->dir[!bc->direct_tx];
+
+	tx->want_space = 0;
+	rx->cons = rx->prod;
+
+	if (rx->want_space) {
+		rx->want_space = 0;
+		queue_notify_producer(bc->rx);
+	}
+}
+
+static void byte_chan_prereset(handle_t *h, int stop)
 {
-	byte_chan_t *ret = alloc_type(byte_chan_t);
+	byte_chan_handle_t *bc = h->bc;
+	register_t saved;
+
+	if (bc->direct)
+		byte_chan_direct_reset(bc);
+
+	/* Held-back interrupts were for the partition being reset. */
+	if (bc->rx_coalesce.deliver)
+		coalesce_reset(&bc->rx_coalesce, 0);
+	if (bc->tx_coalesce.deliver)
+		coalesce_reset(&bc->tx_coalesce, 0);
+
+	/* The ring lives in partition memory, and goes away with it. */
+	saved = spin_lock_intsave(&bc->tx_lock);
+	spin_lock(&bc->rx_lock);
+	bc->ring_size = 0;
+	spin_unlock(&bc->rx_lock);
+	spin_unlock_intsave(&bc->tx_lock, saved);
+}
+
+static handle_ops_t byte_chan_handle_ops = {
+	.prereset = byte_chan_prereset,
+};
+
+/** Allocate a byte channel with the given queue sizes
+ *
+ * @param[in] size0 size of the tx queue of the first handle claimed
+ * @param[in] size1 size of the tx queue of the second handle claimed
+ */
+byte_chan_t *byte_chan_alloc_sized(size_t size0, size_t size1)
+{
+	byte_chan_t *ret = slab_alloc(&byte_chan_pool);
 	if (!ret)
 		return NULL;
 
 	// FIXME: free() on failure
-	if (queue_init(&ret->q[0], QUEUE_SIZE))
+	if (queue_init(&ret->q[0], size0))
 		goto err_bc;
-	if (queue_init(&ret->q[1], QUEUE_SIZE))
+	if (queue_init(&ret->q[1], size1))
 		goto err_q0;
 
+	atomic_add(&byte_chan_queue_bytes, size0 + size1);
+
 	ret->handles[0].tx = &ret->q[0];
 	ret->handles[0].rx = &ret->q[1];
 	ret->handles[0].user.bc = &ret->handles[0];
+	ret->handles[0].user.ops = &byte_chan_handle_ops;
 
 	ret->handles[1].tx = &ret->q[1];
 	ret->handles[1].rx = &ret->q[0];
 	ret->handles[1].user.bc = &ret->handles[1];
+	ret->handles[1].user.ops = &byte_chan_handle_ops;
 
 	return ret;
 
 err_q0:
 	queue_destroy(&ret->q[0]);
 err_bc:
-	free(ret);
+	slab_free(&byte_chan_pool, ret);
 	return NULL;
 }
 
+/* Allocate a byte channel with default-sized queues. */
+byte_chan_t *byte_chan_alloc(void)
+{
+	return byte_chan_alloc_sized(QUEUE_SIZE, QUEUE_SIZE);
+}
+
+/* Return the queue size requested by a property of a byte-channel
+ * node, or zero if there is no valid one.
+ */
+static size_t get_queue_size(dt_node_t *node, const char *propname)
+{
+	dt_prop_t *prop = dt_get_prop(node, propname, 0);
+	uint32_t size;
+
+	if (!prop)
+		return 0;
+
+	if (prop->len != 4) {
+		printlog(LOGTYPE_BYTE_CHAN, LOGLEVEL_ERROR,
+		         "%s: %s has bad %s property\n",
+		         __func__, node->name, propname);
+		return 0;
+	}
+
+	size = *(const uint32_t *)prop->data;
+	if (size < QUEUE_SIZE_MIN || size > QUEUE_SIZE_MAX ||
+	    (size & (size - 1))) {
+		printlog(LOGTYPE_BYTE_CHAN, LOGLEVEL_ERROR,
+		         "%s: %s: %s %u is not a power of two from %d to %d\n",
+		         __func__, node->name, propname, size,
+		         QUEUE_SIZE_MIN, QUEUE_SIZE_MAX);
+		return 0;
+	}
+
+	return size;
+}
+
+/* Size of the queue carrying data from "from" to "to", either of
+ * which may be NULL or a non-byte-channel endpoint.  If both nodes
+ * specify a size, the larger is used.  A queue to or from a gdb stub
+ * is at least GDB_STUB_QUEUE_MIN.
+ */
+static size_t pick_queue_size(dt_node_t *from, dt_node_t *to)
+{
+	size_t size = 0;
+
+	if (from && dt_node_is_compatible(from, "byte-channel"))
+		size = get_queue_size(from, "tx-queue-size");
+
+	if (to && dt_node_is_compatible(to, "byte-channel"))
+		size = max(size, get_queue_size(to, "rx-queue-size"));
+
+	if (!size)
+		size = QUEUE_SIZE;
+
+	if (size < GDB_STUB_QUEUE_MIN &&
+	    ((from && dt_node_is_compatible(from, "gdb-stub")) ||
+	     (to && dt_node_is_compatible(to, "gdb-stub")))) {
+		printlog(LOGTYPE_BYTE_CHAN, LOGLEVEL_NORMAL,
+		         "%s: %s: queue size %zu raised to %d for the gdb stub\n",
+		         __func__, from ? from->name : to->name, size,
+		         GDB_STUB_QUEUE_MIN);
+		size = GDB_STUB_QUEUE_MIN;
+	}
+
+	return size;
+}
+
+/** Allocate a byte channel sized for a config tree node
+ *
+ * @param[in] node the byte-channel node
+ * @param[in] epnode the node's endpoint, or NULL
+ * @param[in] second non-zero if node's handle will be claimed after
+ *            the endpoint's
+ */
+static byte_chan_t *byte_chan_alloc_node(dt_node_t *node, dt_node_t *epnode,
+                                         int second)
+{
+	size_t tx = pick_queue_size(node, epnode);
+	size_t rx = pick_queue_size(epnode, node);
+
+	return second ? byte_chan_alloc_sized(rx, tx) :
+	                byte_chan_alloc_sized(tx, rx);
+}
+
+/* Return the guest physical address of a byte-channel node's direct
+ * ring, or -1 if it does not have a valid one.
+ */
+static phys_addr_t get_direct_addr(dt_node_t *node)
+{
+	dt_prop_t *prop = dt_get_prop(node, "direct-ring", 0);
+	const uint32_t *addr;
+	phys_addr_t gaddr;
+
+	if (!prop)
+		return -1;
+
+	if (prop->len != 8)
+		goto bad;
+
+	addr = prop->data;
+	gaddr = ((phys_addr_t)addr[0] << 32) | addr[1];
+	if (gaddr & (PAGE_SIZE - 1))
+		goto bad;
+
+	return gaddr;
+
+bad:
+	printlog(LOGTYPE_BYTE_CHAN, LOGLEVEL_ERROR,
+	         "%s: %s: direct-ring must be a page-aligned 64-bit address\n",
+	         __func__, node->name);
+	return -1;
+}
+
+/** Give a channel between two partitions a direct ring
+ *
+ * Both nodes must have a "direct-ring" property giving where the ring
+ * is mapped into their partition.  The size of each data area comes
+ * from "direct-ring-size" on either node, the larger if both.
+ * Otherwise, the channel carries its data in its queues.
+ *
+ * @param[in] bc the newly allocated channel, node's handle to be
+ *            claimed first
+ * @param[in] node the byte-channel node
+ * @param[in] epnode its byte-channel endpoint
+ */
+static void byte_chan_init_direct(byte_chan_t *bc, dt_node_t *node,
+                                  dt_node_t *epnode)
+{
+	byte_chan_direct_hdr_t *hdr;
+	size_t size = PAGE_SIZE;
+	int has_node = !!dt_get_prop(node, "direct-ring", 0);
+	int has_ep = !!dt_get_prop(epnode, "direct-ring", 0);
+
+	if (!has_node && !has_ep)
+		return;
+
+	if (has_node != has_ep) {
+		printlog(LOGTYPE_BYTE_CHAN, LOGLEVEL_ERROR,
+		         "%s: only one of %s and %s has direct-ring\n",
+		         __func__, node->name, epnode->name);
+		return;
+	}
+
+	if (get_direct_addr(node) == (phys_addr_t)-1 ||
+	    get_direct_addr(epnode) == (phys_addr_t)-1)
+		return;
+
+	size = max(size, get_queue_size(node, "direct-ring-size"));
+	size = max(size, get_queue_size(epnode, "direct-ring-size"));
+
+	hdr = alloc(PAGE_SIZE + 2 * size, PAGE_SIZE);
+	if (!hdr) {
+		printlog(LOGTYPE_BYTE_CHAN, LOGLEVEL_ERROR,
+		         "%s: %s: out of memory, using queues\n",
+		         __func__, node->name);
+		return;
+	}
+
+	memset(hdr, 0, PAGE_SIZE);
+
+	for (int i = 0; i < 2; i++) {
+		bc->handles[i].direct = hdr;
+		bc->handles[i].direct_size = size;
+		bc->handles[i].direct_tx = i;
+	}
+}
+
 uint32_t bchan_lock;
 
 byte_chan_handle_t *byte_chan_claim(byte_chan_t *bc)
@@ -196,7 +449,21 @@ static int connect_byte_channel(byte_chan_t *bc, dt_node_t *endpoint,
 			return 0;
 		}
 
-		return ret;
+		if (ret)
+			return ret;
+
+		dt_prop_t *weight = dt_get_prop(bcnode, "mux-weight", 0);
+		if (weight) {
+			if (weight->len != 4 ||
+			    mux_complex_set_weight(mux,
+			                           *(const uint32_t *)channel->data,
+			                           *(const uint32_t *)weight->data))
+				printlog(LOGTYPE_BYTE_CHAN, LOGLEVEL_ERROR,
+				         "%s: %s: bad mux-weight, using 1\n",
+				         __func__, bcnode->name);
+		}
+
+		return 0;
 	}
 #endif
 
@@ -206,6 +473,78 @@ static int connect_byte_channel(byte_chan_t *bc, dt_node_t *endpoint,
 	return 0;
 }
 
+/* Map a direct ring into a partition, and describe it in the
+ * partition's handle node.
+ */
+static int byte_chan_map_direct(dt_node_t *node, dt_node_t *gnode,
+                                guest_t *guest)
+{
+	byte_chan_handle_t *handle = node->bch;
+	phys_addr_t gaddr = get_direct_addr(node);
+	unsigned long grpn = gaddr >> PAGE_SHIFT;
+	unsigned long rpn = virt_to_phys(handle->direct) >> PAGE_SHIFT;
+	unsigned long pages = 1 + ((2 * handle->direct_size) >> PAGE_SHIFT);
+	uint32_t ringspec[4];
+
+	/* Checked by byte_chan_init_direct() */
+	assert(gaddr != (phys_addr_t)-1);
+
+	printlog(LOGTYPE_BYTE_CHAN, LOGLEVEL_DEBUG,
+	         "%s: %s: direct ring at guest %llx, %lu pages\n",
+	         __func__, node->name, gaddr, pages);
+
+	vptbl_map(guest->gphys, grpn, rpn, pages, PTE_ALL, PTE_PHYS_LEVELS);
+	vptbl_map(guest->gphys_rev, rpn, grpn, pages, PTE_ALL, PTE_PHYS_LEVELS);
+
+	ringspec[0] = gaddr >> 32;
+	ringspec[1] = gaddr;
+	ringspec[2] = handle->direct_size;
+	ringspec[3] = handle->direct_tx;
+
+	return dt_set_prop(gnode, "fsl,hv-direct-ring", ringspec,
+	                   sizeof(ringspec));
+}
+
+static void byte_chan_deliver_rx(coalesce_t *c)
+{
+	byte_chan_handle_t *bc = to_container(c, byte_chan_handle_t, rx_coalesce);
+
+	vpic_assert_vint(bc->rx_irq);
+}
+
+static void byte_chan_deliver_tx(coalesce_t *c)
+{
+	byte_chan_handle_t *bc = to_container(c, byte_chan_handle_t, tx_coalesce);
+
+	vpic_assert_vint(bc->tx_irq);
+}
+
+/* Coalescing replacements for vpic_assert_vint_rxq() and
+ * vpic_assert_vint_txq().  The level is the data waiting to be
+ * received, or the room to send.
+ */
+static void byte_chan_coalesce_rxq(queue_t *q, int blocking)
+{
+	byte_chan_handle_t *bc = q->consumer;
+	uint32_t avail = queue_get_avail(q), space;
+
+	if (bc->direct)
+		byte_chan_direct_status(bc, &avail, &space);
+
+	coalesce_notify(&bc->rx_coalesce, blocking ? UINT32_MAX : avail);
+}
+
+static void byte_chan_coalesce_txq(queue_t *q)
+{
+	byte_chan_handle_t *bc = q->producer;
+	uint32_t space = queue_get_space(q), avail;
+
+	if (bc->direct)
+		byte_chan_direct_status(bc, &avail, &space);
+
+	coalesce_notify(&bc->tx_coalesce, space);
+}
+
 static int byte_chan_attach_guest(dt_node_t *node, guest_t *guest)
 {
 	byte_chan_handle_t *handle = node->bch;
@@ -240,6 +579,21 @@ static int byte_chan_attach_guest(dt_node_t *node, guest_t *guest)
 		handle->tx->space_avail = vpic_assert_vint_txq;
 	}
 
+	handle->rx_irq = rxirq;
+	handle->tx_irq = txirq;
+
+	if (coalesce_init(&handle->rx_coalesce, node, "coalesce-bytes",
+	                  "rx", byte_chan_deliver_rx)) {
+		handle->rx->consumer = handle;
+		handle->rx->data_avail = byte_chan_coalesce_rxq;
+	}
+
+	if (coalesce_init(&handle->tx_coalesce, node, "coalesce-bytes",
+	                  "tx", byte_chan_deliver_tx)) {
+		handle->tx->producer = handle;
+		handle->tx->space_avail = byte_chan_coalesce_txq;
+	}
+
 	handles = get_handles_node(guest);
 	if (!handles)
 		goto nomem;
@@ -258,6 +612,8 @@ static int byte_chan_attach_guest(dt_node_t *node, guest_t *guest)
 		goto nomem;
 	if (dt_set_prop(gnode, "interrupts", intspec, sizeof(intspec)) < 0)
 		goto nomem;
+	if (handle->direct && byte_chan_map_direct(node, gnode, guest) < 0)
+		goto nomem;
 
 	int ret = dt_process_node_update(guest, gnode, node);
 	if (ret < 0) {
@@ -328,9 +684,17 @@ int init_byte_channel(dt_node_t *node)
 		if (epnode->bc) {
 			node->bc = epnode->bc;
 		} else {
-			node->bc = byte_chan_alloc();
+			/* A char device or mux claims its handle in
+			 * connect_byte_channel(), before this node does.
+			 */
+			int second = !dt_node_is_compatible(epnode, "byte-channel");
+
+			node->bc = byte_chan_alloc_node(node, epnode, second);
 			if (!node->bc)
 				goto nomem;
+
+			if (!second)
+				byte_chan_init_direct(node->bc, node, epnode);
 		}
 
 		if (dt_node_is_compatible(epnode, "byte-channel")) {
@@ -360,7 +724,7 @@ int init_byte_channel(dt_node_t *node)
 
 		node->endpoint = epnode;
 	} else {
-		node->bc = byte_chan_alloc();
+		node->bc = byte_chan_alloc_node(node, NULL, 0);
 		if (!node->bc)
 			goto nomem;
 	}
@@ -408,7 +772,8 @@ byte_chan_t *other_attach_byte_chan(dt_node_t *bcnode, dt_node_t *onode)
 
 	ret = bcnode->bc;
 	if (!ret) {
-		bcnode->bc = ret = byte_chan_alloc();
+		/* The caller claims its handle before bcnode is initialized. */
+		bcnode->bc = ret = byte_chan_alloc_node(bcnode, NULL, 1);
 		if (!ret) {
 			printlog(LOGTYPE_BYTE_CHAN, LOGLEVEL_ERROR,
 			         "%s: out of memory\n", __func__);
@@ -444,8 +809,10 @@ ssize_t byte_chan_send(byte_chan_handle_t *bc, const uint8_t *buf, size_t len)
 {
 	int ret = queue_write(bc->tx, buf, len);
 
-	if (ret > 0)
+	if (ret > 0) {
+		byte_chan_note_fill(bc->tx, &bc->tx_hwm);
 		queue_notify_consumer(bc->tx, 0);
+	}
 
 	return ret;
 }
@@ -459,8 +826,11 @@ ssize_t byte_chan_send(byte_chan_handle_t *bc, const uint8_t *buf, size_t len)
  */
 ssize_t byte_chan_receive(byte_chan_handle_t *bc, uint8_t *buf, size_t len)
 {
-	int ret = queue_read(bc->rx, buf, len, 0);
+	int ret;
+
+	byte_chan_note_fill(bc->rx, &bc->rx_hwm);
 
+	ret = queue_read(bc->rx, buf, len, 0);
 	if (ret > 0)
 		queue_notify_producer(bc->rx);
 
@@ -469,3 +839,452 @@ ssize_t byte_chan_receive(byte_chan_handle_t *bc, uint8_t *buf, size_t len)
 
 	return ret;
 }
+
+/** Send data from guest memory through a byte channel
+ *
+ * As much is sent as the tx queue has room for.  The lock is dropped
+ * every GPHYS_CHUNK bytes, so a send from another vcpu on the same
+ * handle may land in between.
+ *
+ * @param[in] bc the byte channel handle
+ * @param[in] guest the guest owning the handle and the data
+ * @param[in] buf guest physical address of the data
+ * @param[in,out] len bytes to send; bytes sent
+ * @return zero on success, or an EV_ error code
+ */
+int byte_chan_send_gphys(byte_chan_handle_t *bc, guest_t *guest,
+                         phys_addr_t buf, uint32_t *len)
+{
+	uint32_t done = 0;
+	register_t saved;
+	int ret = 0;
+
+	if (bc->direct) {
+		*len = 0;
+		return EV_EINVAL;
+	}
+
+	while (done < *len) {
+		size_t want = min(*len - done, (uint32_t)GPHYS_CHUNK);
+		size_t space, maplen;
+		void *data;
+		int n = 0;
+
+		saved = byte_chan_guest_lock(guest, &bc->tx_lock,
+		                             &bc->tx_contended);
+
+		space = queue_get_space(bc->tx);
+		if (space) {
+			data = map_gphys(TEMPTLB1, guest->gphys, buf + done,
+			                 TEMP_MAPPING1, &maplen, TLB_TSIZE_16M,
+			                 TLB_MAS2_MEM, 0);
+			if (data)
+				n = queue_write(bc->tx, data,
+				                min(min(space, maplen), want));
+			else
+				ret = EV_EFAULT;
+		}
+
+		if (n > 0) {
+			byte_chan_note_fill(bc->tx, &bc->tx_hwm);
+			queue_notify_consumer(bc->tx, 0);
+		}
+
+		byte_chan_guest_unlock(guest, &bc->tx_lock, saved);
+
+		if (n <= 0)
+			break;
+
+		done += n;
+	}
+
+	*len = done;
+	return ret;
+}
+
+/** Receive data from a byte channel into guest memory
+ *
+ * As for byte_chan_send_gphys(), the lock is dropped every
+ * GPHYS_CHUNK bytes.
+ *
+ * @param[in] bc the byte channel handle
+ * @param[in] guest the guest owning the handle and the buffer
+ * @param[in] buf guest physical address of the buffer
+ * @param[in,out] len size of the buffer; bytes received
+ * @return zero on success, or an EV_ error code
+ */
+int byte_chan_receive_gphys(byte_chan_handle_t *bc, guest_t *guest,
+                            phys_addr_t buf, uint32_t *len)
+{
+	uint32_t done = 0;
+	register_t saved;
+	int ret = 0;
+
+	if (bc->direct) {
+		*len = 0;
+		return EV_EINVAL;
+	}
+
+	while (done < *len) {
+		size_t want = min(*len - done, (uint32_t)GPHYS_CHUNK);
+		size_t maplen;
+		void *data;
+		int n = 0;
+
+		saved = byte_chan_guest_lock(guest, &bc->rx_lock,
+		                             &bc->rx_contended);
+		byte_chan_note_fill(bc->rx, &bc->rx_hwm);
+
+		if (!queue_empty(bc->rx)) {
+			data = map_gphys(TEMPTLB1, guest->gphys, buf + done,
+			                 TEMP_MAPPING1, &maplen, TLB_TSIZE_16M,
+			                 TLB_MAS2_MEM, 1);
+			if (data)
+				n = queue_read(bc->rx, data, min(maplen, want), 0);
+			else
+				ret = EV_EFAULT;
+		}
+
+		if (n > 0)
+			queue_notify_producer(bc->rx);
+
+		byte_chan_guest_unlock(guest, &bc->rx_lock, saved);
+
+		if (n <= 0)
+			break;
+
+		done += n;
+	}
+
+	*len = done;
+	return ret;
+}
+
+/* Map the header of a registered ring through TEMPTLB2, leaving
+ * TEMPTLB1 for the data areas.  Caller must hold tx_lock or rx_lock,
+ * per byte_chan_guest_lock().
+ */
+static byte_chan_ring_hdr_t *map_ring_hdr(byte_chan_handle_t *bc,
+                                          guest_t *guest)
+{
+	size_t len;
+
+	/* The header is 32-byte aligned, so cannot cross a page. */
+	return map_gphys(TEMPTLB2, guest->gphys, bc->ring, TEMP_MAPPING2,
+	                 &len, TLB_TSIZE_16M, TLB_MAS2_MEM, 1);
+}
+
+static void *map_ring_data(byte_chan_handle_t *bc, guest_t *guest,
+                           size_t offset, size_t *len, int write)
+{
+	return map_gphys(TEMPTLB1, guest->gphys,
+	                 bc->ring + sizeof(byte_chan_ring_hdr_t) + offset,
+	                 TEMP_MAPPING1, len, TLB_TSIZE_16M, TLB_MAS2_MEM, write);
+}
+
+/** Register a shared ring with a byte channel handle
+ *
+ * Once registered, data may be exchanged through the ring with
+ * byte_chan_ring_kick(), in addition to the register-based
+ * send and receive calls.
+ *
+ * @param[in] bc the byte channel handle
+ * @param[in] guest the guest owning the handle and the ring memory
+ * @param[in] ring guest physical address of the ring header, 32-byte aligned
+ * @param[in] size size of each data area; a power of two, or zero
+ *            to unregister
+ * @return zero on success, or an EV_ error code
+ */
+int byte_chan_ring_register(byte_chan_handle_t *bc, guest_t *guest,
+                            phys_addr_t ring, uint32_t size)
+{
+	byte_chan_ring_hdr_t *hdr;
+	phys_addr_t last;
+	size_t len;
+	register_t saved;
+	int ret = 0;
+
+	if (size && (size < BYTE_CHAN_RING_MIN || size > BYTE_CHAN_RING_MAX ||
+	             (size & (size - 1)) || (ring & 31)))
+		return EV_EINVAL;
+
+	/* A direct channel already has its ring. */
+	if (bc->direct)
+		return EV_EINVAL;
+
+	saved = spin_lock_intsave(&bc->tx_lock);
+	spin_lock(&bc->rx_lock);
+
+	bc->ring_size = 0;
+	if (!size)
+		goto out;
+
+	last = ring + sizeof(byte_chan_ring_hdr_t) + 2 * size - 1;
+	if (!map_gphys(TEMPTLB1, guest->gphys, last, TEMP_MAPPING1,
+	               &len, TLB_TSIZE_4K, TLB_MAS2_MEM, 1)) {
+		ret = EV_EFAULT;
+		goto out;
+	}
+
+	bc->ring = ring;
+	hdr = map_ring_hdr(bc, guest);
+	if (!hdr) {
+		ret = EV_EFAULT;
+		goto out;
+	}
+
+	memset(hdr, 0, sizeof(byte_chan_ring_hdr_t));
+	bc->ring_tx_cons = 0;
+	bc->ring_rx_prod = 0;
+	bc->ring_size = size;
+
+out:
+	spin_unlock(&bc->rx_lock);
+	spin_unlock_intsave(&bc->tx_lock, saved);
+	return ret;
+}
+
+/* Move data the guest has placed in the tx area into the tx queue,
+ * at most GPHYS_CHUNK bytes of it.
+ */
+static int ring_drain_tx(byte_chan_handle_t *bc, guest_t *guest,
+                         uint32_t *left)
+{
+	byte_chan_ring_hdr_t *hdr;
+	uint32_t mask = bc->ring_size - 1;
+	uint32_t avail;
+	size_t moved = 0;
+
+	hdr = map_ring_hdr(bc, guest);
+	if (!hdr)
+		return EV_EFAULT;
+
+	avail = hdr->tx_prod - bc->ring_tx_cons;
+	if (avail > bc->ring_size)
+		return EV_EINVAL;
+
+	/* Order the read of tx_prod before the reads of the data. */
+	smp_lwsync();
+
+	while (avail && moved < GPHYS_CHUNK) {
+		uint32_t off = bc->ring_tx_cons & mask;
+		size_t chunk = min(avail, bc->ring_size - off);
+		size_t space = queue_get_space(bc->tx);
+		size_t len;
+		void *data;
+		int ret;
+
+		if (!space)
+			break;
+
+		data = map_ring_data(bc, guest, off, &len, 0);
+		if (!data)
+			return EV_EFAULT;
+
+		chunk = min(min(chunk, len), space);
+		chunk = min(chunk, (size_t)GPHYS_CHUNK - moved);
+		ret = queue_write(bc->tx, data, chunk);
+		if (ret <= 0)
+			break;
+
+		bc->ring_tx_cons += ret;
+		avail -= ret;
+		moved += ret;
+	}
+
+	if (moved) {
+		byte_chan_note_fill(bc->tx, &bc->tx_hwm);
+
+		/* TEMPTLB2 is untouched by the data mappings. */
+		hdr->tx_cons = bc->ring_tx_cons;
+		queue_notify_consumer(bc->tx, 0);
+	}
+
+	*left = avail;
+	return 0;
+}
+
+/* Move data from the rx queue into the guest's rx area, at most
+ * GPHYS_CHUNK bytes of it.
+ */
+static int ring_fill_rx(byte_chan_handle_t *bc, guest_t *guest,
+                        uint32_t *pending)
+{
+	byte_chan_ring_hdr_t *hdr;
+	uint32_t mask = bc->ring_size - 1;
+	uint32_t cons, space;
+	size_t moved = 0;
+
+	hdr = map_ring_hdr(bc, guest);
+	if (!hdr)
+		return EV_EFAULT;
+
+	cons = hdr->rx_cons;
+	space = bc->ring_size - (bc->ring_rx_prod - cons);
+	if (space > bc->ring_size)
+		return EV_EINVAL;
+
+	/* Don't overwrite data before the guest is done reading it. */
+	smp_lwsync();
+
+	byte_chan_note_fill(bc->rx, &bc->rx_hwm);
+
+	while (space && moved < GPHYS_CHUNK) {
+		uint32_t off = bc->ring_rx_prod & mask;
+		size_t chunk = min(space, bc->ring_size - off);
+		size_t len;
+		void *data;
+		int ret;
+
+		data = map_ring_data(bc, guest, off, &len, 1);
+		if (!data)
+			return EV_EFAULT;
+
+		chunk = min(chunk, (size_t)GPHYS_CHUNK - moved);
+		ret = queue_read(bc->rx, data, min(chunk, len), 0);
+		if (ret <= 0)
+			break;
+
+		bc->ring_rx_prod += ret;
+		space -= ret;
+		moved += ret;
+	}
+
+	if (moved) {
+		/* Data must be visible before the new rx_prod. */
+		smp_lwsync();
+		hdr->rx_prod = bc->ring_rx_prod;
+		queue_notify_producer(bc->rx);
+	}
+
+	*pending = bc->ring_rx_prod - cons;
+	return 0;
+}
+
+/* Report the fill levels of a direct ring's data areas, as seen
+ * from handle bc.  Returns non-zero if the indices are inconsistent.
+ */
+static int direct_fill(byte_chan_handle_t *bc, uint32_t *tx_left,
+                       uint32_t *rx_pending)
+{
+	byte_chan_direct_dir_t *tx = &bc->direct->dir[bc->direct_tx];
+	byte_chan_direct_dir_t *rx = &bc->direct->dir[!bc->direct_tx];
+
+	*tx_left = tx->prod - tx->cons;
+	*rx_pending = rx->prod - rx->cons;
+
+	return *tx_left > bc->direct_size || *rx_pending > bc->direct_size;
+}
+
+/** Get the data and room in a byte channel's direct ring
+ *
+ * @param[in] bc a byte channel handle with a direct ring
+ * @param[out] rx_avail bytes waiting to be received
+ * @param[out] tx_space room for bytes to be sent
+ */
+void byte_chan_direct_status(byte_chan_handle_t *bc,
+                             uint32_t *rx_avail, uint32_t *tx_space)
+{
+	uint32_t tx_left;
+
+	if (direct_fill(bc, &tx_left, rx_avail)) {
+		*rx_avail = 0;
+		*tx_space = 0;
+		return;
+	}
+
+	*tx_space = bc->direct_size - tx_left;
+}
+
+/* The data is already in place in a direct ring: all that is left is
+ * to interrupt the other partition.  No lock is needed, as only the
+ * guests write the ring, and a duplicate interrupt is harmless.
+ */
+static int byte_chan_direct_kick(byte_chan_handle_t *bc, uint32_t *tx_left,
+                                 uint32_t *rx_pending)
+{
+	byte_chan_direct_dir_t *rx = &bc->direct->dir[!bc->direct_tx];
+
+	if (direct_fill(bc, tx_left, rx_pending))
+		return EV_EINVAL;
+
+	/* The other partition's rx interrupt */
+	if (*tx_left)
+		queue_notify_consumer(bc->tx, 0);
+
+	/* The other partition's tx interrupt, if it is waiting for room */
+	if (rx->want_space && *rx_pending < bc->direct_size) {
+		rx->want_space = 0;
+		queue_notify_producer(bc->rx);
+	}
+
+	return 0;
+}
+
+/** Exchange data between a shared ring and its byte channel
+ *
+ * Drains as much of the guest's tx area into the channel as the tx
+ * queue will accept, and fills the rx area with whatever the channel
+ * has received.  The guest only needs to call this when its tx area
+ * goes from empty to non-empty, or on a byte-channel interrupt.
+ *
+ * For a direct channel, the other partition reads and writes the
+ * ring itself, and is just interrupted.
+ *
+ * @param[in] bc the byte channel handle
+ * @param[in] guest the guest owning the handle and the ring memory
+ * @param[out] tx_left bytes still waiting in the tx area
+ * @param[out] rx_pending bytes unread by the guest in the rx area
+ * @return zero on success, or an EV_ error code
+ */
+int byte_chan_ring_kick(byte_chan_handle_t *bc, guest_t *guest,
+                        uint32_t *tx_left, uint32_t *rx_pending)
+{
+	register_t saved;
+	uint32_t start;
+	int ret, more;
+
+	if (bc->direct)
+		return byte_chan_direct_kick(bc, tx_left, rx_pending);
+
+	/* Each pass takes the lock afresh, and another vcpu may
+	 * unregister the ring while it is dropped.
+	 */
+	do {
+		saved = byte_chan_guest_lock(guest, &bc->tx_lock,
+		                             &bc->tx_contended);
+
+		if (!bc->ring_size) {
+			byte_chan_guest_unlock(guest, &bc->tx_lock, saved);
+			return EV_EINVAL;
+		}
+
+		start = bc->ring_tx_cons;
+		ret = ring_drain_tx(bc, guest, tx_left);
+		more = !ret && *tx_left && bc->ring_tx_cons != start;
+
+		byte_chan_guest_unlock(guest, &bc->tx_lock, saved);
+	} while (more);
+
+	if (ret)
+		return ret;
+
+	do {
+		saved = byte_chan_guest_lock(guest, &bc->rx_lock,
+		                             &bc->rx_contended);
+
+		if (!bc->ring_size) {
+			byte_chan_guest_unlock(guest, &bc->rx_lock, saved);
+			return EV_EINVAL;
+		}
+
+		start = bc->ring_rx_prod;
+		ret = ring_fill_rx(bc, guest, rx_pending);
+		more = !ret && *rx_pending < bc->ring_size &&
+		       bc->ring_rx_prod != start;
+
+		byte_chan_guest_unlock(guest, &bc->rx_lock, saved);
+	} while (more);
+
+	return ret;
+}
@@ -0,0 +1,171 @@
+
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <libos/libos.h>
+#include <libos/printlog.h>
+
+#include <coalesce.h>
+#include <devtree.h>
+#include <percpu.h>
+
+coalesce_t *coalesce_list;
+static uint32_t coalesce_list_lock;
+
+/* Called with c->lock held */
+static int coalesce_take(coalesce_t *c)
+{
+	if (!c->held)
+		return 0;
+
+	c->held = 0;
+	c->delivered++;
+	return 1;
+}
+
+static void coalesce_timeout(hv_timer_t *timer)
+{
+	coalesce_t *c = to_container(timer, coalesce_t, timer);
+	int deliver;
+
+	spin_lock(&c->lock);
+	c->timer_queued = 0;
+	c->timer_pending = 0;
+	deliver = coalesce_take(c);
+	spin_unlock(&c->lock);
+
+	if (deliver)
+		c->deliver(c);
+}
+
+/** Set up an interrupt coalescer from a config tree node
+ *
+ * Notifications are held back if the node has a property prop giving
+ * the threshold level, and a "coalesce-delay" property giving the
+ * longest hold in timebase ticks.
+ *
+ * @param[in] c the coalescer
+ * @param[in] node the config node with the coalescing properties
+ * @param[in] prop the name of the threshold property
+ * @param[in] kind what is notified, as shown by the shell
+ * @param[in] deliver called to send the interrupt
+ * @return non-zero if notifications will be coalesced
+ */
+int coalesce_init(coalesce_t *c, dt_node_t *node, const char *prop,
+                  const char *kind, void (*deliver)(coalesce_t *c))
+{
+	dt_prop_t *threshold = dt_get_prop(node, prop, 0);
+	dt_prop_t *delay = dt_get_prop(node, "coalesce-delay", 0);
+	register_t saved;
+
+	if (!threshold && !delay)
+		return 0;
+
+	if (!threshold || threshold->len != 4 || !delay || delay->len != 4) {
+		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+		         "%s: %s: %s and coalesce-delay must both be "
+		         "single cells\n", __func__, node->name, prop);
+		return 0;
+	}
+
+	c->timer.fn = coalesce_timeout;
+	c->deliver = deliver;
+	c->threshold = *(const uint32_t *)threshold->data;
+	c->delay = *(const uint32_t *)delay->data;
+	c->name = node->name;
+	c->kind = kind;
+
+	saved = spin_lock_intsave(&coalesce_list_lock);
+	c->next = coalesce_list;
+	coalesce_list = c;
+	spin_unlock_intsave(&coalesce_list_lock, saved);
+
+	return 1;
+}
+
+/** Deliver a notification, or hold it back
+ *
+ * @param[in] c the coalescer
+ * @param[in] level how much is waiting to be noticed
+ */
+void coalesce_notify(coalesce_t *c, uint32_t level)
+{
+	register_t saved = spin_lock_intsave(&c->lock);
+	int deliver = 0;
+
+	c->held = 1;
+
+	if (level >= c->threshold) {
+		deliver = coalesce_take(c);
+	} else {
+		c->suppressed++;
+
+		/* The timer goes on this CPU's wheel, whose FIT keeps
+		 * running through a nap (see idle_loop()).  A timer that fires
+		 * after the notification was delivered anyway does nothing.
+		 * One still queued from before a reset times this hold,
+		 * ending it early.
+		 */
+		if (!c->timer_pending) {
+			c->timer_pending = 1;
+
+			if (!c->timer_queued) {
+				c->timer_queued = 1;
+				hv_timer_add(&c->timer, get_tb() + c->delay);
+			}
+		}
+	}
+
+	spin_unlock_intsave(&c->lock, saved);
+
+	if (deliver)
+		c->deliver(c);
+}
+
+/** Forget any notification held back, when its owner is reset
+ *
+ * A timer already queued cannot be taken off another CPU's wheel; it
+ * stays queued, and does nothing when it fires unless a later
+ * notification has been held back in the meantime.
+ *
+ * @param[in] c the coalescer
+ * @param[in] flush deliver a held notification now, rather than
+ *            dropping it
+ */
+void coalesce_reset(coalesce_t *c, int flush)
+{
+	register_t saved = spin_lock_intsave(&c->lock);
+	int deliver = 0;
+
+	if (flush)
+		deliver = coalesce_take(c);
+
+	c->held = 0;
+	c->timer_pending = 0;
+
+	spin_unlock_intsave(&c->lock, saved);
+
+	if (deliver)
+		c->deliver(c);
+}
@@ -0,0 +1,538 @@
+/** @file
+ * Asynchronous copies between partitions
+ *
+ * A manager loading a partition image does not have to stall one of
+ * its vcpus for the length of the copy.  An asynchronous copy is
+ * queued, and is carried out by the worker thread of a copy backend
+ * -- a DMA channel owned by the hypervisor if there is one, otherwise
+ * the software backend here.  The caller is told of completion by a
+ * doorbell, and collects the result with its request id.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <libos/libos.h>
+#include <libos/printlog.h>
+#include <libos/alloc.h>
+
+#include <copy_engine.h>
+#include <errors.h>
+#include <ipi_doorbell.h>
+#include <paging.h>
+#include <percpu.h>
+#include <thread.h>
+
+/* The software backend copies this much between sleeps */
+#define COPY_SOFT_CHUNK 0x10000
+
+/* Most bytes copied at once with interrupts disabled */
+#define COPY_INT_CHUNK 0x1000
+
+enum {
+	copy_queued,
+	copy_running,
+	copy_done,
+};
+
+typedef struct copy_req {
+	struct copy_req *next; /**< in the queue */
+	guest_t *caller, *source, *target;
+	ipi_doorbell_t *done;
+	struct hcall_sg_list *sg;
+	unsigned int num;
+	int state;
+	int status;   /**< result, once done */
+	int orphaned; /**< the caller was reset while it was running */
+	int cancelled; /**< the source or target was reset while it was running */
+} copy_req_t;
+
+copy_backend_t *copy_backends;
+
+/* Protects the request table and the queue */
+static uint32_t copy_lock;
+static copy_req_t *reqs[COPY_MAX_REQS];
+static copy_req_t *queue_head, **queue_tail = &queue_head;
+
+static copy_backend_t soft_backend = {
+	.name = "software",
+	.copy = copy_engine_soft_copy,
+	.chunk = COPY_SOFT_CHUNK,
+};
+
+static void free_req(copy_req_t *req)
+{
+	free(req->sg);
+	free(req);
+}
+
+/** Add a copy backend
+ *
+ * Called from driver probe, before copy_engine_init().
+ */
+void copy_engine_register(copy_backend_t *be)
+{
+	be->next = copy_backends;
+	copy_backends = be;
+}
+
+/** Queue an asynchronous copy
+ *
+ * @param[in] caller the partition asking for the copy
+ * @param[in] source the partition to copy from
+ * @param[in] target the partition to copy to
+ * @param[in] sg_gphys caller's guest physical address of the
+ *            scatter-gather list
+ * @param[in] num number of entries in the list
+ * @param[in] done doorbell to ring on completion, or NULL
+ * @param[out] id request id, for copy_engine_status()
+ * @return 0 or an EV_ error code
+ */
+int copy_engine_submit(guest_t *caller, guest_t *source, guest_t *target,
+                       phys_addr_t sg_gphys, unsigned int num,
+                       ipi_doorbell_t *done, unsigned int *id)
+{
+	size_t size = num * sizeof(struct hcall_sg_list);
+	copy_req_t *req;
+	register_t saved;
+	int slot = -1, pending = 0;
+
+	if (num == 0 || num > COPY_MAX_SG)
+		return EV_EINVAL;
+
+	req = alloc_type(copy_req_t);
+	if (!req)
+		return EV_ENOMEM;
+
+	req->sg = alloc(size, __alignof__(struct hcall_sg_list));
+	if (!req->sg) {
+		free(req);
+		return EV_ENOMEM;
+	}
+
+	/* The list is copied in whole, so the caller may reuse its
+	 * buffer as soon as the hcall returns.
+	 */
+	for (size_t off = 0; off < size; off += COPY_INT_CHUNK) {
+		size_t chunk = min(size - off, (size_t)COPY_INT_CHUNK);
+		size_t copied;
+
+		saved = disable_int_save();
+		copied = copy_from_gphys(caller->gphys, (char *)req->sg + off,
+		                         sg_gphys + off, chunk);
+		restore_int(saved);
+
+		if (copied != chunk) {
+			free_req(req);
+			return EV_EFAULT;
+		}
+	}
+
+	req->caller = caller;
+	req->source = source;
+	req->target = target;
+	req->done = done;
+	req->num = num;
+	req->state = copy_queued;
+
+	saved = spin_lock_intsave(&copy_lock);
+
+	for (int i = 0; i < COPY_MAX_REQS; i++) {
+		if (!reqs[i]) {
+			if (slot < 0)
+				slot = i;
+		} else if (reqs[i]->caller == caller) {
+			pending++;
+		}
+	}
+
+	if (slot < 0 || pending >= COPY_MAX_PENDING) {
+		spin_unlock_intsave(&copy_lock, saved);
+		free_req(req);
+		return EV_EAGAIN;
+	}
+
+	reqs[slot] = req;
+	*queue_tail = req;
+	queue_tail = &req->next;
+
+	spin_unlock_intsave(&copy_lock, saved);
+
+	/* A worker that is already running just goes round again. */
+	for (copy_backend_t *be = copy_backends; be; be = be->next)
+		if (be->worker)
+			unblock(be->worker);
+
+	*id = slot;
+	return 0;
+}
+
+/** Collect the result of an asynchronous copy
+ *
+ * Once a result other than EV_EAGAIN has been returned, the id is
+ * free for reuse.
+ *
+ * @param[in] caller the partition that queued the copy
+ * @param[in] id the request id
+ * @return 0 if the copy is done, EV_EAGAIN if it is still in
+ * progress, EV_EFAULT if part of it could not be copied, or
+ * EV_EINVAL if the caller has no such request
+ */
+int copy_engine_status(guest_t *caller, unsigned int id)
+{
+	copy_req_t *req = NULL;
+	register_t saved;
+	int ret;
+
+	if (id >= COPY_MAX_REQS)
+		return EV_EINVAL;
+
+	saved = spin_lock_intsave(&copy_lock);
+
+	if (!reqs[id] || reqs[id]->caller != caller) {
+		ret = EV_EINVAL;
+	} else if (reqs[id]->state != copy_done) {
+		ret = EV_EAGAIN;
+	} else {
+		req = reqs[id];
+		reqs[id] = NULL;
+		ret = req->status;
+	}
+
+	spin_unlock_intsave(&copy_lock, saved);
+
+	if (req)
+		free_req(req);
+
+	return ret;
+}
+
+static int req_involves(copy_req_t *req, guest_t *guest)
+{
+	return req->caller == guest || req->source == guest ||
+	       req->target == guest;
+}
+
+/* Whether a worker is copying for, from or to the guest.
+ * Called with copy_lock held.
+ */
+static int copy_busy(guest_t *guest)
+{
+	for (copy_backend_t *be = copy_backends; be; be = be->next)
+		if (be->cur && req_involves(be->cur, guest))
+			return 1;
+
+	return 0;
+}
+
+/** Drop or stop the asynchronous copies that involve a partition
+ *
+ * Called when the partition is reset.  Its own queued copies are
+ * discarded.  Other partitions' queued copies from or to it fail with
+ * EV_INVALID_STATE, and their doorbells are rung.  A copy that is
+ * running is stopped after its current chunk, the same way; no
+ * doorbell is rung for it if it was the partition's own.
+ *
+ * This waits until no worker is copying for, from or to the
+ * partition, so that its memory is not touched once the reset is done.
+ */
+void copy_engine_reset(guest_t *guest)
+{
+	ipi_doorbell_t *ring[COPY_MAX_REQS];
+	copy_req_t *dead = NULL;
+	int nring = 0, busy;
+	register_t saved = spin_lock_intsave(&copy_lock);
+
+	for (int i = 0; i < COPY_MAX_REQS; i++) {
+		copy_req_t *req = reqs[i];
+
+		if (!req || !req_involves(req, guest))
+			continue;
+
+		if (req->caller != guest) {
+			/* Already finished, or finishing, without it */
+			if (req->state == copy_done)
+				continue;
+
+			if (req->state == copy_running) {
+				req->cancelled = 1;
+				continue;
+			}
+		} else {
+			reqs[i] = NULL;
+
+			if (req->state == copy_running) {
+				/* The worker frees it. */
+				req->orphaned = 1;
+				continue;
+			}
+		}
+
+		if (req->state == copy_queued) {
+			copy_req_t **prev = &queue_head;
+
+			while (*prev != req)
+				prev = &(*prev)->next;
+
+			*prev = req->next;
+			if (queue_tail == &req->next)
+				queue_tail = prev;
+		}
+
+		if (req->caller != guest) {
+			/* Left for the caller to collect */
+			req->status = EV_INVALID_STATE;
+			req->state = copy_done;
+
+			if (req->done)
+				ring[nring++] = req->done;
+
+			continue;
+		}
+
+		req->next = dead;
+		dead = req;
+	}
+
+	busy = copy_busy(guest);
+	if (busy)
+		guest->copy_waiter = cur_thread();
+
+	spin_unlock_intsave(&copy_lock, saved);
+
+	while (dead) {
+		copy_req_t *req = dead;
+		dead = req->next;
+		free_req(req);
+	}
+
+	for (int i = 0; i < nring; i++)
+		send_doorbells(ring[i]);
+
+	while (busy) {
+		prepare_to_block();
+
+		saved = spin_lock_intsave(&copy_lock);
+		busy = copy_busy(guest);
+		if (!busy)
+			guest->copy_waiter = NULL;
+		spin_unlock_intsave(&copy_lock, saved);
+
+		if (busy)
+			block();
+	}
+}
+
+/** Carry out the copy at the head of the queue
+ *
+ * @param[in] be the backend to copy with
+ * @return non-zero if there was a copy to do
+ */
+int copy_engine_run(copy_backend_t *be)
+{
+	copy_req_t *req;
+	ipi_doorbell_t *done = NULL;
+	register_t saved;
+	int status = 0, orphaned;
+
+	saved = spin_lock_intsave(&copy_lock);
+
+	req = queue_head;
+	if (req) {
+		queue_head = req->next;
+		if (!queue_head)
+			queue_tail = &queue_head;
+
+		req->state = copy_running;
+		be->cur = req;
+	}
+
+	spin_unlock_intsave(&copy_lock, saved);
+
+	if (!req)
+		return 0;
+
+	be->requests++;
+
+	for (unsigned int i = 0; i < req->num && !status; i++) {
+		phys_addr_t src = req->sg[i].source;
+		phys_addr_t dest = req->sg[i].target;
+		uint64_t len = req->sg[i].size;
+
+		while (len) {
+			size_t chunk = min(len, (uint64_t)be->chunk);
+			uint64_t start;
+			size_t copied;
+
+			/* Stop as soon as possible for a reset partition. */
+			if (req->orphaned || req->cancelled) {
+				status = EV_INVALID_STATE;
+				break;
+			}
+
+			start = get_tb();
+			copied = be->copy(be, req->target->gphys, dest,
+			                  req->source->gphys, src, chunk);
+			be->busy_tb += get_tb() - start;
+			be->bytes += copied;
+
+			if (copied != chunk) {
+				be->faults++;
+				status = EV_EFAULT;
+				break;
+			}
+
+			src += chunk;
+			dest += chunk;
+			len -= chunk;
+		}
+	}
+
+	saved = spin_lock_intsave(&copy_lock);
+
+	/* Once it is marked done, the caller may collect and free it. */
+	orphaned = req->orphaned;
+	if (!orphaned) {
+		req->status = status;
+		req->state = copy_done;
+		done = req->done;
+	}
+
+	be->cur = NULL;
+
+	/* Wake any reset that was waiting for this copy to stop. */
+	if (req->caller->copy_waiter)
+		unblock(req->caller->copy_waiter);
+	if (req->source->copy_waiter)
+		unblock(req->source->copy_waiter);
+	if (req->target->copy_waiter)
+		unblock(req->target->copy_waiter);
+
+	spin_unlock_intsave(&copy_lock, saved);
+
+	if (orphaned)
+		free_req(req);
+	else if (done)
+		send_doorbells(done);
+
+	return 1;
+}
+
+static void copy_engine_wake(hv_timer_t *timer)
+{
+	copy_backend_t *be = to_container(timer, copy_backend_t, timer);
+
+	be->timer_pending = 0;
+	unblock(be->worker);
+}
+
+/** Sleep the calling worker thread
+ *
+ * @param[in] be the worker's backend
+ * @param[in] ticks timebase ticks to sleep for, rounded up to the
+ *            next timer wheel tick
+ */
+void copy_engine_sleep(copy_backend_t *be, uint64_t ticks)
+{
+	be->timer_pending = 1;
+	hv_timer_add(&be->timer, get_tb() + ticks);
+
+	/* Submissions also wake the worker, so wait for the timer
+	 * itself -- it must not be added again while it is pending.
+	 */
+	while (1) {
+		prepare_to_block();
+
+		if (!be->timer_pending)
+			break;
+
+		block();
+	}
+}
+
+/** Copy with the CPU
+ *
+ * Interrupts are held off only while the temporary mappings are in
+ * use, COPY_INT_CHUNK bytes at a time.  The worker runs above the
+ * guest threads on its CPU, so it sleeps for a timer wheel tick after
+ * each chunk to let them run.
+ */
+size_t copy_engine_soft_copy(copy_backend_t *be, struct pte *dtbl,
+                             phys_addr_t dest, struct pte *stbl,
+                             phys_addr_t src, size_t len)
+{
+	size_t ret = 0;
+
+	while (ret < len) {
+		size_t chunk = min(len - ret, (size_t)COPY_INT_CHUNK);
+		register_t saved = disable_int_save();
+		size_t copied = copy_between_gphys(dtbl, dest + ret,
+		                                   stbl, src + ret, chunk);
+		restore_int(saved);
+
+		ret += copied;
+		if (copied != chunk)
+			break;
+	}
+
+	copy_engine_sleep(be, 1);
+	return ret;
+}
+
+static void copy_worker(trapframe_t *regs, void *arg)
+{
+	copy_backend_t *be = arg;
+
+	while (1) {
+		prepare_to_block();
+
+		if (!copy_engine_run(be))
+			block();
+	}
+}
+
+/** Start a worker thread for each copy backend
+ *
+ * The software backend is used only if no DMA channel registered.
+ * Workers are bound to the boot CPU, which does not nap, so their
+ * timers always run.
+ */
+void copy_engine_init(void)
+{
+	if (!copy_backends)
+		copy_engine_register(&soft_backend);
+
+	for (copy_backend_t *be = copy_backends; be; be = be->next) {
+		be->timer.fn = copy_engine_wake;
+
+		be->worker = new_thread(be->name, copy_worker, be, 1);
+		if (!be->worker) {
+			printlog(LOGTYPE_MISC, LOGLEVEL_ERROR,
+			         "%s: failed to create %s copy worker\n",
+			         __func__, be->name);
+			continue;
+		}
+
+		unblock(be->worker);
+	}
+}
@@ -0,0 +1,227 @@
+/** @file
+ * Partition copies with a hypervisor-owned Elo Plus DMA channel
+ *
+ * A DMA channel assigned to the hypervisor in its config tree becomes
+ * a copy backend for asynchronous partition_memcpy.  The channel is
+ * run in basic direct mode: each call programs one transfer within a
+ * single guest page on each side, and the worker sleeps on the timer
+ * wheel until the channel is no longer busy.
+ *
+ * Transfers snoop, so the data is coherent in the data caches.  The
+ * instruction caches are not synced: a partition that is loaded
+ * while stopped had its caches flushed when it stopped, and one that
+ * is running must sync its own, as for any other DMA.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <libos/libos.h>
+#include <libos/printlog.h>
+#include <libos/alloc.h>
+#include <libos/io.h>
+
+#include <copy_engine.h>
+#include <devtree.h>
+#include <errors.h>
+#include <paging.h>
+#include <pamu.h>
+#include <percpu.h>
+
+/* Channel registers */
+#define ELO_MR   0x00
+#define ELO_SR   0x04
+#define ELO_SATR 0x10
+#define ELO_SAR  0x14
+#define ELO_DATR 0x18
+#define ELO_DAR  0x1c
+#define ELO_BCR  0x20
+
+#define ELO_MR_CS  0x00000001 /* channel start */
+#define ELO_MR_CTM 0x00000004 /* direct mode */
+
+#define ELO_SR_CB  0x00000004 /* channel busy */
+#define ELO_SR_TE  0x00000080 /* transfer error */
+
+#define ELO_SATR_SNOOP_READ   0x00050000
+#define ELO_DATR_SNOOP_WRITE  0x00050000
+#define ELO_ATR_ESAD_MASK     0x0000000f
+
+#define ELO_BCR_MAX 0x03ffffff
+
+/* Bytes handed to the channel per call from the worker */
+#define ELO_CHUNK 0x100000
+
+typedef struct elo_chan {
+	copy_backend_t be;
+	void *regs;
+	dt_node_t *node;
+	uint32_t liodn;
+	int has_liodn;
+	int setup;    /**< 0 not yet tried, 1 usable, -1 failed */
+	unsigned long errors;
+} elo_chan_t;
+
+static int elo_dma_probe(device_t *dev, const dev_compat_t *compat_id);
+
+static const dev_compat_t elo_dma_compats[] = {
+	{
+		.compatible = "fsl,eloplus-dma-channel"
+	},
+	{}
+};
+
+static driver_t __driver elo_dma = {
+	.compatibles = elo_dma_compats,
+	.probe = elo_dma_probe
+};
+
+/* The PAMU may not have been probed yet when the channel is, so the
+ * channel's window is set up when it is first used.
+ */
+static int elo_dma_setup(elo_chan_t *chan)
+{
+	chan->setup = 1;
+
+#ifdef CONFIG_PAMU
+	if (chan->has_liodn && hv_pamu_config_hv_liodn(chan->liodn)) {
+		printlog(LOGTYPE_DEV, LOGLEVEL_ERROR,
+		         "%s: %s: cannot set up liodn %u, copying in software\n",
+		         __func__, chan->node->name, chan->liodn);
+		chan->setup = -1;
+	}
+#endif
+
+	return chan->setup < 0;
+}
+
+/* Copy len bytes of physically contiguous memory */
+static int elo_dma_transfer(elo_chan_t *chan, phys_addr_t dest,
+                            phys_addr_t src, size_t len)
+{
+	uint32_t sr;
+
+	out32(chan->regs + ELO_MR, ELO_MR_CTM);
+	out32(chan->regs + ELO_SR, ELO_SR_TE);
+
+	out32(chan->regs + ELO_SATR, ELO_SATR_SNOOP_READ |
+	      ((src >> 32) & ELO_ATR_ESAD_MASK));
+	out32(chan->regs + ELO_SAR, (uint32_t)src);
+	out32(chan->regs + ELO_DATR, ELO_DATR_SNOOP_WRITE |
+	      ((dest >> 32) & ELO_ATR_ESAD_MASK));
+	out32(chan->regs + ELO_DAR, (uint32_t)dest);
+	out32(chan->regs + ELO_BCR, len);
+
+	out32(chan->regs + ELO_MR, ELO_MR_CTM | ELO_MR_CS);
+
+	while ((sr = in32(chan->regs + ELO_SR)) & ELO_SR_CB)
+		copy_engine_sleep(&chan->be, 1);
+
+	out32(chan->regs + ELO_MR, ELO_MR_CTM);
+
+	if (sr & ELO_SR_TE) {
+		out32(chan->regs + ELO_SR, ELO_SR_TE);
+		chan->errors++;
+		printlog(LOGTYPE_DEV, LOGLEVEL_ERROR,
+		         "%s: %s: transfer error, sr 0x%x\n",
+		         __func__, chan->node->name, sr);
+		return -1;
+	}
+
+	return 0;
+}
+
+static size_t elo_dma_copy(copy_backend_t *be, pte_t *dtbl, phys_addr_t dest,
+                           pte_t *stbl, phys_addr_t src, size_t len)
+{
+	elo_chan_t *chan = be->priv;
+	size_t ret = 0;
+
+	if ((!chan->setup && elo_dma_setup(chan)) || chan->setup < 0)
+		return copy_engine_soft_copy(be, dtbl, dest, stbl, src, len);
+
+	while (ret < len) {
+		phys_addr_t sphys, dphys;
+		size_t slen, dlen, chunk;
+
+		sphys = xlate_gphys(stbl, src, &slen, 0);
+		if (sphys == (phys_addr_t)-1)
+			break;
+
+		dphys = xlate_gphys(dtbl, dest, &dlen, 1);
+		if (dphys == (phys_addr_t)-1)
+			break;
+
+		chunk = min(len - ret, min(slen, dlen));
+		if (chunk > ELO_BCR_MAX)
+			chunk = ELO_BCR_MAX;
+
+		if (elo_dma_transfer(chan, dphys, sphys, chunk))
+			break;
+
+		src += chunk;
+		dest += chunk;
+		ret += chunk;
+	}
+
+	return ret;
+}
+
+static int elo_dma_probe(device_t *dev, const dev_compat_t *compat_id)
+{
+	dt_node_t *node = to_container(dev, dt_node_t, dev);
+	dt_prop_t *prop;
+	elo_chan_t *chan;
+
+	if (dev->num_regs < 1 || !dev->regs[0].virt) {
+		printlog(LOGTYPE_DEV, LOGLEVEL_ERROR,
+		         "%s: %s: no registers\n", __func__, node->name);
+		return ERR_INVALID;
+	}
+
+	chan = alloc_type(elo_chan_t);
+	if (!chan)
+		return ERR_NOMEM;
+
+	chan->regs = dev->regs[0].virt;
+	chan->node = node;
+
+	/* The LIODN belongs to the DMA controller, not the channel. */
+	prop = dt_get_prop(node->parent, "fsl,liodn", 0);
+	if (prop && prop->len == 4) {
+		chan->liodn = *(const uint32_t *)prop->data;
+		chan->has_liodn = 1;
+	}
+
+	out32(chan->regs + ELO_MR, ELO_MR_CTM);
+
+	chan->be.name = node->name;
+	chan->be.copy = elo_dma_copy;
+	chan->be.chunk = ELO_CHUNK;
+	chan->be.priv = chan;
+	copy_engine_register(&chan->be);
+
+	printlog(LOGTYPE_DEV, LOGLEVEL_NORMAL,
+	         "%s: using %s for partition copies\n", __func__, node->name);
+	return 0;
+}
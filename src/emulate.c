@@ -402,8 +402,9 @@ static int emu_tlbre(trapframe_t *regs, uint32_t insn)
 
 		if (cpu->client.tlbcache_enable)
 			gtlb0_to_mas((mfspr(SPR_MAS2) >> MAS2_EPN_SHIFT) &
-			             (cpu->client.tlbcache_bits - 1),
-			             MAS0_GET_TLB0ESEL(mas0), gcpu);
+			             ((1 << cpu->client.tlbcache_bits) - 1),
+			             TLBC_GET_ESEL(mas0) &
+			             (cpu->client.tlbcache_ways - 1), gcpu);
 		else {
 			asm volatile("tlbre" : : : "memory");
 			fixup_tlb_sx_re();
@@ -31,6 +31,7 @@
 #include <libos/errors.h>
 #include <libos/platform_error.h>
 
+#include <atomic.h>
 #include <events.h>
 #include <vpic.h>
 #include <doorbell.h>
@@ -55,6 +56,17 @@ static eventfp_t event_table[] = {
 #endif
 };
 
+const char *event_names[NUM_EVENTS] = {
+	"assert vint",
+	"tlbivax",
+	"resched",
+	"mcp",
+	"guest crit int",
+	"dump hv queue",
+	"deliver mpic errint",
+	"sync nap",
+};
+
 /* Guest events are processed when returning to the guest, but
  * without regard for the MSR[EE/CE/ME] bits of the guest.
  */
@@ -97,16 +109,50 @@ int register_gevent(eventfp_t handler)
 	return i;
 }
 
+#ifdef CONFIG_STATISTICS
+#define count_event(gcpu, event, field) \
+	atomic_add(&(gcpu)->event_stats[event].field, 1)
+#else
+#define count_event(gcpu, event, field) do {} while (0)
+#endif
+
+/* Raise a hypervisor event on gcpu.
+ *
+ * Only the first event raised against an idle gcpu needs a doorbell.
+ * Both doorbell_int() and return_hook() loop until dbell_pending is
+ * empty, so anything raised while a bit is still set is picked up by
+ * whoever owns that bit, and a burst of events raised during one
+ * exception costs a single doorbell.
+ *
+ * If the target is this core and we're in a normal-level exception,
+ * the events are run from return_hook() on the way out instead, which
+ * saves taking a doorbell interrupt right after returning.
+ */
 void setevent(gcpu_t *gcpu, int event)
 {
+	unsigned long old;
+
+	count_event(gcpu, event, raised);
+
 	/* set the event bit */
 	smp_mbar();
-	atomic_or(&gcpu->dbell_pending, (1 << event));
-	send_doorbell(gcpu->cpu->coreid);
+	old = atomic_fetch_or(&gcpu->dbell_pending, 1 << event);
 
-	// TODO optimization -- could check if it's on
-	// the same cpu and just invoke
-	// the event function
+	if (old) {
+		count_event(gcpu, event, coalesced);
+		return;
+	}
+
+	if (gcpu->cpu == cpu && cpu->traplevel == TRAPLEVEL_NORMAL) {
+		/* ret_hook must not be seen before dbell_pending */
+		smp_lwsync();
+		cpu->ret_hook = 1;
+		count_event(gcpu, event, local);
+		return;
+	}
+
+	send_doorbell(gcpu->cpu->coreid);
+	count_event(gcpu, event, remote);
 }
 
 void setgevent(gcpu_t *gcpu, int event)
@@ -134,14 +180,44 @@ void setgevent(gcpu_t *gcpu, int event)
 #endif
 }
 
+/* Run the pending hypervisor events of the current gcpu, with
+ * interrupts disabled.
+ */
+static void run_events(trapframe_t *regs)
+{
+	gcpu_t *gcpu = get_gcpu();
+
+	while (gcpu->dbell_pending) {
+		/* get the next event */
+		unsigned int bit = count_lsb_zeroes(gcpu->dbell_pending);
+		assert(bit < sizeof(event_table) / sizeof(eventfp_t));
+
+		/* clear the event */
+		atomic_and(&gcpu->dbell_pending, ~(1 << bit));
+
+		smp_lwsync();
+
+		/* invoke the function */
+		event_table[bit](regs);
+	}
+}
+
 void return_hook(trapframe_t *regs)
 {
 	gcpu_t *gcpu = get_gcpu();
 
 	if (unlikely(!(regs->srr1 & MSR_GS)) &&
 	    (!cur_thread()->can_take_gevent ||
-	     regs->traplevel != TRAPLEVEL_THREAD))
+	     regs->traplevel != TRAPLEVEL_THREAD)) {
+		/* Events that setevent() left for us can't be run from
+		 * here; let them be taken as a doorbell once interrupts
+		 * are enabled again.
+		 */
+		if (gcpu && gcpu->dbell_pending)
+			send_doorbell(cpu->coreid);
+
 		return;
+	}
 
 	if (unlikely(cpu->traplevel != TRAPLEVEL_NORMAL))
 		return;
@@ -149,10 +225,18 @@ void return_hook(trapframe_t *regs)
 	assert(cpu->ret_hook);
 	assert(!(mfmsr() & MSR_EE));
 
-	while (gcpu->gevent_pending) {
+	while (gcpu->gevent_pending || gcpu->dbell_pending) {
 		cpu->ret_hook = 0;
 		smp_sync();
 
+		/* Hypervisor events come first, as they would have
+		 * if they had been delivered by doorbell.
+		 */
+		if (gcpu->dbell_pending) {
+			run_events(regs);
+			continue;
+		}
+
 		if (!gcpu->gevent_pending)
 			break;
 
@@ -181,24 +265,10 @@ void crit_dbell_int(trapframe_t *regs)
 
 void doorbell_int(trapframe_t *regs)
 {
-	gcpu_t *gcpu = get_gcpu();
 	assert(!(mfmsr() & MSR_EE));
 
 	set_stat(bm_stat_dbell, regs);
-
-	while (gcpu->dbell_pending) {
-		/* get the next event */
-		unsigned int bit = count_lsb_zeroes(gcpu->dbell_pending);
-		assert(bit < sizeof(event_table) / sizeof(eventfp_t));
-
-		/* clear the event */
-		atomic_and(&gcpu->dbell_pending, ~(1 << bit));
-
-		smp_lwsync();
-
-		/* invoke the function */
-		event_table[bit](regs);
-	}
+	run_events(regs);
 }
 
 void dbell_to_mcgdbell_glue(trapframe_t *regs)
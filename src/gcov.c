@@ -281,7 +281,7 @@ void gcov_config(dt_node_t *config)
 	if (gcov_byte_chan_init(config, &bc, &bch))
 		return;
 
-	gcov_thread = new_thread(gcov_rx_thread, NULL, 1);
+	gcov_thread = new_thread("gcov", gcov_rx_thread, NULL, 1);
 	if (!gcov_thread) {
 		printlog(LOGTYPE_MISC, LOGLEVEL_ERROR,
 		         "failed to create gcov thread\n");
@@ -241,8 +241,14 @@ int read_gspr(trapframe_t *regs, int spr, register_t *val)
 
 	case SPR_TLB0CFG:
 		*val = mfspr(SPR_TLB0CFG);
-		if (cpu->client.tlbcache_enable)
-			*val &= ~TLBCFG_NENTRY_MASK;
+		if (cpu->client.tlbcache_enable) {
+			/* Report the associativity of the TLB cache (in
+			 * TLB0CFG[ASSOC], bits 0-7), so that the guest
+			 * can make use of all of its ways.
+			 */
+			*val &= ~(TLBCFG_NENTRY_MASK | TLBCFG_ASSOC_MASK);
+			*val |= cpu->client.tlbcache_ways << 24;
+		}
 		/*
 		 * Mask out MMUv2 features not yet supported.
 		 * They will be unmasked as they'll be implemented.
@@ -57,6 +57,7 @@
 #include <debug-stub.h>
 #include <error_log.h>
 #include <guts.h>
+#include <copy_engine.h>
 
 #include <malloc.h>
 
@@ -815,6 +816,7 @@ static int map_device_to_guest(dt_node_t *node, void *arg)
 	dt_node_t *hwnode;
 	dev_owner_t *owner;
 	const char *failstr = NULL;
+	uint64_t tb;
 	int ret;
 
 	hwnode = node->upstream;
@@ -843,6 +845,8 @@ static int map_device_to_guest(dt_node_t *node, void *arg)
 	}
 #endif
 
+	tb = get_tb();
+
 	ret = map_guest_reg(owner);
 	if (ret < 0) {
 		failstr = "map_guest_reg";
@@ -855,6 +859,8 @@ static int map_device_to_guest(dt_node_t *node, void *arg)
 		goto fail;
 	}
 
+	guest->map_ranges_tb += get_tb() - tb;
+
 	dt_lookup_irqs(hwnode);
 
 	ret = map_guest_irqs(owner);
@@ -1950,6 +1956,7 @@ static void start_guest_primary_noload(trapframe_t *regs, void *arg)
 
 	guest_core_init(guest);
 	reset_spintbl(guest);
+	vpic_reset_posting(guest);
 	queue_purge(&guest->error_event_queue);
 
 	void *fdt = malloc(guest->dtb_window_len);
@@ -2009,6 +2016,7 @@ static void start_guest_primary_noload(trapframe_t *regs, void *arg)
 	guest->state = guest_running;
 	smp_mbar();
 	send_doorbells(guest->dbell_state_change);
+	vmpic_balance_start(guest);
 
 	assert(cpu->traplevel == TRAPLEVEL_THREAD);
 	assert(cpu->thread == &gcpu->thread.libos_thread);
@@ -2192,7 +2200,8 @@ void start_core(trapframe_t *regs)
 	else
 		fn = start_guest_secondary;
 
-	new_thread_inplace(&gcpu->thread, gcpu->hvstack, fn, NULL, 0);
+	new_thread_inplace(&gcpu->thread, guest->name, gcpu->hvstack,
+	                   fn, NULL, 0);
 	unblock(&gcpu->thread);
 }
 
@@ -2207,7 +2216,7 @@ void load_guest(trapframe_t *regs)
 
 	atomic_and(&gcpu->napping, ~GCPU_NAPPING_STATE);
 
-	new_thread_inplace(&gcpu->thread, gcpu->hvstack,
+	new_thread_inplace(&gcpu->thread, guest->name, gcpu->hvstack,
 	                   start_guest_primary, (void *)1, 0);
 	unblock(&gcpu->thread);
 }
@@ -2223,7 +2232,7 @@ void start_load_guest(trapframe_t *regs)
 
 	atomic_and(&gcpu->napping, ~GCPU_NAPPING_STATE);
 
-	new_thread_inplace(&gcpu->thread, gcpu->hvstack,
+	new_thread_inplace(&gcpu->thread, guest->name, gcpu->hvstack,
 	                   start_guest_primary, (void *)0, 0);
 	unblock(&gcpu->thread);
 }
@@ -2247,6 +2256,7 @@ void do_stop_core(trapframe_t *regs, int restart)
 	disable_int();
 
 	guest_reset_tlb();
+	vptbl_xlate_flush();
 
 	if (cpu_has_ftr(CPU_FTR_MMUV2) && guest->direct_guest_tlb_mgt)
 		inv_lrat(gcpu);
@@ -2267,6 +2277,8 @@ void do_stop_core(trapframe_t *regs, int restart)
 				h->ops->prereset(h, !restart);
 		}
 
+		copy_engine_reset(guest);
+
 		guest->active_cpus = guest->cpucnt;
 		smp_mbar();
 		guest->state = guest_stopping_percpu;
@@ -2289,6 +2301,12 @@ void do_stop_core(trapframe_t *regs, int restart)
 	memset(&gcpu->gdbell_pending, 0,
 	       sizeof(gcpu_t) - offsetof(gcpu_t, gdbell_pending));
 
+#ifdef CONFIG_STATISTICS
+	if (gcpu->hcall_stats)
+		memset(gcpu->hcall_stats, 0,
+		       hcall_stat_count() * sizeof(hcall_stat_t));
+#endif
+
 	/* Wait for all cores to clear interrupts before doing postreset and
 	 * indicating "stopped", which allows device claiming.
 	 */
@@ -2988,6 +3006,7 @@ static int init_guest_devs(guest_t *guest)
 	setup_soc_properties(guest);
 
 	vmpic_partition_init(guest);
+	vpic_init_posting(guest);
 
 	dt_assign_devices(guest->partition, guest);
 	qman_portal_liodn_fixup(guest);
@@ -3062,6 +3081,7 @@ static int __attribute__((noinline)) init_guest_primary(guest_t *guest)
 	char buf[64];
 	int compat_len;
 	char *compat_buf;
+	uint64_t tb, freq;
 
 	/* count number of cpus for this partition and alloc data struct */
 	guest->cpucnt = count_cpus(guest->cpulist, guest->cpulist_len);
@@ -3190,7 +3210,9 @@ static int __attribute__((noinline)) init_guest_primary(guest_t *guest)
 	if (ret < 0)
 		goto fail;
 
+	tb = get_tb();
 	map_guest_mem(guest);
+	guest->map_mem_tb = get_tb() - tb;
 
 	/*
 	 * This must be called *after* map_guest_mem() because it needs
@@ -3226,6 +3248,12 @@ static int __attribute__((noinline)) init_guest_primary(guest_t *guest)
 	if (ret < 0)
 		goto fail;
 
+	freq = dt_get_timebase_freq();
+	printlog(LOGTYPE_PARTITION, LOGLEVEL_DEBUG,
+	         "%s: mapped guest memory in %llu us, device ranges in %llu us\n",
+	         guest->name, guest->map_mem_tb * 1000000 / freq,
+	         guest->map_ranges_tb * 1000000 / freq);
+
 	// create the guest error queue node
 	ret = create_guest_error_node(guest);
 	if (ret < 0)
@@ -3362,6 +3390,35 @@ static void start_partitions(void)
 	}
 }
 
+static unsigned int get_tlbcache_param(guest_t *guest, const char *name,
+                                       unsigned int def, unsigned int min,
+                                       unsigned int max)
+{
+	dt_prop_t *prop;
+	uint32_t val;
+
+	prop = dt_get_prop(guest->partition, name, 0);
+	if (!prop)
+		return def;
+
+	if (prop->len != 4) {
+		printlog(LOGTYPE_PARTITION, LOGLEVEL_ERROR,
+		         "%s: guest %s: invalid %s property\n",
+		         __func__, guest->name, name);
+		return def;
+	}
+
+	val = *(const uint32_t *)prop->data;
+	if (val < min || val > max) {
+		printlog(LOGTYPE_PARTITION, LOGLEVEL_ERROR,
+		         "%s: guest %s: unsupported %s %u, using %u\n",
+		         __func__, guest->name, name, val, def);
+		return def;
+	}
+
+	return val;
+}
+
 static void configure_tlb_mgt(guest_t *guest)
 {
 	register_t epcr;
@@ -3388,8 +3445,25 @@ static void configure_tlb_mgt(guest_t *guest)
 	 */
 
 	if (!guest->direct_guest_tlb_miss && !guest->direct_guest_tlb_mgt &&
-		((mfspr(SPR_PVR) & 0xffff0000) < 0x80400000))
-		tlbcache_init();
+		((mfspr(SPR_PVR) & 0xffff0000) < 0x80400000)) {
+		unsigned int ways, bits;
+
+		ways = get_tlbcache_param(guest, "tlb-cache-ways",
+		                          TLBC_DEFAULT_WAYS,
+		                          TLBC_MIN_WAYS, TLBC_MAX_WAYS);
+		if (ways & (ways - 1)) {
+			printlog(LOGTYPE_PARTITION, LOGLEVEL_ERROR,
+			         "%s: guest %s: tlb-cache-ways must be a power of two\n",
+			         __func__, guest->name);
+			ways = TLBC_DEFAULT_WAYS;
+		}
+
+		bits = get_tlbcache_param(guest, "tlb-cache-index-bits",
+		                          TLBC_DEFAULT_IDX_BITS,
+		                          TLBC_MIN_IDX_BITS, TLBC_MAX_IDX_BITS);
+
+		tlbcache_init(ways, bits);
+	}
 
 	fast_guest_tlb1_init();
 }
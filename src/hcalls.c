@@ -43,6 +43,7 @@
 #include <guts.h>
 
 #include <malloc.h>
+#include <copy_engine.h>
 
 typedef void (*hcallfp_t)(trapframe_t *regs);
 
@@ -342,78 +343,79 @@ static void hcall_send_nmi(trapframe_t *regs)
 	regs->gpregs[3] = 0; /* success */
 }
 
-/**
- * Structure definition for the hcall_partition_memcpy scatter-gather list
- *
- * This structure must be aligned on 32-byte boundary
- *
- * @source: guest physical address to copy from
- * @destination: guest physical address to copy to
- * @size: number of bytes to copy
- * @reserved: reserved, must be zero
- */
-struct hcall_sg_list {
-	uint64_t source;
-	uint64_t target;
-	uint64_t size;
-	uint64_t reserved;
-} __attribute__ ((aligned (32)));
-
 #define SG_PER_PAGE	(PAGE_SIZE / sizeof(struct hcall_sg_list))
 
 /**
  * Copy a block of memory from one guest to another
+ *
+ * The scatter-gather list is read a page at a time into a buffer
+ * belonging to the calling vcpu, so managers copying on several
+ * vcpus at once do not contend with each other.  Interrupts are
+ * only held off for one entry at a time, while the per-thread
+ * temporary mappings are in use.
  */
 static void hcall_partition_memcpy(trapframe_t *regs)
 {
+	gcpu_t *gcpu = get_gcpu();
 	guest_t *source = handle_to_guest(regs->gpregs[3]);
 	guest_t *target = handle_to_guest(regs->gpregs[4]);
 
 	unsigned int num_sgs = regs->gpregs[7];
-	static struct hcall_sg_list sg_list[SG_PER_PAGE];
+	struct hcall_sg_list *sg_list = gcpu->memcpy_sg;
 	size_t sg_size = num_sgs * sizeof(struct hcall_sg_list);
 	phys_addr_t sg_gphys =
 		(phys_addr_t) regs->gpregs[6] << 32 | regs->gpregs[5];
-	static uint32_t sg_lock;
 
 	if (!source || !target) {
 		regs->gpregs[3] = EV_EINVAL;
 		return;
 	}
 
+	if (!sg_list) {
+		sg_list = alloc(PAGE_SIZE, __alignof__(struct hcall_sg_list));
+		if (!sg_list) {
+			regs->gpregs[3] = EV_ENOMEM;
+			return;
+		}
+
+		gcpu->memcpy_sg = sg_list;
+	}
+
 	while (num_sgs) {
 		size_t bytes_to_copy = min(PAGE_SIZE, sg_size);
 		unsigned int sg_to_copy = min(SG_PER_PAGE, num_sgs);
-
-		spin_lock_int(&sg_lock);
+		register_t saved;
 
 		/* Read the next page of the guest's scatter-gather list into
 		   memory. */
-		if (copy_from_gphys(get_gcpu()->guest->gphys, sg_list, sg_gphys,
+		saved = disable_int_save();
+		if (copy_from_gphys(gcpu->guest->gphys, sg_list, sg_gphys,
 				    bytes_to_copy) != bytes_to_copy) {
+			restore_int(saved);
 			regs->gpregs[3] = EV_EFAULT;
-			spin_unlock_int(&sg_lock);
 			return;
 		}
+		restore_int(saved);
 
 		/* Now go through that list and copy the memory one entry at a
 		   time. */
 		for (unsigned i = 0; i < sg_to_copy; i++) {
-			size_t size = copy_between_gphys(target->gphys,
+			size_t size;
+
+			saved = disable_int_save();
+			size = copy_between_gphys(target->gphys,
 				sg_list[i].target,
 				source->gphys,
 				sg_list[i].source,
 				sg_list[i].size);
+			restore_int(saved);
 
 			if (size != sg_list[i].size) {
 				regs->gpregs[3] = EV_EFAULT;
-				spin_unlock_int(&sg_lock);
 				return;
 			}
 		}
 
-		spin_unlock_int(&sg_lock);
-
 		sg_gphys += bytes_to_copy;
 		sg_size -= bytes_to_copy;
 		num_sgs -= sg_to_copy;
@@ -422,6 +424,59 @@ static void hcall_partition_memcpy(trapframe_t *regs)
 	regs->gpregs[3] = 0;
 }
 
+/**
+ * Start an asynchronous copy from one guest to another
+ *
+ * r3 and r4 are the source and target partition handles, r5/r6 the
+ * scatter-gather list as for partition_memcpy, and r7 the number of
+ * entries.  r8 is a doorbell send handle to ring on completion, or
+ * -1 for none.  On success the request id is returned in r4, to be
+ * passed to partition_memcpy_status.
+ */
+static void hcall_partition_memcpy_async(trapframe_t *regs)
+{
+	guest_t *guest = get_gcpu()->guest;
+	guest_t *source = handle_to_guest(regs->gpregs[3]);
+	guest_t *target = handle_to_guest(regs->gpregs[4]);
+	int handle = regs->gpregs[8];
+	phys_addr_t sg_gphys =
+		(phys_addr_t) regs->gpregs[6] << 32 | regs->gpregs[5];
+	ipi_doorbell_t *done = NULL;
+	unsigned int id;
+
+	if (!source || !target) {
+		regs->gpregs[3] = EV_EINVAL;
+		return;
+	}
+
+	if (handle != -1) {
+		if ((unsigned int)handle >= MAX_HANDLES ||
+		    !guest->handles[handle] || !guest->handles[handle]->db) {
+			regs->gpregs[3] = EV_EINVAL;
+			return;
+		}
+
+		done = guest->handles[handle]->db->dbell;
+	}
+
+	regs->gpregs[3] = copy_engine_submit(guest, source, target, sg_gphys,
+	                                     regs->gpregs[7], done, &id);
+	if (!regs->gpregs[3])
+		regs->gpregs[4] = id;
+}
+
+/**
+ * Collect the result of an asynchronous copy
+ *
+ * r3 is the request id.  EV_EAGAIN is returned while the copy is in
+ * progress; any other result frees the id.
+ */
+static void hcall_partition_memcpy_status(trapframe_t *regs)
+{
+	regs->gpregs[3] = copy_engine_status(get_gcpu()->guest,
+	                                     regs->gpregs[3]);
+}
+
 #ifdef CONFIG_PAMU
 static void hcall_dma_enable(trapframe_t *regs)
 {
@@ -482,13 +537,15 @@ static void hcall_byte_channel_send(trapframe_t *regs)
 		return;
 	}
 
+	/* A direct channel's data goes through its ring. */
 	byte_chan_handle_t *bc = guest->handles[handle]->bc;
-	if (!bc) {
+	if (!bc || bc->direct) {
 		regs->gpregs[3] = EV_EINVAL;
 		return;
 	}
 
-	register_t saved = spin_lock_intsave(&bc->tx_lock);
+	register_t saved = byte_chan_guest_lock(guest, &bc->tx_lock,
+	                                        &bc->tx_contended);
 
 	ssize_t ret = byte_chan_send(bc, buf, len);
 	if (ret == 0 && len != 0)
@@ -498,7 +555,7 @@ static void hcall_byte_channel_send(trapframe_t *regs)
 
 	regs->gpregs[4] = ret;
 
-	spin_unlock_intsave(&bc->tx_lock, saved);
+	byte_chan_guest_unlock(guest, &bc->tx_lock, saved);
 }
 
 static void hcall_byte_channel_receive(trapframe_t *regs)
@@ -521,14 +578,14 @@ static void hcall_byte_channel_receive(trapframe_t *regs)
 	}
 
 	byte_chan_handle_t *bc = guest->handles[handle]->bc;
-	if (!bc) {
+	if (!bc || bc->direct) {
 		regs->gpregs[3] = EV_EINVAL;
 		return;
 	}
 
-	saved = spin_lock_intsave(&bc->rx_lock);
+	saved = byte_chan_guest_lock(guest, &bc->rx_lock, &bc->rx_contended);
 	regs->gpregs[4] = byte_chan_receive(bc, outbuf, max_receive);
-	spin_unlock_intsave(&bc->rx_lock, saved);
+	byte_chan_guest_unlock(guest, &bc->rx_lock, saved);
 
 #ifdef CONFIG_LIBOS_64BIT
 	uint64_t tmp[2];
@@ -545,7 +602,6 @@ static void hcall_byte_channel_receive(trapframe_t *regs)
 
 static void hcall_byte_channel_poll(trapframe_t *regs)
 {
-	register_t saved;
 	guest_t *guest = get_gcpu()->guest;
 
 	unsigned int handle = regs->gpregs[3];
@@ -562,20 +618,190 @@ static void hcall_byte_channel_poll(trapframe_t *regs)
 		return;
 	}
 
-	saved = spin_lock_intsave(&bc->rx_lock);
-	regs->gpregs[4] = queue_get_avail(bc->rx);
-	spin_unlock_intsave(&bc->rx_lock, saved);
+	/* No locks needed for a snapshot: each count is derived from
+	 * the queue's head and tail, which are only ever advanced.
+	 * The result may be stale by the time the guest sees it, as it
+	 * could be with the locks held.
+	 */
+	if (bc->direct) {
+		uint32_t rx_avail, tx_space;
 
-	saved = spin_lock_intsave(&bc->tx_lock);
-	regs->gpregs[5] = queue_get_space(bc->tx);
-	spin_unlock_intsave(&bc->tx_lock, saved);
+		byte_chan_direct_status(bc, &rx_avail, &tx_space);
+		regs->gpregs[4] = rx_avail;
+		regs->gpregs[5] = tx_space;
+	} else {
+		regs->gpregs[4] = queue_get_avail(bc->rx);
+		regs->gpregs[5] = queue_get_space(bc->tx);
+	}
 
 	regs->gpregs[3] = 0;  /* success */
 }
+
+/*
+ * r3: handle
+ * r4: size of each ring data area, or zero to unregister
+ * r5: ring guest physical address (low)
+ * r6: ring guest physical address (high)
+ */
+static void hcall_byte_channel_ring_register(trapframe_t *regs)
+{
+	guest_t *guest = get_gcpu()->guest;
+	unsigned int handle = regs->gpregs[3];
+	phys_addr_t ring =
+		(phys_addr_t) regs->gpregs[6] << 32 | regs->gpregs[5];
+
+	// FIXME: race against handle closure
+	if (handle >= MAX_HANDLES || !guest->handles[handle]) {
+		regs->gpregs[3] = EV_EINVAL;
+		return;
+	}
+
+	byte_chan_handle_t *bc = guest->handles[handle]->bc;
+	if (!bc) {
+		regs->gpregs[3] = EV_EINVAL;
+		return;
+	}
+
+	regs->gpregs[3] = byte_chan_ring_register(bc, guest, ring,
+	                                          regs->gpregs[4]);
+}
+
+/*
+ * r3: handle
+ *
+ * Returns r4: bytes left in the tx area, r5: bytes unread in the rx area
+ */
+static void hcall_byte_channel_ring_kick(trapframe_t *regs)
+{
+	guest_t *guest = get_gcpu()->guest;
+	unsigned int handle = regs->gpregs[3];
+	uint32_t tx_left = 0, rx_pending = 0;
+
+	// FIXME: race against handle closure
+	if (handle >= MAX_HANDLES || !guest->handles[handle]) {
+		regs->gpregs[3] = EV_EINVAL;
+		return;
+	}
+
+	byte_chan_handle_t *bc = guest->handles[handle]->bc;
+	if (!bc) {
+		regs->gpregs[3] = EV_EINVAL;
+		return;
+	}
+
+	regs->gpregs[3] = byte_chan_ring_kick(bc, guest, &tx_left, &rx_pending);
+	regs->gpregs[4] = tx_left;
+	regs->gpregs[5] = rx_pending;
+}
+
+/* Descriptors are read and written back in batches of this many. */
+#define BC_VEC_BATCH 8
+
+static void byte_channel_vec(trapframe_t *regs, int send)
+{
+	guest_t *guest = get_gcpu()->guest;
+	unsigned int count = regs->gpregs[3];
+	phys_addr_t vec_gphys =
+		(phys_addr_t) regs->gpregs[5] << 32 | regs->gpregs[4];
+	byte_chan_vec_t vec[BC_VEC_BATCH];
+	unsigned long total = 0;
+
+	if (count > BYTE_CHAN_VEC_MAX) {
+		regs->gpregs[3] = EV_EINVAL;
+		return;
+	}
+
+	while (count) {
+		unsigned int num = min(count, (unsigned int)BC_VEC_BATCH);
+		size_t size = num * sizeof(byte_chan_vec_t);
+		register_t saved;
+		size_t copied;
+
+		saved = disable_int_save();
+		copied = copy_from_gphys(guest->gphys, vec, vec_gphys, size);
+		restore_int(saved);
+
+		if (copied != size) {
+			regs->gpregs[3] = EV_EFAULT;
+			return;
+		}
+
+		for (unsigned int i = 0; i < num; i++) {
+			byte_chan_vec_t *v = &vec[i];
+			byte_chan_handle_t *bc = NULL;
+
+			// FIXME: race against handle closure
+			if (v->handle < MAX_HANDLES && guest->handles[v->handle])
+				bc = guest->handles[v->handle]->bc;
+
+			if (!bc) {
+				v->len = 0;
+				v->status = EV_EINVAL;
+				continue;
+			}
+
+			if (send)
+				v->status = byte_chan_send_gphys(bc, guest,
+				                                 v->buf, &v->len);
+			else
+				v->status = byte_chan_receive_gphys(bc, guest,
+				                                    v->buf, &v->len);
+
+			total += v->len;
+		}
+
+		saved = disable_int_save();
+		copied = copy_to_gphys(guest->gphys, vec_gphys, vec, size, 0);
+		restore_int(saved);
+
+		if (copied != size) {
+			regs->gpregs[3] = EV_EFAULT;
+			return;
+		}
+
+		vec_gphys += size;
+		count -= num;
+	}
+
+	regs->gpregs[3] = 0;
+	regs->gpregs[4] = total;
+}
+
+/*
+ * r3: number of byte_chan_vec_t descriptors, up to BYTE_CHAN_VEC_MAX
+ * r4: descriptor array guest physical address (low)
+ * r5: descriptor array guest physical address (high)
+ *
+ * Returns r4: total bytes sent.  Each descriptor's len and status
+ * are written back.
+ */
+static void hcall_byte_channel_sendv(trapframe_t *regs)
+{
+	set_stat(bm_stat_bc_sendv, regs);
+	byte_channel_vec(regs, 1);
+}
+
+/*
+ * r3: number of byte_chan_vec_t descriptors, up to BYTE_CHAN_VEC_MAX
+ * r4: descriptor array guest physical address (low)
+ * r5: descriptor array guest physical address (high)
+ *
+ * Returns r4: total bytes received.  Each descriptor's len and status
+ * are written back.
+ */
+static void hcall_byte_channel_receivev(trapframe_t *regs)
+{
+	set_stat(bm_stat_bc_receivev, regs);
+	byte_channel_vec(regs, 0);
+}
 #else
 #define hcall_byte_channel_send unimplemented
 #define hcall_byte_channel_receive unimplemented
 #define hcall_byte_channel_poll unimplemented
+#define hcall_byte_channel_ring_register unimplemented
+#define hcall_byte_channel_ring_kick unimplemented
+#define hcall_byte_channel_sendv unimplemented
+#define hcall_byte_channel_receivev unimplemented
 #endif
 
 static void hcall_doorbell_send(trapframe_t *regs)
@@ -813,76 +1039,121 @@ out:
 }
 #endif
 
-
-static hcallfp_t fsl_hcall_table[] = {
-	unimplemented,
-	hcall_err_get_info,
-	hcall_partition_get_dtprop,
-	hcall_partition_set_dtprop,
-	hcall_partition_restart,              /* 4 */
-	hcall_partition_get_status,
-	hcall_partition_start,
-	hcall_partition_stop,
-	hcall_partition_memcpy,               /* 8 */
-	hcall_dma_enable,
-	hcall_dma_disable,
-	hcall_send_nmi,
-	hcall_vmpic_get_msir,                 /* 12 */
-	hcall_system_reset,
+/* Dispatch table entry.  The name is what the per-hcall statistics
+ * are reported under.
+ */
+typedef struct hcall_desc {
+	hcallfp_t fn;
+	const char *name;
+} hcall_desc_t;
+
+#define HCALL(name) { hcall_##name, #name }
+#define UNIMPLEMENTED { unimplemented, "unimplemented" }
+
+static const hcall_desc_t fsl_hcall_table[] = {
+	UNIMPLEMENTED,
+	HCALL(err_get_info),
+	HCALL(partition_get_dtprop),
+	HCALL(partition_set_dtprop),
+	HCALL(partition_restart),             /* 4 */
+	HCALL(partition_get_status),
+	HCALL(partition_start),
+	HCALL(partition_stop),
+	HCALL(partition_memcpy),              /* 8 */
+	HCALL(dma_enable),
+	HCALL(dma_disable),
+	HCALL(send_nmi),
+	HCALL(vmpic_get_msir),                /* 12 */
+	HCALL(system_reset),
 #ifdef CONFIG_PM
-	hcall_get_core_state,
-	hcall_enter_nap,
-	hcall_exit_nap,                       /* 16 */
+	HCALL(get_core_state),
+	HCALL(enter_nap),
+	HCALL(exit_nap),                      /* 16 */
 #else
-	unimplemented,
-	unimplemented,
-	unimplemented,                        /* 16 */
+	UNIMPLEMENTED,
+	UNIMPLEMENTED,
+	UNIMPLEMENTED,                        /* 16 */
 #endif
 #ifdef CONFIG_CLAIMABLE_DEVICES
-	hcall_claim_device,
+	HCALL(claim_device),
 #else
-	unimplemented,
+	UNIMPLEMENTED,
 #endif
 #ifdef CONFIG_PAMU
-	hcall_partition_stop_dma,
-	hcall_dma_attr_set,
-	hcall_dma_attr_get,                   /* 20 */
+	HCALL(partition_stop_dma),
+	HCALL(dma_attr_set),
+	HCALL(dma_attr_get),                  /* 20 */
 #else
-	unimplemented,
-	unimplemented,
-	unimplemented,
+	UNIMPLEMENTED,
+	UNIMPLEMENTED,
+	UNIMPLEMENTED,
 #endif
+	HCALL(byte_channel_ring_register),
+	HCALL(byte_channel_ring_kick),
+	HCALL(byte_channel_sendv),
+	HCALL(byte_channel_receivev),         /* 24 */
+	HCALL(partition_memcpy_async),
+	HCALL(partition_memcpy_status),
 };
 
-static hcallfp_t epapr_hcall_table[] = {
-	unimplemented,
-	hcall_byte_channel_send,
-	hcall_byte_channel_receive,
-	hcall_byte_channel_poll,
-	hcall_int_set_config,               /* 4 */
-	hcall_int_get_config,
-	hcall_int_set_mask,
-	hcall_int_get_mask,
-	unimplemented,                      /* 8 */
-	hcall_int_iack,
-	hcall_int_eoi,
-	unimplemented,
-	unimplemented,                      /* 12 */
-	unimplemented,
-	hcall_doorbell_send,
-	unimplemented,
-	unimplemented /* idle */,           /* 16 */
+static const hcall_desc_t epapr_hcall_table[] = {
+	UNIMPLEMENTED,
+	HCALL(byte_channel_send),
+	HCALL(byte_channel_receive),
+	HCALL(byte_channel_poll),
+	HCALL(int_set_config),              /* 4 */
+	HCALL(int_get_config),
+	HCALL(int_set_mask),
+	HCALL(int_get_mask),
+	UNIMPLEMENTED,                      /* 8 */
+	HCALL(int_iack),
+	HCALL(int_eoi),
+	UNIMPLEMENTED,
+	UNIMPLEMENTED,                      /* 12 */
+	UNIMPLEMENTED,
+	HCALL(doorbell_send),
+	UNIMPLEMENTED,
+	UNIMPLEMENTED /* idle */,           /* 16 */
 };
 
+#define NUM_EPAPR_HCALLS (sizeof(epapr_hcall_table) / sizeof(hcall_desc_t))
+#define NUM_FSL_HCALLS (sizeof(fsl_hcall_table) / sizeof(hcall_desc_t))
+
+/* Per-hcall statistics are indexed by the ePAPR hcall number, then
+ * NUM_EPAPR_HCALLS plus the Freescale hcall number, with a final slot
+ * for out-of-range hcall numbers.
+ */
+#define HCALL_STAT_FSL ((int)NUM_EPAPR_HCALLS)
+#define HCALL_STAT_INVALID ((int)(NUM_EPAPR_HCALLS + NUM_FSL_HCALLS))
+
+#ifdef CONFIG_STATISTICS
+int hcall_stat_count(void)
+{
+	return HCALL_STAT_INVALID + 1;
+}
+
+const char *hcall_stat_name(int index)
+{
+	if (index < HCALL_STAT_FSL)
+		return epapr_hcall_table[index].name;
+
+	if (index < HCALL_STAT_INVALID)
+		return fsl_hcall_table[index - HCALL_STAT_FSL].name;
+
+	return "invalid";
+}
+#endif
+
 #define HCALL_GET_VENDOR_ID(hcall_token)   (((hcall_token) & 0x7fffffff) >> 16)
 #define HCALL_GET_NUMBER(hcall_token)       ((hcall_token) & 0xffff)
 
 void hcall(trapframe_t *regs)
 {
+	uint32_t start = statistics_start();
 	unsigned int token;
 	unsigned int vendor_id;
 	unsigned int hcall_number;
-
+	int index;
 
 	set_stat(bm_stat_hcall, regs);
 
@@ -900,16 +1171,23 @@ void hcall(trapframe_t *regs)
 
 	/* FIXME: we support ePAPR vendor id == 0 for temporary backwards compatibility */
 	if (vendor_id == EV_VENDOR_ID || !vendor_id) {
-		if (unlikely(hcall_number >= sizeof(epapr_hcall_table) / sizeof(hcallfp_t))) {
+		if (unlikely(hcall_number >= NUM_EPAPR_HCALLS)) {
 			regs->gpregs[3] = EV_UNIMPLEMENTED;
-			return;
+			index = HCALL_STAT_INVALID;
+			goto out;
 		}
-		epapr_hcall_table[hcall_number](regs);
+		epapr_hcall_table[hcall_number].fn(regs);
+		index = hcall_number;
 	} else {
-		if (unlikely(hcall_number >= sizeof(fsl_hcall_table) / sizeof(hcallfp_t))) {
+		if (unlikely(hcall_number >= NUM_FSL_HCALLS)) {
 			regs->gpregs[3] = EV_UNIMPLEMENTED;
-			return;
+			index = HCALL_STAT_INVALID;
+			goto out;
 		}
-		fsl_hcall_table[hcall_number](regs);
+		fsl_hcall_table[hcall_number].fn(regs);
+		index = HCALL_STAT_FSL + hcall_number;
 	}
+
+out:
+	hcall_stat_stop(start, index);
 }
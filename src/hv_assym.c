@@ -30,6 +30,7 @@
 #include <libos-client.h>
 
 ASSYM(CLIENT_GCPU, offsetof(client_cpu_t, gcpu));
+ASSYM(CLIENT_TLBCACHE_GEN, offsetof(client_cpu_t, tlbcache_gen));
 #if defined(CONFIG_STATISTICS)
 ASSYM(TLB_MISS_COUNT, offsetof(gcpu_t, benchmarks[bm_stat_tlb_miss_count].num));
 #endif
@@ -57,6 +57,7 @@
 #include <thread.h>
 #include <error_log.h>
 #include <error_mgmt.h>
+#include <copy_engine.h>
 
 queue_t hv_global_event_queue;
 uint32_t hv_queue_prod_lock;
@@ -284,8 +285,8 @@ static void unmap_fdt(void)
 	/* We need to unmap the FDT, since we use TEMP_MAPPING1 in
 	 * TEMPTLB2, which could otherwise cause a duplicate TLB entry.
 	 */
-	tlb1_clear_entry(TEMPTLB1);
-	tlb1_clear_entry(TEMPTLB2);
+	clear_temp_tlb(TEMPTLB1);
+	clear_temp_tlb(TEMPTLB2);
 }
 
 extern queue_t early_console;
@@ -838,6 +839,33 @@ static void watchdog_init(void)
 }
 #endif
 
+/**
+ * Configure the hypervisor thread scheduler
+ *
+ * A sched-timeslice property in the HV config tree gives, in
+ * microseconds, how long a hypervisor thread may run while another
+ * of the same priority is waiting.  Without it, threads of equal
+ * priority run until they block.
+ */
+static void sched_config(void)
+{
+	const dt_prop_t *prop;
+	uint32_t usec;
+
+	prop = dt_get_prop(hvconfig, "sched-timeslice", 0);
+	if (!prop)
+		return;
+
+	if (prop->len != sizeof(uint32_t)) {
+		printlog(LOGTYPE_MISC, LOGLEVEL_ERROR,
+			 "sched: invalid sched-timeslice property\n");
+		return;
+	}
+
+	usec = *(const uint32_t *)prop->data;
+	sched_set_timeslice(dt_get_timebase_freq() * usec / 1000000);
+}
+
 /* partition_init_counter is atomically decremented each time a core
  * completes its partition init (or lack thereof if it has no
  * partition).  Once this reaches zero, gevents will be sent
@@ -1126,6 +1154,10 @@ void libos_client_entry(unsigned long treephys)
 	watchdog_init();
 #endif
 
+	sched_config();
+
+	copy_engine_init();
+
 #ifdef CONFIG_SHELL
 	shell_init();
 #endif
@@ -1320,6 +1352,8 @@ static void core_init(void)
 		         "Couldn't allocate displacement flush area\n");
 	}
 
+	hcall_stat_init();
+
 	/* dec init sequence
 	 *  -disable DEC interrupts
 	 *  -disable DEC auto reload
@@ -40,6 +40,34 @@
 
 #include <vpic.h>
 #include <vmpic.h>
+#include <slab.h>
+
+/* Interrupt every receiver now.  Called with dbell_lock held. */
+static int __send_doorbells(ipi_doorbell_t *dbell)
+{
+	guest_recv_dbell_list_t *receiver = dbell->normal_dbell->recv_head;
+	int count = 0;
+
+	dbell->rings = 0;
+
+	while (receiver) {
+		vpic_assert_vint(receiver->guest_vint);
+		receiver = receiver->next;
+		count++;
+	}
+
+	return count;
+}
+
+static void deliver_doorbell(coalesce_t *c)
+{
+	ipi_doorbell_t *dbell = to_container(c, ipi_doorbell_t, coalesce);
+	register_t saved;
+
+	saved = spin_lock_intsave(&dbell->dbell_lock);
+	__send_doorbells(dbell);
+	spin_unlock_intsave(&dbell->dbell_lock, saved);
+}
 
 /**
  * send_doorbells - send a doorbell interrupt to all receivers for a doorbell
@@ -60,23 +88,42 @@ int send_doorbells(struct ipi_doorbell *dbell)
 	}
 
 	saved = spin_lock_intsave(&dbell->dbell_lock);
-	if (dbell->normal_dbell->recv_head) {
-		guest_recv_dbell_list_t *receiver =
-					dbell->normal_dbell->recv_head;
-		while (receiver) {
-			vpic_assert_vint(receiver->guest_vint);
-			receiver = receiver->next;
-			count++;
-		}
+
+	if (dbell->coalesce.deliver) {
+		uint32_t rings = ++dbell->rings;
+
+		spin_unlock_intsave(&dbell->dbell_lock, saved);
+		coalesce_notify(&dbell->coalesce, rings);
+		return 1;
 	}
+
+	count = __send_doorbells(dbell);
 	spin_unlock_intsave(&dbell->dbell_lock, saved);
 
 	return count;
 }
 
+/* Rings held back are owed to the receivers, so a sender being reset
+ * has them delivered now rather than leave them to a timer.
+ */
+static void doorbell_prereset(handle_t *h, int stop)
+{
+	ipi_doorbell_t *dbell = h->db->dbell;
+
+	if (dbell->coalesce.deliver)
+		coalesce_reset(&dbell->coalesce, 1);
+}
+
+static handle_ops_t doorbell_handle_ops = {
+	.prereset = doorbell_prereset,
+};
+
+static SLAB_POOL(doorbell_pool, ipi_doorbell_t, 16);
+static SLAB_POOL(doorbell_handle_pool, struct ipi_doorbell_handle, 32);
+
 ipi_doorbell_t *alloc_doorbell(uint32_t type)
 {
-	ipi_doorbell_t *dbell = alloc_type(ipi_doorbell_t);
+	ipi_doorbell_t *dbell = slab_alloc(&doorbell_pool);
 	if (!dbell)
 		return NULL;
 
@@ -85,7 +132,7 @@ ipi_doorbell_t *alloc_doorbell(uint32_t type)
 		if (!dbell->normal_dbell) {
 			printlog(LOGTYPE_DOORBELL, LOGLEVEL_ERROR,
 				"%s: Failed to allocate memory\n", __func__);
-			free(dbell);
+			slab_free(&doorbell_pool, dbell);
 
 			return NULL;
 		}
@@ -94,14 +141,14 @@ ipi_doorbell_t *alloc_doorbell(uint32_t type)
 		if (!dbell->fast_dbell) {
 			printlog(LOGTYPE_DOORBELL, LOGLEVEL_ERROR,
 				"%s: Failed to allocate memory\n", __func__);
-			free(dbell);
+			slab_free(&doorbell_pool, dbell);
 
 			return NULL;
 		}
 	} else {
 		printlog(LOGTYPE_DOORBELL, LOGLEVEL_ERROR,
 			"%s: Invalid doorbell type\n", __func__);
-		free(dbell);
+		slab_free(&doorbell_pool, dbell);
 
 		return NULL;
 	}
@@ -114,7 +161,7 @@ void destroy_doorbell(ipi_doorbell_t *dbell)
 	if (dbell) {
 		free(dbell->normal_dbell);
 		free(dbell->fast_dbell);
-		free(dbell);
+		slab_free(&doorbell_pool, dbell);
 	}
 }
 
@@ -122,7 +169,7 @@ static uint32_t fdbell_lock;
 
 static int create_doorbell(dt_node_t *node, void *arg)
 {
-	ipi_doorbell_t *dbell = alloc_type(ipi_doorbell_t);
+	ipi_doorbell_t *dbell = slab_alloc(&doorbell_pool);
 	if (!dbell)
 		return ERR_NOMEM;
 
@@ -132,14 +179,14 @@ static int create_doorbell(dt_node_t *node, void *arg)
 			printlog(LOGTYPE_DOORBELL, LOGLEVEL_ERROR,
 				"%s: cannot create more than "
 				"4 fast doorbells\n", __func__);
-			free(dbell);
+			slab_free(&doorbell_pool, dbell);
 
 			return 0;
 		}
 
 		dbell->fast_dbell = alloc_type(ipi_fast_doorbell_t);
 		if (!dbell->fast_dbell) {
-			free(dbell);
+			slab_free(&doorbell_pool, dbell);
 			return ERR_NOMEM;
 		}
 
@@ -148,7 +195,7 @@ static int create_doorbell(dt_node_t *node, void *arg)
 		dbell->fast_dbell->global_handle = alloc_global_handle();
 		if (dbell->fast_dbell->global_handle < 0) {
 			free(dbell->fast_dbell);
-			free(dbell);
+			slab_free(&doorbell_pool, dbell);
 			ipi_fast_dbell--;
 			spin_unlock_intsave(&fdbell_lock, saved);
 
@@ -162,9 +209,12 @@ static int create_doorbell(dt_node_t *node, void *arg)
 	} else {
 		dbell->normal_dbell = alloc_type(ipi_normal_doorbell_t);
 		if (!dbell->normal_dbell) {
-			free(dbell);
+			slab_free(&doorbell_pool, dbell);
 			return ERR_NOMEM;
 		}
+
+		coalesce_init(&dbell->coalesce, node, "coalesce-count",
+		              "doorbell", deliver_doorbell);
 	}
 
 	node->dbell = dbell;
@@ -186,16 +236,17 @@ int doorbell_attach_guest(ipi_doorbell_t *dbell, guest_t *guest)
 {
 	struct ipi_doorbell_handle *db_handle;
 
-	db_handle = alloc_type(struct ipi_doorbell_handle);
+	db_handle = slab_alloc(&doorbell_handle_pool);
 	if (!db_handle) {
 		return ERR_NOMEM;
 	}
 	db_handle->user.db = db_handle;
+	db_handle->user.ops = &doorbell_handle_ops;
 	db_handle->dbell = dbell;
 
 	int ghandle = alloc_guest_handle(guest, &db_handle->user);
 	if (ghandle < 0) {
-		free(db_handle);
+		slab_free(&doorbell_handle_pool, db_handle);
 		return ERR_NOMEM;
 	}
 
@@ -208,7 +259,7 @@ static int attach_fast_doorbell(guest_t *guest, struct ipi_doorbell *dbell,
 	uint32_t handle[2];
 	int ret;
 
-	vmpic_interrupt_t *vmirq = alloc_type(vmpic_interrupt_t);
+	vmpic_interrupt_t *vmirq = slab_alloc(&vmpic_irq_pool);
 	if (!vmirq) {
 		printlog(LOGTYPE_DOORBELL, LOGLEVEL_ERROR,
 			"%s: out of memory\n", __func__);
@@ -229,7 +280,7 @@ static int attach_fast_doorbell(guest_t *guest, struct ipi_doorbell *dbell,
 	if (ret < 0) {
 		printlog(LOGTYPE_DOORBELL, LOGLEVEL_ERROR,
 			"%s: error in setting global handle\n", __func__);
-		free(vmirq);
+		slab_free(&vmpic_irq_pool, vmirq);
 
 		return ret;
 	}
@@ -242,7 +293,7 @@ static int attach_fast_doorbell(guest_t *guest, struct ipi_doorbell *dbell,
 		printlog(LOGTYPE_DOORBELL, LOGLEVEL_ERROR,
 			"%s: Couldn't set 'interrupts' property: %i\n",
 			__func__, ret);
-		free(vmirq);
+		slab_free(&vmpic_irq_pool, vmirq);
 
 		return ret;
 	}
@@ -31,10 +31,98 @@
 #include <paging.h>
 #include <percpu.h>
 #include <errors.h>
+#include <benchmark.h>
+#include <slab.h>
 #include <limits.h>
 
 phys_addr_t CCSRBAR_PA;
 
+/* Cached translations from an older generation are ignored.  This is
+ * bumped whenever a page table may have changed.
+ */
+static unsigned long xlate_cache_gen = 1;
+
+void vptbl_xlate_flush(void)
+{
+	/* Order the page table updates before the bump */
+	smp_lwsync();
+	atomic_add(&xlate_cache_gen, 1);
+}
+
+/* Large pages are cached by their 4MiB region, so that walking
+ * through a large page hits a single entry.  Small pages are cached
+ * by page number.
+ */
+static xlate_cache_entry_t *xlate_cache_slot(unsigned long epn, int large)
+{
+	if (large)
+		epn >>= PGDIR_SHIFT;
+
+	return &cpu->client.xlate_cache[epn & (XLATE_CACHE_SIZE - 1)];
+}
+
+static int xlate_cache_match(xlate_cache_entry_t *xc, pte_t *tbl,
+                             unsigned long epn, unsigned long gen)
+{
+	return xc->tbl == tbl && xc->gen == gen && epn - xc->epn < xc->pages;
+}
+
+static int xlate_cache_lookup(pte_t *tbl, unsigned long epn, pte_t *pte)
+{
+	unsigned long gen = xlate_cache_gen;
+	xlate_cache_entry_t *xc;
+	register_t saved;
+	int hit = 0;
+
+	/* An interrupt handler could refill the entry under us */
+	saved = disable_int_save();
+
+	xc = xlate_cache_slot(epn, 1);
+	if (!xlate_cache_match(xc, tbl, epn, gen)) {
+		xc = xlate_cache_slot(epn, 0);
+		if (!xlate_cache_match(xc, tbl, epn, gen))
+			goto out;
+	}
+
+	pte->page = xc->page;
+	pte->attr = xc->attr;
+	hit = 1;
+
+out:
+	restore_int(saved);
+	return hit;
+}
+
+static void xlate_cache_fill(pte_t *tbl, unsigned long epn,
+                             unsigned long gen, pte_t *pte)
+{
+	unsigned int size = pte->attr >> PTE_SIZE_SHIFT;
+	unsigned long size_pages = tsize_to_pages(size);
+	xlate_cache_entry_t *xc;
+	register_t saved;
+
+	saved = disable_int_save();
+
+	xc = xlate_cache_slot(epn, size >= TLB_TSIZE_4M);
+	xc->tbl = tbl;
+	xc->epn = epn & ~(size_pages - 1);
+	xc->pages = size_pages;
+	xc->page = pte->page;
+	xc->attr = pte->attr;
+	xc->gen = gen;
+
+	restore_int(saved);
+}
+
+#define PTBL_SIZE (PGDIR_SIZE * sizeof(pte_t))
+
+/* Page directories are taken from this pool.  vptbl_map() computes how
+ * many directories a mapping may need and reserves them as one chunk,
+ * rather than doing an alloc() per directory.  Directories released when
+ * a large page replaces small pages go back to the pool.
+ */
+static SLAB_POOL_SIZED(ptbl_pool, "page directory", PTBL_SIZE, PTBL_SIZE, 8);
+
 /* epn is already shifted by levels that the caller deals with. */
 static pte_t *vptbl_get_ptep(pte_t *tbl, int *levels, unsigned long epn,
                              int insert)
@@ -59,8 +147,7 @@ static pte_t *vptbl_get_ptep(pte_t *tbl, int *levels, unsigned long epn,
 			if (*levels == 0)
 				return ptep;
 
-			tbl = alloc(PGDIR_SIZE * sizeof(pte_t),
-			            PGDIR_SIZE * sizeof(pte_t));
+			tbl = slab_alloc(&ptbl_pool);
 			assert(tbl);
 
 			ptep->page = (unsigned long)tbl;
@@ -79,9 +166,24 @@ static pte_t *vptbl_get_ptep(pte_t *tbl, int *levels, unsigned long epn,
 unsigned long vptbl_xlate(pte_t *tbl, unsigned long epn,
                           unsigned long *attr, int level, int dma)
 {
-	pte_t *ptep = vptbl_get_ptep(tbl, &level, epn, 0);
 	int valid = dma ? PTE_DMA : PTE_VALID;
+	unsigned long gen = xlate_cache_gen;
+	unsigned long size_pages;
+	unsigned int size;
+	pte_t *ptep;
+	pte_t pte;
+
+	if (likely(xlate_cache_lookup(tbl, epn, &pte))) {
+		statistics_count(bm_stat_xlate_hit);
+		goto found;
+	}
 
+	statistics_count(bm_stat_xlate_miss);
+
+	/* Don't let the table walk see entries older than gen */
+	smp_lwsync();
+
+	ptep = vptbl_get_ptep(tbl, &level, epn, 0);
 	if (unlikely(!ptep)) {
 		*attr = 0;
 		printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
@@ -90,9 +192,7 @@ unsigned long vptbl_xlate(pte_t *tbl, unsigned long epn,
 		return (1UL << (PGDIR_SHIFT * level)) - 1;
 	}
 
-	pte_t pte = *ptep;
-	unsigned int size = pte.attr >> PTE_SIZE_SHIFT;
-	unsigned long size_pages;
+	pte = *ptep;
 
 	printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
 	         "vtable xlate %p 0x%llx 0x%lx\n", tbl,
@@ -110,15 +210,64 @@ unsigned long vptbl_xlate(pte_t *tbl, unsigned long epn,
 		assert(size >= TLB_TSIZE_4G);
 	}
 
+	xlate_cache_fill(tbl, epn, gen, &pte);
+
+found:
 	*attr = pte.attr;
+	size = pte.attr >> PTE_SIZE_SHIFT;
 
-	if (unlikely(!(pte.attr & valid)))
+	if (unlikely(!(pte.attr & valid))) {
+		level = (size >= TLB_TSIZE_4M) + (size >= TLB_TSIZE_4G);
 		return (1UL << (PGDIR_SHIFT * level)) - 1;
+	}
 
 	size_pages = tsize_to_pages(size);
 	return (pte.page & ~(size_pages - 1)) | (epn & (size_pages - 1));
 }
 
+/* Return an upper bound on the number of page directories that mapping
+ * the range could allocate.  Each page is mapped with the same sizes as
+ * vptbl_map() uses, and needs a directory for every level between the
+ * top level and its own, once per region that the directory covers.
+ * Directories that already exist are not accounted for.
+ */
+static unsigned long vptbl_count_tables(unsigned long epn, unsigned long rpn,
+                                        unsigned long end, int levels)
+{
+	unsigned long last[PTE_PHYS_LEVELS];
+	unsigned long count = 0;
+	int i;
+
+	assert(levels <= PTE_PHYS_LEVELS);
+
+	for (i = 0; i < PTE_PHYS_LEVELS; i++)
+		last[i] = ULONG_MAX;
+
+	while (epn < end) {
+		unsigned int size = min(max_page_size(epn, end - epn),
+		                        natural_alignment(rpn));
+		unsigned long size_pages = tsize_to_pages(size);
+		int largepage = (size >= TLB_TSIZE_4M) + (size >= TLB_TSIZE_4G);
+
+		/* Pages are naturally aligned, so each one falls within
+		 * a single region at every higher level.
+		 */
+		for (i = largepage; i < levels - 1; i++) {
+			unsigned long region = epn >> (PGDIR_SHIFT * (i + 1));
+
+			if (region != last[i]) {
+				last[i] = region;
+				count++;
+			}
+		}
+
+		epn += size_pages;
+		rpn += size_pages;
+	}
+
+	return count;
+}
+
 /* Large mappings are a latency source -- this should only be done
    at initialization, when processing the device tree. */
 
@@ -130,6 +279,8 @@ void vptbl_map(pte_t *tbl, unsigned long epn, unsigned long rpn,
 	printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_DEBUG,
 	         "vptbl_map: epn %lx end %lx rpn %lx\n", epn, end, rpn);
 
+	slab_reserve(&ptbl_pool, vptbl_count_tables(epn, rpn, end, levels));
+
 	while (epn < end) {
 		unsigned int size = min(max_page_size(epn, end - epn),
 		                        natural_alignment(rpn));
@@ -188,10 +339,32 @@ void vptbl_map(pte_t *tbl, unsigned long epn, unsigned long rpn,
 					for (int i = 0; i < PGDIR_SIZE; i++)
 						if ((next_ptep[i].attr & PTE_VALID) &&
 						   (!(next_ptep[i].attr & PTE_SIZE)))
-							free((void *)next_ptep[i].page);
+							slab_free(&ptbl_pool,
+							          (pte_t *)next_ptep[i].page);
 				}
 
-				free((void *)ptep->page);
+				slab_free(&ptbl_pool, (pte_t *)ptep->page);
+			}
+
+			/* Small pages are filled to the end of the directory
+			 * without walking the table again for each one.
+			 */
+			if (!largepage) {
+				unsigned long run = min(sub_end - epn,
+				                        PGDIR_SIZE - (epn & (PGDIR_SIZE - 1)));
+
+				printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
+				         "epn %lx: setting %lx pages at rpn %lx attr %lx\n",
+				         epn, run, rpn, attr);
+
+				for (unsigned long i = 0; i < run; i++) {
+					ptep[i].page = rpn + i;
+					ptep[i].attr = attr;
+				}
+
+				epn += run;
+				rpn += run;
+				continue;
 			}
 
 			ptep->page = rpn;
@@ -205,6 +378,8 @@ next:
 			rpn = (rpn | incr) + 1;
 		}
 	}
+
+	vptbl_xlate_flush();
 }
 
 #ifdef CONFIG_DEVICE_VIRT
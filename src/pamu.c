@@ -48,6 +48,7 @@
 #include <error_log.h>
 #include <error_mgmt.h>
 #include <guts.h>
+#include <slab.h>
 #include <devtree.h>
 
 static const char *pamu_err_policy[PAMU_ERROR_COUNT];
@@ -442,7 +443,7 @@ static unsigned long setup_pcie_msi_subwin(guest_t *guest, dt_node_t *cfgnode,
 		}
 	}
 
-	tlb1_clear_entry(TEMPTLB1);
+	clear_temp_tlb(TEMPTLB1);
 
 	if (i > 2) {
 		printlog(LOGTYPE_PAMU, LOGLEVEL_ERROR,
@@ -930,6 +931,44 @@ int hv_pamu_disable_liodn(unsigned int handle)
 	return 0;
 }
 
+/** Give a hypervisor-owned DMA engine access to all of memory
+ *
+ * The hypervisor translates guest addresses itself before
+ * programming the engine, so the window is an identity mapping of
+ * the whole 36-bit physical address space.
+ *
+ * @param[in] liodn the engine's LIODN
+ * @return 0 or an ERR_ code
+ */
+int hv_pamu_config_hv_liodn(uint32_t liodn)
+{
+	uint32_t saved;
+	int ret;
+
+	if (liodn >= PAACE_NUMBER_ENTRIES)
+		return ERR_INVALID;
+
+	ret = pamu_config_ppaace(liodn, 0, 1ULL << 36, ~(uint32_t)0, 0,
+	                         ~(uint32_t)0, ~(uint32_t)0, 0);
+	if (ret < 0) {
+		printlog(LOGTYPE_PAMU, LOGLEVEL_ERROR,
+		         "%s: liodn %u in use\n", __func__, liodn);
+		return ret;
+	}
+
+#ifdef CONFIG_ERRATUM_PAMU_A_004510
+	saved = spin_lock_intsave(&pamu_lock);
+#endif
+
+	ret = pamu_enable_liodn(liodn);
+
+#ifdef CONFIG_ERRATUM_PAMU_A_004510
+	spin_unlock_intsave(&pamu_lock, saved);
+#endif
+
+	return ret;
+}
+
 static void setup_omt(void)
 {
 	ome_t *ome;
@@ -1709,6 +1748,8 @@ static handle_ops_t pamu_handle_ops = {
 	.postreset = pamu_reset_handle,
 };
 
+static SLAB_POOL(pamu_handle_pool, pamu_handle_t, 32);
+
 void hcall_partition_stop_dma(trapframe_t *regs)
 {
 	guest_t *guest = handle_to_guest(regs->gpregs[3]);
@@ -1821,7 +1862,7 @@ int configure_dma(dt_node_t *hwnode, dev_owner_t *owner)
 		}
 
 		if (!pamu_handle) {
-			pamu_handle = alloc_type(pamu_handle_t);
+			pamu_handle = slab_alloc(&pamu_handle_pool);
 			if (!pamu_handle)
 				goto nomem;
 
@@ -40,6 +40,7 @@
 #include <devtree.h>
 #include <events.h>
 #include <doorbell.h>
+#include <timers.h>
 
 #define RCPM_REV1	1
 #define RCPM_REV2	2
@@ -309,6 +310,14 @@ out:
 	regs->gpregs[3] = ret;
 }
 
+/* The FIT has fired for this CPU's timer wheel during a nap.  It is
+ * handled once the nap is over and interrupts are enabled again.
+ */
+static int timer_wheel_due(void)
+{
+	return cpu->client.timers_pending && (mfspr(SPR_TSR) & TSR_FIS);
+}
+
 void idle_loop(void)
 {
 	nap_state_t ns;
@@ -322,6 +331,8 @@ void idle_loop(void)
 	 * idle without intending to nap.
 	 */
 	while (1) {
+		register_t tcr;
+
 		disable_int();
 
 		/* Disable decrementer, FIT, and watchdog interrupts.  Reset
@@ -330,7 +341,17 @@ void idle_loop(void)
 		 * napping.
 		 */
 		ns.tcr = mfspr(SPR_TCR);
-		mtspr(SPR_TCR, ns.tcr & ~(TCR_DIE | TCR_FIE | TCR_WIE | TCR_WP_MASK));
+		tcr = ns.tcr & ~(TCR_DIE | TCR_FIE | TCR_WIE | TCR_WP_MASK);
+
+		/* If this CPU's timer wheel has timers pending, keep the
+		 * FIT running at the wheel's period, so that it wakes the
+		 * core in time for the next one.
+		 */
+		if (cpu->client.timers_pending)
+			tcr = (tcr & ~TCR_FP_MASK) | TCR_FIE |
+			      TCR_INT_TO_FP(timer_wheel_fp());
+
+		mtspr(SPR_TCR, tcr);
 
 		/* There is a small possibility that the that the watchdog
 		 * expired after we disabled (critical) interrupts, but before
@@ -350,7 +371,8 @@ void idle_loop(void)
 
 		cpu->client.nap_request = 1;
 
-		while (gcpu->napping && !gcpu->gevent_pending) {
+		while (gcpu->napping && !gcpu->gevent_pending &&
+		       !timer_wheel_due()) {
 			uint64_t tb;
 			setevent(cpu0.client.gcpu, EV_SYNC_NAP);
 
@@ -368,7 +390,8 @@ void idle_loop(void)
 				while (get_tb() - tb2 < tb_freq / 10000)
 					;
 
-				if (!gcpu->napping || gcpu->gevent_pending)
+				if (!gcpu->napping || gcpu->gevent_pending ||
+				    timer_wheel_due())
 					break;
 			}
 		}
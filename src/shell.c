@@ -39,6 +39,13 @@
 #include <guts.h>
 #include <benchmark.h>
 #include <error_mgmt.h>
+#include <slab.h>
+#include <byte_chan.h>
+#include <bcmux.h>
+#include <coalesce.h>
+#include <copy_engine.h>
+#include <vmpic.h>
+#include <vpic.h>
 
 extern command_t *shellcmd_begin, *shellcmd_end;
 
@@ -136,7 +143,7 @@ void shell_init(void)
 
 		shell->out = stdout;
 
-		thread = new_thread(shell_thread, shell, 1);
+		thread = new_thread("shell", shell_thread, shell, 1);
 		if (thread)
 			unblock(thread);
 		else
@@ -739,7 +746,7 @@ static void dump_tlb(shell_t *shell, gcpu_t *gcpu)
 
 			qprintf(shell->out, 1, "%02u  ",
 				(tlb_num ? (int) MAS0_GET_TLB1ESEL(gmas.mas0) :
-							(int) MAS0_GET_TLB0ESEL(gmas.mas0)));
+							(int) TLBC_GET_ESEL(gmas.mas0)));
 
 			qprintf(shell->out, 1,
 				"0x%0" VADDR_WIDTH "lx - 0x%0" VADDR_WIDTH "lx ",
@@ -815,8 +822,9 @@ shell_cmd(gtlb);
 #ifdef CONFIG_STATISTICS
 #define MICRO_BENCHMARK_START bm_tlb0_inv_pid
 extern const char *benchmark_names[];
+extern const char *event_names[];
 
-static unsigned long tb_to_nsec(uint64_t freq, unsigned long ticks)
+static unsigned long tb_to_nsec(uint64_t freq, uint64_t ticks)
 {
 	return ticks * 1000000000ULL / freq;
 }
@@ -846,6 +854,125 @@ static void print_stats(shell_t *shell, gcpu_t *gcpu, int start, int end, int to
 		qprintf(shell->out, 1, "-------------------------------------------------------------------------------\n");
 		qprintf(shell->out, 1, "TOTAL                    %10lu\n", total);
 	}
+
+	for (benchmark_num_t i = start; i < end; i++) {
+		benchmark_t *bm = &gcpu->benchmarks[i];
+
+		/* Kept in 64 bits: the accumulated time of a few image
+		 * loads does not fit in 32 bits of nanoseconds.
+		 */
+		if (bm->bytes && bm->accum)
+			qprintf(shell->out, 1, "%-24s %10llu bytes %10llu MB/s\n",
+			        benchmark_names[i], (unsigned long long)bm->bytes,
+			        (unsigned long long)(bm->bytes * freq / bm->accum /
+			                             1000000));
+	}
+}
+
+static void print_event_stats(shell_t *shell, gcpu_t *gcpu)
+{
+	qprintf(shell->out, 1, "\nHypervisor event             Raised  Coalesced      Local     Remote\n");
+	qprintf(shell->out, 1, "-------------------------------------------------------------------------------\n");
+
+	for (int i = 0; i < NUM_EVENTS; i++) {
+		event_stat_t *es = &gcpu->event_stats[i];
+
+		qprintf(shell->out, 1, "%-24s %10lu %10lu %10lu %10lu\n",
+		        event_names[i], es->raised, es->coalesced,
+		        es->local, es->remote);
+	}
+}
+
+/* Upper bound, in timebase ticks, of the histogram bucket that the
+ * given percentile of calls falls into.
+ */
+static unsigned long hcall_percentile(hcall_stat_t *hs, int pct)
+{
+	unsigned long seen = 0;
+
+	for (int i = 0; i < HCALL_HIST_BUCKETS - 1; i++) {
+		seen += hs->hist[i];
+
+		if (seen * 100 >= hs->num * pct)
+			return min(2UL << i, hs->max);
+	}
+
+	return hs->max;
+}
+
+static void print_hcall_stats(shell_t *shell, gcpu_t *gcpu)
+{
+	uint64_t freq = dt_get_timebase_freq();
+
+	if (!gcpu->hcall_stats)
+		return;
+
+	qprintf(shell->out, 1, "\nHcall                         Count    Avg(ns)    p50(ns)    p99(ns)    Max(ns)\n");
+	qprintf(shell->out, 1, "-------------------------------------------------------------------------------\n");
+
+	for (int i = 0; i < hcall_stat_count(); i++) {
+		hcall_stat_t *hs = &gcpu->hcall_stats[i];
+
+		if (!hs->num)
+			continue;
+
+		qprintf(shell->out, 1, "%-24s %10lu %10lu %10lu %10lu %10lu\n",
+		        hcall_stat_name(i), hs->num,
+		        tb_to_nsec(freq, hs->accum / hs->num),
+		        tb_to_nsec(freq, hcall_percentile(hs, 50)),
+		        tb_to_nsec(freq, hcall_percentile(hs, 99)),
+		        tb_to_nsec(freq, hs->max));
+	}
+}
+
+/* One line per hcall that has been called, for consumption by tools
+ * on the other end of the console byte channel.  Bucket n of the
+ * histogram counts calls of [2^n, 2^(n+1)) timebase ticks.
+ */
+static void print_hcall_csv(shell_t *shell, int gcpu_num, gcpu_t *gcpu)
+{
+	if (!gcpu->hcall_stats)
+		return;
+
+	for (int i = 0; i < hcall_stat_count(); i++) {
+		hcall_stat_t *hs = &gcpu->hcall_stats[i];
+
+		if (!hs->num)
+			continue;
+
+		qprintf(shell->out, 1, "%d,%d,%s,%lu,%llu,%lu",
+		        gcpu_num, i, hcall_stat_name(i), hs->num,
+		        (unsigned long long)hs->accum, hs->max);
+
+		for (int j = 0; j < HCALL_HIST_BUCKETS; j++)
+			qprintf(shell->out, 1, ",%lu", hs->hist[j]);
+
+		qprintf(shell->out, 1, "\n");
+	}
+}
+
+static void dump_hcall_stats(shell_t *shell, int num, int csv)
+{
+	guest_t *guest = &guests[num];
+
+	if (csv)
+		qprintf(shell->out, 1, "# timebase %llu\n"
+		        "# gcpu,index,hcall,count,total_ticks,max_ticks,hist0..hist%d\n",
+		        (unsigned long long)dt_get_timebase_freq(),
+		        HCALL_HIST_BUCKETS - 1);
+	else
+		qprintf(shell->out, 1, "Guest: %s\n", guest->name);
+
+	for (int i = 0; i < guest->cpucnt; i++) {
+		gcpu_t *gcpu = guest->gcpus[i];
+
+		if (csv) {
+			print_hcall_csv(shell, i, gcpu);
+		} else {
+			qprintf(shell->out, 1, "guest gcpu: %d\n", i);
+			print_hcall_stats(shell, gcpu);
+		}
+	}
 }
 
 static void dump_stats(shell_t *shell, int num)
@@ -864,11 +991,18 @@ static void dump_stats(shell_t *shell, int num)
 		gcpu_t *gcpu = guest->gcpus[i];
 		qprintf(shell->out, 1, "guest gcpu: %d\n", i);
 		print_stats(shell, gcpu, 0, MICRO_BENCHMARK_START, 1);
+		print_event_stats(shell, gcpu);
+		qprintf(shell->out, 1, "\nvpic lock contended      %10lu\n",
+		        gcpu->vpic.lock_contended);
+		qprintf(shell->out, 1, "vpic interrupts posted   %10lu\n",
+		        gcpu->vpic.posted);
 	#ifdef CONFIG_BENCHMARKS
 		qprintf(shell->out, 1, "\nMicro Benchmarks:\n");
 		print_stats(shell, gcpu, MICRO_BENCHMARK_START, num_benchmarks, 0);
 	#endif
 	}
+	qprintf(shell->out, 1, "\nguest vpic lock contended %9lu\n",
+	        guest->vpic.lock_contended);
 	qprintf(shell->out, 1, "\n");
 }
 
@@ -878,12 +1012,21 @@ static void clear_stats(int num)
 	int i;
 
 	guest = &guests[num];
+	guest->vpic.lock_contended = 0;
+
 	for (i = 0; i < guest->cpucnt; i++) {
 		gcpu_t *gcpu = guest->gcpus[i];
 		for (benchmark_num_t i = 0; i < num_benchmarks; i++) {
 			benchmark_t *bm = &gcpu->benchmarks[i];
 			memset(bm, 0, sizeof(benchmark_t));
 		}
+		memset(gcpu->event_stats, 0, sizeof(gcpu->event_stats));
+		gcpu->vpic.lock_contended = 0;
+		gcpu->vpic.posted = 0;
+
+		if (gcpu->hcall_stats)
+			memset(gcpu->hcall_stats, 0,
+			       hcall_stat_count() * sizeof(hcall_stat_t));
 	}
 }
 
@@ -909,6 +1052,10 @@ static void stats_fn(shell_t *shell, char *args)
 		dump_stats(shell, num);
 	else if (!strcmp(cmdstr, "clear"))
 		clear_stats(num);
+	else if (!strcmp(cmdstr, "hcalls"))
+		dump_hcall_stats(shell, num, 0);
+	else if (!strcmp(cmdstr, "hcalls-csv"))
+		dump_hcall_stats(shell, num, 1);
 }
 
 static command_t stats = {
@@ -916,7 +1063,10 @@ static command_t stats = {
 	.action = stats_fn,
 	.shorthelp = "Print statistics/microbenchmark information",
 	.longhelp = "  Usage: stats <cmd> <partition-spec>\n\n"
-	            "  'print' & 'clear' commands are supported.",
+	            "  'print' & 'clear' commands are supported.\n"
+	            "  'hcalls' prints per-hcall counts and latencies, and\n"
+	            "  'hcalls-csv' the same with full latency histograms\n"
+	            "  in comma-separated form.",
 };
 shell_cmd(stats);
 #endif
@@ -1014,6 +1164,131 @@ static command_t guestmem = {
 };
 shell_cmd(guestmem);
 
+static void irqs_fn(shell_t *shell, char *args)
+{
+	vmpic_balance_t *bal;
+	guest_t *guest;
+	char *numstr;
+	int num, i;
+
+	args = stripspace(args);
+	numstr = nextword(shell->out, &args);
+
+	if (!numstr) {
+		qprintf(shell->out, 1, "Usage: irqs <partition-spec>\n");
+		return;
+	}
+
+	num = get_partition_num(shell, numstr);
+	if (num == -1)
+		return;
+
+	guest = &guests[num];
+	bal = guest->irq_balance;
+
+	qprintf(shell->out, 1, "Balancing: %s, %lu moves\n",
+	        bal ? vmpic_balance_policy_name(bal->policy) : "off",
+	        bal ? bal->moves : 0);
+
+	qprintf(shell->out, 1, "Handle  Type  Count        Rate/s     Vcpu  Pinned\n");
+	qprintf(shell->out, 1, "------------------------------------------------\n");
+
+	for (i = 0; i < MAX_HANDLES; i++) {
+		handle_t *h = guest->handles[i];
+		vmpic_interrupt_t *vmirq;
+		int target;
+
+		if (!h || !h->intr)
+			continue;
+
+		vmirq = h->intr;
+		target = vmpic_is_claimed(vmirq) ? vmpic_irq_target(vmirq) : -1;
+
+		qprintf(shell->out, 1, "%-7d %-5s %-12lu %-10lu ",
+		        i, vmirq->irq->ops == &vpic_ops ? "virt" : "hw",
+		        vmirq->count, vmirq->rate);
+
+		if (target < 0)
+			qprintf(shell->out, 1, "%-5s", "-");
+		else
+			qprintf(shell->out, 1, "%-5d", target);
+
+		qprintf(shell->out, 1, " %s\n", vmirq->pinned ? "yes" : "no");
+	}
+}
+
+static command_t irqs = {
+	.name = "irqs",
+	.action = irqs_fn,
+	.shorthelp = "Print partition interrupt routing and rates",
+	.longhelp = "  Usage: irqs <partition-spec>\n\n"
+	            "  Rates are sampled when the partition has an\n"
+	            "  irq-balance property.  Pinned interrupts were routed\n"
+	            "  by the guest and are not moved by the balancer.",
+};
+shell_cmd(irqs);
+
+#define SHELL_MAX_THREADS 16
+
+static uint64_t tb_to_usec(uint64_t freq, uint64_t ticks)
+{
+	return ticks / freq * 1000000 + ticks % freq * 1000000 / freq;
+}
+
+static void threads_fn(shell_t *shell, char *args)
+{
+	thread_stat_t ts[SHELL_MAX_THREADS];
+	uint64_t freq = dt_get_timebase_freq();
+	sched_stat_t ss;
+	unsigned int core;
+
+	qprintf(shell->out, 1, "Core  Thread            Prio  State    "
+	        "Runtime(us)  Runs      Wakeups   Wait avg/max(us)\n");
+	qprintf(shell->out, 1, "----------------------------------------"
+	        "-------------------------------------------------\n");
+
+	for (core = 0; core < CONFIG_LIBOS_MAX_CPUS; core++) {
+		int i, n = sched_snapshot(core, &ss, ts, SHELL_MAX_THREADS);
+
+		for (i = 0; i < n; i++) {
+			const char *state;
+
+			if (ts[i].current)
+				state = "running";
+			else if (ts[i].state == sched_blocked)
+				state = "blocked";
+			else
+				state = "ready";
+
+			/* Each run but the idle thread's ends a wait */
+			qprintf(shell->out, 1, "%-5u %-17s %-5d %-8s %-12llu "
+			        "%-9lu %-9lu %llu/%llu\n",
+			        core, ts[i].name ? ts[i].name : "?",
+			        ts[i].prio, state,
+			        tb_to_usec(freq, ts[i].runtime),
+			        ts[i].runs, ts[i].wakeups,
+			        ts[i].runs ?
+			            tb_to_usec(freq, ts[i].wait_total / ts[i].runs) : 0,
+			        tb_to_usec(freq, ts[i].wait_max));
+		}
+
+		if (n >= 0)
+			qprintf(shell->out, 1, "%-5u %lu switches, %lu remote wakeups, "
+			        "%lu time slices\n", core, ss.switches,
+			        ss.remote_wakeups, ss.slices);
+	}
+}
+
+static command_t threads = {
+	.name = "threads",
+	.action = threads_fn,
+	.shorthelp = "Print hypervisor threads and scheduler statistics",
+	.longhelp = "  Usage: threads\n\n"
+	            "  Wait times are from when a thread became runnable,\n"
+	            "  by being woken or preempted, until it ran.",
+};
+shell_cmd(threads);
+
 
 static void error_policy_dump_fn(shell_t *shell, char *args)
 {
@@ -1068,6 +1343,158 @@ static command_t build_config = {
 shell_cmd(build_config);
 #endif
 
+static void slabs_fn(shell_t *shell, char *args)
+{
+	slab_pool_t **i;
+	unsigned long total = 0;
+
+	qprintf(shell->out, 1, "Pool                          Size   Slabs   In use     Peak     Free      Bytes\n");
+	qprintf(shell->out, 1, "--------------------------------------------------------------------------------\n");
+
+	for (i = &slab_pool_begin; i < &slab_pool_end; i++) {
+		slab_pool_t *pool = *i;
+
+		qprintf(shell->out, 1, "%-28s %6zu %7lu %8lu %8lu %8lu %10lu\n",
+		        pool->name, pool->objsize, pool->slabs, pool->inuse,
+		        pool->peak, pool->avail, pool->bytes);
+		total += pool->bytes;
+	}
+
+	qprintf(shell->out, 1, "--------------------------------------------------------------------------------\n");
+	qprintf(shell->out, 1, "TOTAL %74lu\n", total);
+}
+
+static command_t slabs = {
+	.name = "slabs",
+	.action = slabs_fn,
+	.shorthelp = "Print object pool usage",
+};
+shell_cmd(slabs);
+
+static void coalesce_fn(shell_t *shell, char *args)
+{
+	coalesce_t *c;
+
+	qprintf(shell->out, 1, "Node                 Kind     Threshold      Delay  Delivered Suppressed\n");
+	qprintf(shell->out, 1, "--------------------------------------------------------------------------\n");
+
+	for (c = coalesce_list; c; c = c->next)
+		qprintf(shell->out, 1, "%-20s %-8s %9u %10u %10lu %10lu\n",
+		        c->name, c->kind, c->threshold, c->delay,
+		        c->delivered, c->suppressed);
+}
+
+static command_t coalesce = {
+	.name = "coalesce",
+	.action = coalesce_fn,
+	.shorthelp = "Print interrupt coalescing statistics",
+};
+shell_cmd(coalesce);
+
+static void copies_fn(shell_t *shell, char *args)
+{
+	uint64_t freq = dt_get_timebase_freq();
+	copy_backend_t *be;
+
+	qprintf(shell->out, 1, "Backend              Requests        Bytes   Faults     MB/s\n");
+	qprintf(shell->out, 1, "---------------------------------------------------------------\n");
+
+	for (be = copy_backends; be; be = be->next) {
+		/* Time spent sleeping between chunks counts as busy. */
+		uint64_t rate = 0;
+
+		if (be->busy_tb)
+			rate = be->bytes * freq / be->busy_tb / 1000000;
+
+		qprintf(shell->out, 1, "%-20s %8lu %12llu %8lu %8llu\n",
+		        be->name, be->requests, (unsigned long long)be->bytes,
+		        be->faults, (unsigned long long)rate);
+	}
+}
+
+static command_t copies = {
+	.name = "copies",
+	.action = copies_fn,
+	.shorthelp = "Print asynchronous partition copy statistics",
+};
+shell_cmd(copies);
+
+#ifdef CONFIG_BYTE_CHAN
+static int print_byte_chan(dt_node_t *node, void *arg)
+{
+	shell_t *shell = arg;
+	byte_chan_handle_t *bc = node->bch;
+
+	if (!bc)
+		return 0;
+
+	qprintf(shell->out, 1, "%-20s %6zu %6zu %6zu %6zu %6zu %6zu %6u %9lu %9lu\n",
+	        node->name,
+	        bc->tx->size, queue_get_avail(bc->tx), bc->tx_hwm,
+	        bc->rx->size, queue_get_avail(bc->rx), bc->rx_hwm,
+	        bc->ring_size ? bc->ring_size : bc->direct_size,
+	        bc->tx_contended, bc->rx_contended);
+	return 0;
+}
+
+static void bytechan_fn(shell_t *shell, char *args)
+{
+	qprintf(shell->out, 1, "Byte channel          TX sz   TX q TX max  RX sz   RX q RX max   Ring   TX wait   RX wait\n");
+	qprintf(shell->out, 1, "-----------------------------------------------------------------------------------------\n");
+
+	dt_for_each_compatible(config_tree, "byte-channel", print_byte_chan, shell);
+
+	qprintf(shell->out, 1, "-----------------------------------------------------------------------------------------\n");
+	qprintf(shell->out, 1, "Queue memory: %lu bytes\n", byte_chan_queue_bytes);
+}
+
+static command_t bytechan = {
+	.name = "bytechan",
+	.action = bytechan_fn,
+	.shorthelp = "Print byte channel queue sizes, fill levels and lock statistics",
+};
+shell_cmd(bytechan);
+#endif
+
+#ifdef CONFIG_BCMUX
+static int print_bcmux(dt_node_t *node, void *arg)
+{
+	shell_t *shell = arg;
+	mux_complex_t *mux = node->bcmux;
+	connected_bc_t *cbc;
+
+	if (!mux)
+		return 0;
+
+	qprintf(shell->out, 1, "%s: %s, %d rx bytes discarded\n", node->name,
+	        mux->framed ? "framed" :
+	        mux->framed_ack ? "framed ack pending" : "unframed",
+	        mux->rx_discarded);
+
+	for (cbc = mux->first_bc; cbc; cbc = cbc->next)
+		qprintf(shell->out, 1, "%7d %6d %12lu %12lu %10lu %6zu\n",
+		        cbc->num, cbc->weight, cbc->tx_bytes, cbc->rx_bytes,
+		        cbc->rx_dropped, queue_get_avail(cbc->byte_chan->rx));
+
+	return 0;
+}
+
+static void bcmux_fn(shell_t *shell, char *args)
+{
+	qprintf(shell->out, 1, "Channel Weight     TX bytes     RX bytes  Discarded TX q\n");
+	qprintf(shell->out, 1, "-------------------------------------------------------\n");
+
+	dt_for_each_compatible(config_tree, "byte-channel-mux", print_bcmux, shell);
+}
+
+static command_t bcmux = {
+	.name = "bcmux",
+	.action = bcmux_fn,
+	.shorthelp = "Print byte channel multiplexer per-channel statistics",
+};
+shell_cmd(bcmux);
+#endif
+
 #ifdef CONFIG_HV_WATCHDOG
 static void crash_fn(shell_t *shell, char *args)
 {
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+#include <libos/trapframe.h>
+
+#include <libos/libos.h>
+#include <libos/alloc.h>
+#include <libos/printlog.h>
+
+#include <slab.h>
+#include <errors.h>
+#include <percpu.h>
+
+static size_t slab_objsize(slab_pool_t *pool)
+{
+	size_t size = max(pool->objsize, sizeof(void *));
+
+	return (size + pool->align - 1) & ~(pool->align - 1);
+}
+
+/* Called with the pool lock held. */
+static void slab_add(slab_pool_t *pool, char *chunk, unsigned long count)
+{
+	size_t size = slab_objsize(pool);
+
+	for (unsigned long i = 0; i < count; i++) {
+		void **obj = (void **)(chunk + i * size);
+
+		*obj = pool->free;
+		pool->free = obj;
+	}
+
+	pool->avail += count;
+	pool->slabs++;
+	pool->bytes += count * size;
+}
+
+static int slab_grow(slab_pool_t *pool, unsigned long count)
+{
+	register_t saved;
+	char *chunk;
+
+	chunk = alloc(count * slab_objsize(pool), pool->align);
+	if (!chunk) {
+		printlog(LOGTYPE_MISC, LOGLEVEL_ERROR,
+		         "%s: %s: out of memory\n", __func__, pool->name);
+		return ERR_NOMEM;
+	}
+
+	saved = spin_lock_intsave(&pool->lock);
+	slab_add(pool, chunk, count);
+	spin_unlock_intsave(&pool->lock, saved);
+
+	return 0;
+}
+
+/** Allocate a zeroed object from a pool.
+ *
+ * @param[in] pool the pool to allocate from
+ * @return the object, or NULL if out of memory
+ */
+void *slab_alloc(slab_pool_t *pool)
+{
+	register_t saved;
+	void **obj;
+
+	saved = spin_lock_intsave(&pool->lock);
+
+	while (!pool->free) {
+		spin_unlock_intsave(&pool->lock, saved);
+
+		if (slab_grow(pool, pool->objs_per_slab) < 0) {
+			saved = spin_lock_intsave(&pool->lock);
+			pool->failed++;
+			spin_unlock_intsave(&pool->lock, saved);
+			return NULL;
+		}
+
+		saved = spin_lock_intsave(&pool->lock);
+	}
+
+	obj = pool->free;
+	pool->free = *obj;
+	pool->avail--;
+
+	if (++pool->inuse > pool->peak)
+		pool->peak = pool->inuse;
+
+	spin_unlock_intsave(&pool->lock, saved);
+
+	memset(obj, 0, pool->objsize);
+	return obj;
+}
+
+/** Return an object to its pool.
+ *
+ * @param[in] pool the pool that obj was allocated from
+ * @param[in] obj the object, or NULL
+ */
+void slab_free(slab_pool_t *pool, void *obj)
+{
+	register_t saved;
+
+	if (!obj)
+		return;
+
+	saved = spin_lock_intsave(&pool->lock);
+
+	*(void **)obj = pool->free;
+	pool->free = obj;
+	pool->avail++;
+	pool->inuse--;
+
+	spin_unlock_intsave(&pool->lock, saved);
+}
+
+/** Make sure that a pool can satisfy a number of allocations.
+ *
+ * @param[in] pool the pool to fill
+ * @param[in] count the number of objects needed
+ * @return zero on success, ERR_NOMEM if the objects could not be allocated
+ *
+ * The missing objects are allocated as a single chunk.
+ */
+int slab_reserve(slab_pool_t *pool, unsigned long count)
+{
+	register_t saved;
+
+	saved = spin_lock_intsave(&pool->lock);
+	count = count > pool->avail ? count - pool->avail : 0;
+	spin_unlock_intsave(&pool->lock, saved);
+
+	if (!count)
+		return 0;
+
+	return slab_grow(pool, count);
+}
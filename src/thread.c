@@ -29,31 +29,119 @@
 #include <libos/trapframe.h>
 #include <libos/trap_booke.h>
 #include <libos/alloc.h>
+#include <libos/bitops.h>
 
 #include <thread.h>
 #include <hv.h>
 #include <events.h>
+#include <timers.h>
 
 static sched_t scheds[CONFIG_LIBOS_MAX_CPUS];
 
+/* Rotates equal-priority threads on each CPU; see sched_set_timeslice() */
+static hv_timer_t slice_timers[CONFIG_LIBOS_MAX_CPUS];
+static uint64_t slice_ticks;
+
 #ifdef CONFIG_LIBOS_64BIT
 extern unsigned long toc_start;
 #endif
 
+/* Called with sched->lock held */
+static void rq_add(sched_t *sched, thread_t *thread)
+{
+	list_add(&sched->rq[thread->prio], &thread->rq_node);
+	sched->rq_mask |= 1 << thread->prio;
+}
+
+/* Called with sched->lock held */
+static void rq_del(sched_t *sched, thread_t *thread)
+{
+	list_del(&thread->rq_node);
+
+	if (list_empty(&sched->rq[thread->prio]))
+		sched->rq_mask &= ~(1 << thread->prio);
+}
+
+/* Called with sched->lock held.  Returns true if another thread of the
+ * same priority is waiting behind this one.
+ */
+static int has_peer(sched_t *sched, thread_t *thread)
+{
+	return sched->rq[thread->prio].prev != &thread->rq_node;
+}
+
+static void slice_expired(hv_timer_t *timer)
+{
+	sched_t *sched = &scheds[timer - slice_timers];
+	thread_t *thread;
+	int resched = 0;
+
+	spin_lock(&sched->lock);
+
+	sched->slice_pending = 0;
+	thread = sched->cur;
+
+	/* Send the current thread to the back of its queue */
+	if (thread != &sched->idle && thread->state != sched_blocked &&
+	    has_peer(sched, thread)) {
+		list_del(&thread->rq_node);
+		list_add(sched->rq[thread->prio].prev, &thread->rq_node);
+		sched->slices++;
+		resched = 1;
+	}
+
+	spin_unlock(&sched->lock);
+
+	if (resched)
+		setevent(sched->sched_cpu->client.gcpu, EV_RESCHED);
+}
+
 static void do_schedule(sched_t *sched)
 {
-	libos_thread_t *thread = &sched->idle.libos_thread;
+	thread_t *prev = cur_thread();
+	thread_t *next = &sched->idle;
+	uint64_t now = get_tb();
 
 	assert(cpu->traplevel <= TRAPLEVEL_NORMAL);
 
-	for (int i = 0; i < NUM_PRIOS; i++)
-		if (!list_empty(&sched->rq[i]))
-			thread = &to_container(sched->rq[i].next,
-			                       thread_t, rq_node)->libos_thread;
+	if (sched->rq_mask) {
+		int prio = 31 - count_msb_zeroes_32(sched->rq_mask);
+		next = to_container(sched->rq[prio].next, thread_t, rq_node);
+	}
+
+	prev->runtime += now - prev->last_run;
+
+	if (next != prev) {
+		sched->switches++;
+		next->runs++;
+
+		/* A preempted thread is waiting to run again */
+		if (prev != &sched->idle && prev->state != sched_blocked)
+			prev->ready_since = now;
+
+		if (next->ready_since) {
+			uint64_t wait = now - next->ready_since;
+
+			next->wait_total += wait;
+			if (next->wait_max < wait)
+				next->wait_max = wait;
+
+			next->ready_since = 0;
+		}
+	}
+
+	next->last_run = now;
+	sched->cur = next;
+
+	if (slice_ticks && !sched->slice_pending &&
+	    next != &sched->idle && has_peer(sched, next)) {
+		sched->slice_pending = 1;
+		hv_timer_add(&slice_timers[cpu->coreid], now + slice_ticks);
+	}
 
 	spin_unlock(&sched->lock);
 
-	switch_thread(thread);
+	switch_thread(&next->libos_thread);
 }
 
 void schedule(trapframe_t *regs)
@@ -86,7 +174,7 @@ void block(void)
 
 	if (thread->state == sched_prep_block) {
 		thread->state = sched_blocked;
-		list_del(&thread->rq_node);
+		rq_del(sched, thread);
 		do_schedule(sched);
 		restore_int(saved);
 		return;
@@ -105,8 +193,20 @@ void unblock(thread_t *thread)
 	saved = spin_lock_intsave(&sched->lock);
 
 	if (thread->state == sched_blocked) {
-		list_add(&sched->rq[thread->prio], &thread->rq_node);
-		setevent(sched->sched_cpu->client.gcpu, EV_RESCHED);
+		thread->ready_since = get_tb();
+		thread->wakeups++;
+		rq_add(sched, thread);
+
+		/* A thread of lower priority than the current one will be
+		 * picked up when the current one blocks.
+		 */
+		if (sched->cur == &sched->idle ||
+		    thread->prio >= sched->cur->prio) {
+			if (sched->sched_cpu != cpu)
+				sched->remote_wakeups++;
+
+			setevent(sched->sched_cpu->client.gcpu, EV_RESCHED);
+		}
 	}
 
 	thread->state = sched_running;
@@ -118,10 +218,43 @@ void libos_unblock(libos_thread_t *lthread)
 	unblock(thread_from_libos(lthread));
 }
 
-void new_thread_inplace(thread_t *thread, uint8_t *kstack,
+/* Threads can be reinitialized in place, e.g. a vcpu's thread when
+ * its partition restarts.  Such a thread is still in the list, and
+ * must be taken out before its node is cleared.  The list is searched
+ * rather than the node trusted, as a new thread's memory is garbage.
+ *
+ * Called with sched->lock held
+ */
+static void sched_del_thread(sched_t *sched, thread_t *thread)
+{
+	list_t *node;
+
+	list_for_each(&sched->threads, node) {
+		if (node == &thread->sched_node) {
+			list_del(node);
+			break;
+		}
+	}
+}
+
+/* Called with sched->lock held */
+static void sched_add_thread(sched_t *sched, thread_t *thread)
+{
+	list_add(sched->threads.prev, &thread->sched_node);
+}
+
+void new_thread_inplace(thread_t *thread, const char *name, uint8_t *kstack,
                         void (*func)(trapframe_t *regs, void *arg),
                         void *arg, int prio)
 {
+	sched_t *sched = &scheds[cpu->coreid];
+	register_t saved;
+
+	assert(prio >= 0 && prio < NUM_PRIOS);
+
+	saved = spin_lock_intsave(&sched->lock);
+
+	sched_del_thread(sched, thread);
 	memset(thread, 0, sizeof(thread_t));
 
 	thread->libos_thread.kstack = &kstack[KSTACK_SIZE - FRAMELEN];
@@ -132,9 +265,11 @@ void new_thread_inplace(thread_t *thread, uint8_t *kstack,
 	thread->libos_thread.pc = ret_from_exception;
 	thread->libos_thread.stack = regs;
 
-	thread->sched = &scheds[cpu->coreid];
+	thread->sched = sched;
+	thread->name = name;
 	thread->state = sched_blocked;
 	thread->prio = prio;
+	thread->last_run = get_tb();
 
 	regs->gpregs[1] = (register_t)regs;
 #ifndef CONFIG_LIBOS_64BIT
@@ -161,9 +296,13 @@ void new_thread_inplace(thread_t *thread, uint8_t *kstack,
 #endif
 
 	regs->lr = (register_t)ret_from_exception;
+
+	sched_add_thread(sched, thread);
+	spin_unlock_intsave(&sched->lock, saved);
 }
 
-thread_t *new_thread(void (*func)(trapframe_t *regs, void *arg),
+thread_t *new_thread(const char *name,
+                     void (*func)(trapframe_t *regs, void *arg),
                      void *arg, int prio)
 {
 	thread_t *thread = malloc(sizeof(thread_t));
@@ -176,7 +315,7 @@ thread_t *new_thread(void (*func)(trapframe_t *regs, void *arg),
 		return NULL;
 	}
 
-	new_thread_inplace(thread, stack, func, arg, prio);
+	new_thread_inplace(thread, name, stack, func, arg, prio);
 	return thread;
 }
 
@@ -186,14 +325,92 @@ void sched_core_init(cpu_t *sched_cpu)
 
 	sched->sched_cpu = sched_cpu;
 	sched->idle.sched = sched;
+	sched->idle.name = "idle";
 	sched->idle.libos_thread.kstack = sched_cpu->kstack;
+	sched->idle.last_run = get_tb();
+	sched->cur = &sched->idle;
 
 	for (int i = 0; i < NUM_PRIOS; i++)
 		list_init(&sched->rq[i]);
 
+	list_init(&sched->threads);
+	list_add(&sched->threads, &sched->idle.sched_node);
+
+	slice_timers[sched_cpu->coreid].fn = slice_expired;
+
 	sched_cpu->thread = &sched->idle.libos_thread;
 }
 
 void sched_init(void)
 {
 }
+
+/** Set the time slice for threads of equal priority
+ *
+ * A thread that has run for this long while another thread of the same
+ * priority is runnable goes to the back of its run queue.  Threads of
+ * higher priority still always preempt lower ones.
+ *
+ * @param[in] ticks slice length in timebase ticks, or 0 to let threads
+ * run until they block
+ */
+void sched_set_timeslice(uint64_t ticks)
+{
+	slice_ticks = ticks;
+}
+
+/** Copy a CPU's scheduler accounting
+ *
+ * @param[in] coreid the CPU
+ * @param[out] ss the CPU's totals
+ * @param[out] ts the per-thread accounting
+ * @param[in] max the number of entries in ts
+ * @return the number of entries filled in, or -1 if the CPU has
+ * no scheduler
+ */
+int sched_snapshot(unsigned int coreid, sched_stat_t *ss,
+                   thread_stat_t *ts, int max)
+{
+	sched_t *sched;
+	register_t saved;
+	uint64_t now;
+	list_t *node;
+	int n = 0;
+
+	if (coreid >= CONFIG_LIBOS_MAX_CPUS || !scheds[coreid].sched_cpu)
+		return -1;
+
+	sched = &scheds[coreid];
+
+	saved = spin_lock_intsave(&sched->lock);
+	now = get_tb();
+
+	ss->switches = sched->switches;
+	ss->remote_wakeups = sched->remote_wakeups;
+	ss->slices = sched->slices;
+
+	list_for_each(&sched->threads, node) {
+		thread_t *thread = to_container(node, thread_t, sched_node);
+
+		if (n == max)
+			break;
+
+		ts[n].name = thread->name;
+		ts[n].prio = thread->prio;
+		ts[n].state = thread->state;
+		ts[n].current = thread == sched->cur;
+		ts[n].runtime = thread->runtime;
+		ts[n].wait_total = thread->wait_total;
+		ts[n].wait_max = thread->wait_max;
+		ts[n].runs = thread->runs;
+		ts[n].wakeups = thread->wakeups;
+
+		if (ts[n].current)
+			ts[n].runtime += now - thread->last_run;
+
+		n++;
+	}
+
+	spin_unlock_intsave(&sched->lock, saved);
+	return n;
+}
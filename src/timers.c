@@ -42,6 +42,162 @@
 #include <timers.h>
 #include <benchmark.h>
 
+/* Hardware FIT period, as a TCR_INT_TO_FP() value, that interrupts
+ * once per timer wheel tick.
+ */
+#define TIMER_WHEEL_FP (64 - TIMER_WHEEL_SHIFT)
+
+/* Longest FIT period used for the timer wheel.  It may be more than
+ * a turn of the wheel: run_timer_wheel() copes with falling behind.
+ */
+#define TIMER_WHEEL_MAX_PERIOD (1UL << 31)
+
+/** FIT period needed by this CPU's timer wheel
+ *
+ * The longest power of two no longer than the time until the earliest
+ * pending timer, and no shorter than a wheel tick, so that the FIT
+ * interrupts no later than that timer and then comes faster as it
+ * approaches, rather than every tick for as long as any timer is
+ * pending.
+ *
+ * @return a TCR_INT_TO_FP() value, or 0 if no timers are pending
+ */
+unsigned int timer_wheel_fp(void)
+{
+	client_cpu_t *c = &cpu->client;
+	uint64_t now = get_tb();
+	unsigned long delta;
+
+	if (!c->timers_pending)
+		return 0;
+
+	if (c->timer_next <= now)
+		return TIMER_WHEEL_FP;
+
+	delta = min(c->timer_next - now, (uint64_t)TIMER_WHEEL_MAX_PERIOD);
+	if (delta >> TIMER_WHEEL_SHIFT == 0)
+		return TIMER_WHEEL_FP;
+
+	return 64 - ilog2(delta);
+}
+
+/* Set the actual hardware FIT period to the maximum of the guest
+ * watchdog and guest FIT periods, and of the timer wheel's if it has
+ * timers pending.
+ */
+static void update_fit_period(gcpu_t *gcpu)
+{
+	register_t tcr = mfspr(SPR_TCR);
+	unsigned int period;
+
+	period = max(TCR_FP_TO_INT(gcpu->gtcr), TCR_WP_TO_INT(gcpu->gtcr));
+	period = max(period, timer_wheel_fp());
+
+	tcr = (tcr & ~TCR_FP_MASK) | TCR_INT_TO_FP(period);
+	mtspr(SPR_TCR, tcr);
+}
+
+/* Find the earliest expiry on this CPU's timer wheel. */
+static void find_next_timer(client_cpu_t *c)
+{
+	uint64_t next = ~0ULL;
+	hv_timer_t *timer;
+	int i;
+
+	for (i = 0; i < TIMER_WHEEL_SLOTS; i++)
+		for (timer = c->timer_wheel[i]; timer; timer = timer->next)
+			next = min(next, timer->expires);
+
+	c->timer_next = next;
+}
+
+/** Add a timer to this CPU's timer wheel
+ *
+ * The timer must not already be pending.
+ *
+ * @param[in] timer the timer, with fn set
+ * @param[in] expires timebase value to fire at
+ */
+void hv_timer_add(hv_timer_t *timer, uint64_t expires)
+{
+	client_cpu_t *c = &cpu->client;
+	register_t saved = disable_int_save();
+	uint64_t tick = expires >> TIMER_WHEEL_SHIFT;
+	unsigned int slot;
+
+	if (!c->timers_pending)
+		c->timer_wheel_tick = get_tb() >> TIMER_WHEEL_SHIFT;
+
+	/* Already expired: run it on the next FIT. */
+	if (tick < c->timer_wheel_tick)
+		tick = c->timer_wheel_tick;
+
+	timer->expires = expires;
+	slot = tick & (TIMER_WHEEL_SLOTS - 1);
+	timer->next = c->timer_wheel[slot];
+	c->timer_wheel[slot] = timer;
+
+	if (c->timers_pending++ == 0 || expires < c->timer_next) {
+		c->timer_next = expires;
+		update_fit_period(get_gcpu());
+	}
+
+	restore_int(saved);
+}
+
+/* Run the timers expired by the ticks that have passed since the
+ * last call.  Called from the FIT handler.
+ */
+static void run_timer_wheel(gcpu_t *gcpu, uint64_t tb)
+{
+	client_cpu_t *c = &cpu->client;
+	uint64_t now = tb >> TIMER_WHEEL_SHIFT;
+	hv_timer_t *expired = NULL, *timer;
+	int slots = 0;
+
+	if (!c->timers_pending)
+		return;
+
+	/* Only finished ticks are run, so every timer in a slot that
+	 * is run has expired, bar those a whole turn of the wheel away.
+	 */
+	while (c->timer_wheel_tick < now && slots++ < TIMER_WHEEL_SLOTS) {
+		unsigned int slot = c->timer_wheel_tick & (TIMER_WHEEL_SLOTS - 1);
+		hv_timer_t **prev = &c->timer_wheel[slot];
+
+		while ((timer = *prev)) {
+			if (timer->expires > tb) {
+				prev = &timer->next;
+				continue;
+			}
+
+			*prev = timer->next;
+			timer->next = expired;
+			expired = timer;
+			c->timers_pending--;
+		}
+
+		c->timer_wheel_tick++;
+	}
+
+	/* More than a turn behind: every slot has been looked at. */
+	if (c->timer_wheel_tick < now)
+		c->timer_wheel_tick = now;
+
+	/* Shorten the FIT period as the next timer comes closer. */
+	if (expired)
+		find_next_timer(c);
+
+	update_fit_period(gcpu);
+
+	/* Callbacks run last, as they may add timers. */
+	while (expired) {
+		timer = expired;
+		expired = timer->next;
+		timer->fn(timer);
+	}
+}
+
 void decrementer(trapframe_t *regs)
 {
 	gcpu_t *gcpu = get_gcpu();
@@ -220,6 +376,8 @@ void fit(trapframe_t *regs)
 		}
 	}
 
+	run_timer_wheel(gcpu, tb);
+
 	// Finally, remember the current timebase for next time
 	cpu->client.previous_tb = tb;
 }
@@ -261,8 +419,7 @@ void watchdog_trap(trapframe_t *regs)
 void set_tcr(uint32_t val)
 {
 	gcpu_t *gcpu = get_gcpu();
-	unsigned int period;
-	register_t tcr = mfspr(SPR_TCR);
+	register_t tcr;
 
 	/* The watchdog is fully emulated by the hypervisor, so we never allow
 	 * the guest to read or modify any of the real watchdog bits in TCR.
@@ -293,12 +450,10 @@ void set_tcr(uint32_t val)
 	if ((val & TCR_DIE)&&  (gcpu->gtsr & TSR_DIS))
 		send_local_guest_doorbell();
 
-	// Set the actual hardware FIT period to the maximum of the guest
-	// watchdog and guest FIT periods
-	period = max(TCR_FP_TO_INT(gcpu->gtcr), TCR_WP_TO_INT(gcpu->gtcr));
-	tcr = (tcr & ~TCR_FP_MASK) | TCR_INT_TO_FP(period);
+	update_fit_period(gcpu);
 
 	// Pass on any bits that are not fully emulated
+	tcr = mfspr(SPR_TCR);
 	tcr = (tcr & ~GCPU_TCR_HW_BITS) | (val & GCPU_TCR_HW_BITS);
 
 	mtspr(SPR_TCR, tcr);
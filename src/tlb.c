@@ -96,6 +96,7 @@ static void free_tlb1(unsigned int entry, int write_tlb)
 
 			gcpu->tlb1_map[entry][i] &= ~(1UL << bit);
 			shared_cpu->tlb1_inuse[i] &= ~(1UL << bit);
+			shared_cpu->tlb1_ref[i] &= ~(1UL << bit);
 		}
 
 		i++;
@@ -123,6 +124,7 @@ static int alloc_tlb1(unsigned int entry, int evict)
 				goto none_avail;
 
 			shared_cpu->tlb1_inuse[i] |= 1UL << bit;
+			shared_cpu->tlb1_ref[i] |= 1UL << bit;
 			gcpu->tlb1_map[entry][i] |= 1UL << bit;
 
 			tlb_unlock(saved);
@@ -143,11 +145,35 @@ none_avail:
 	if (evict) {
 		int bit;
 
-		i = shared_cpu->evict_tlb1++;
+		/* The guest entry being refilled is in use, so the real
+		 * entries it already has should not be chosen as victims.
+		 */
+		for (idx = 0; idx < (int)(sizeof(tlbmap_t) / sizeof(long)); idx++)
+			shared_cpu->tlb1_ref[idx] |= gcpu->tlb1_map[entry][idx];
+
+		/* Clock replacement: entries referenced since the hand last
+		 * passed them get a second chance.  This terminates within
+		 * two revolutions, as the hand clears the bits it passes.
+		 */
+		for (;;) {
+			i = shared_cpu->evict_tlb1++;
+			if (shared_cpu->evict_tlb1 > GUEST_TLB_END)
+				shared_cpu->evict_tlb1 = 0;
+
+			idx = i / LONG_BITS;
+			bit = i % LONG_BITS;
 
-		idx = i / LONG_BITS;
-		bit = i % LONG_BITS;
+			if (!(shared_cpu->tlb1_ref[idx] & (1UL << bit)))
+				break;
+
+			shared_cpu->tlb1_ref[idx] &= ~(1UL << bit);
+		}
 
+		/* Only count a victim that still held a translation. */
+		if (cpu->tlb1[i].mas1 & MAS1_VALID)
+			statistics_count(bm_stat_tlb1_evict);
+
+		shared_cpu->tlb1_ref[idx] |= 1UL << bit;
 		gcpu->tlb1_map[entry][idx] |= 1UL << bit;
 		for (int j = 0; j < TLB1_GSIZE; j++) {
 			if (j != entry && (gcpu->tlb1_map[j][idx] & (1UL << bit))) {
@@ -161,9 +187,6 @@ none_avail:
 			}
 		}
 
-		if (shared_cpu->evict_tlb1 > GUEST_TLB_END)
-			shared_cpu->evict_tlb1 = 0;
-
 		tlb_unlock(saved);
 		return i;
 	}
@@ -172,120 +195,15 @@ none_avail:
 	return -1;
 }
 
-/**
- * Find a TLB cache entry, or a slot suitable for use
- *
- * @param[in]  vaddr Virtual (effective) address
- * @param[in]  tag   TLB tag to find
- * @param[out] setp  TLB set containing entry
- * @param[out] way   way within the set
- * @param[in]  ignorespace AS does not need to match (used for invalidation)
- *
- * If a translation for the address exists in the cache, then setp/way is
- * filled in appropriately, and the return value is non-zero.
- *
- * Otherwise, setp and way are filled in with a suitable slot for adding
- * such a translation.  Evicting the current contents of the slot
- * is the responsibility of the caller.
- */
-
-int find_gtlb_entry(uintptr_t vaddr, tlbctag_t tag,
-                    tlbcset_t **setp, unsigned int *way)
-{
-	tlbcset_t *set;
-	tlbctag_t mask;
-	int index;
-	int i;
-
-	printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
-	         "find vaddr %lx tag %lx\n", vaddr, tag.tag);
-
-	mask.tag = ~0UL;
-	mask.pid = 0;
-
-	index = vaddr >> PAGE_SHIFT;
-	index &= (1 << cpu->client.tlbcache_bits) - 1;
-
-	*setp = set = &cpu->client.tlbcache[index];
-
-	for (i = 0; i < TLBC_WAYS; i++) {
-		int pid = set->tag[i].pid;
-
-		printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
-		         "pid %d tag.pid %d set->tag %lx mask %lx\n",
-		         pid, tag.pid, set->tag[i].tag, mask.tag);
-
-		if (pid != tag.pid && tag.pid != 0 && pid != 0)
-			continue;
-
-		if (((tag.tag ^ set->tag[i].tag) & mask.tag) == 0) {
-			*way = i;
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
-/**
- * Check for a TLB0 cache entry that conflicts with a new TLB1 entry.
- *
- * @param[in]  epn   Effective page number
- * @param[in]  tsize Size of the TLB1 mapping
- * @param[in]  pid   PID of mapping
- * @param[in]  space zero if AS0, 1 if AS1
- * @return non-zero if a conflicting entry was found
- */
-int check_tlb1_conflict(uintptr_t epn, unsigned int tsize,
-                        unsigned int pid, unsigned int space)
-{
- 	uintptr_t pages = tsize_to_pages(tsize);
- 	int mask = (1 << cpu->client.tlbcache_bits) - 1;
-	unsigned int cache_entries = min(pages, 1 << cpu->client.tlbcache_bits);
-	unsigned int index = epn & mask;
-	unsigned int end = index + cache_entries;
-
-	tlbcset_t *set = &cpu->client.tlbcache[index];
-
-	uintptr_t tag_start = epn >> cpu->client.tlbcache_bits;
-	uintptr_t tag_end = (epn + pages - 1) >> cpu->client.tlbcache_bits;
-
-	for (; index < end; set++, index++) {
-		int way;
-
-		for (way = 0; way < TLBC_WAYS; way++) {
-			if (!set->tag[way].valid)
-				continue;
-
-			if (set->tag[way].vaddr < tag_start ||
-			    set->tag[way].vaddr > tag_end)
-				continue;
-
-			if (pid != 0 && pid != set->tag[way].pid)
-				continue;
-
-			if (space != set->tag[way].space)
-				continue;
-
-			printlog(LOGTYPE_EMU, LOGLEVEL_ERROR,
-			         "check_tlb1_conflict: tag 0x%08lx entry 0x%08x 0x%08x way %d\n",
-			         set->tag[way].tag, set->entry[way].mas3,
-			         set->entry[way].pad, way);
-
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
 void gtlb0_to_mas(unsigned int index, unsigned int way, gcpu_t *gcpu)
 {
-	tlbcset_t *set = &gcpu->cpu->client.tlbcache[index];
+	tlbcset_t *set = tlbc_get_set(gcpu->cpu, index);
+	tlbctag_t *tag = tlbc_tag(set, way);
+	tlbcentry_t *entry = tlbc_entry(gcpu->cpu, set, way);
 	int bits = gcpu->cpu->client.tlbcache_bits;
 	register_t mas3;
 
-	if (!set->tag[way].valid) {
+	if (!tlbc_valid(gcpu->cpu, set, way)) {
 		mtspr(SPR_MAS1, mfspr(SPR_MAS1) & ~MAS1_VALID);
 		return;
 	}
@@ -297,32 +215,32 @@ void gtlb0_to_mas(unsigned int index, unsigned int way, gcpu_t *gcpu)
 	 */
 	mtspr(SPR_MAS0, MAS0_ESEL(way));
 	mtspr(SPR_MAS1, MAS1_VALID |
-	                (set->tag[way].pid << MAS1_TID_SHIFT) |
-	                (set->tag[way].space << MAS1_TS_SHIFT) |
+	                (tag->pid << MAS1_TID_SHIFT) |
+	                (tag->space << MAS1_TS_SHIFT) |
 	                (TLB_TSIZE_4K << MAS1_TSIZE_SHIFT));
-	mtspr(SPR_MAS2, (set->tag[way].vaddr << (PAGE_SHIFT + bits)) |
+	mtspr(SPR_MAS2, (tag->vaddr << (PAGE_SHIFT + bits)) |
 	                (index << PAGE_SHIFT) |
-	                set->entry[way].mas2);
+	                entry->mas2);
 
 	unsigned long attr;
-	unsigned long grpn = (set->entry[way].mas7 << (32 - PAGE_SHIFT)) |
-	                     (set->entry[way].mas3 >> MAS3_RPN_SHIFT);
+	unsigned long grpn = (entry->mas7 << (32 - PAGE_SHIFT)) |
+	                     (entry->mas3 >> MAS3_RPN_SHIFT);
 	unsigned long rpn = vptbl_xlate(gcpu->guest->gphys_rev,
 	                                grpn, &attr, PTE_PHYS_LEVELS, 0);
 
 	/* Currently, we only use virtualization faults for bad mappings. */
-	if (likely(!(set->entry[way].mas8 & 1))) {
+	if (likely(!(entry->mas8 & 1))) {
 		assert(attr & PTE_VALID);
 
 		mas3 = (uint32_t)(rpn << PAGE_SHIFT) |
-		       (set->entry[way].mas3 & MAS3_USER);
+		       (entry->mas3 & MAS3_USER);
 		mtspr(SPR_MAS7, rpn >> (32 - PAGE_SHIFT));
 	} else {
-		mas3 = set->entry[way].mas3 & ~PTE_MAS3_MASK;
-		mtspr(SPR_MAS7, set->entry[way].mas7);
+		mas3 = entry->mas3 & ~PTE_MAS3_MASK;
+		mtspr(SPR_MAS7, entry->mas7);
 	}
 
-	mtspr(SPR_MAS3, mas3 | set->entry[way].gmas3);
+	mtspr(SPR_MAS3, mas3 | entry->gmas3);
 }
 
 static void guest_inv_tlb0_all(void)
@@ -330,9 +248,7 @@ static void guest_inv_tlb0_all(void)
 	unsigned long bm_start = bench_start();
 
 	if (!get_gcpu()->clean_tlb) {
-		memset(cpu->client.tlbcache, 0,
-		       sizeof(tlbcset_t) << cpu->client.tlbcache_bits);
-
+		tlbcache_inv_all();
 		get_gcpu()->clean_tlb = 1;
 	}
 
@@ -342,122 +258,65 @@ static void guest_inv_tlb0_all(void)
 static void guest_inv_tlb0_pid(int pid)
 {
 	unsigned long bm_start;
-	tlbcset_t *set;
-	unsigned int num_sets;
-	unsigned int i, j;
 
 	/* Optimize away repeated invalidations to the same PID. */
 	if (get_gcpu()->clean_tlb_pid == pid)
 		return;
 
 	bm_start = bench_start();
-	set = cpu->client.tlbcache;
-	num_sets = 1 << cpu->client.tlbcache_bits;
-
-	for (i = 0; i < num_sets; i++) {
-		prefetch_store(&set[i + 4]);
-
-		for (j = 0; j < TLBC_WAYS; j++)
-			if (pid == set[i].tag[j].pid)
-				set[i].tag[j].valid = 0;
-	}
-
+	tlbcache_inv_pid(pid);
 	get_gcpu()->clean_tlb_pid = pid;
 
 	bench_stop(bm_start, bm_tlb0_inv_pid);
 }
 
-static void guest_inv_tlb0_va(register_t vaddr, int pid)
-{
-	tlbcset_t *set;
-	tlbctag_t tag = make_tag(vaddr, pid < 0 ? 0 : pid, 0);
-	tlbctag_t mask;
-	int index;
-	int i;
-
-	printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
-	         "inv vaddr %lx pid %d\n", vaddr, pid);
-
-	mask.tag = ~0UL;
-	mask.space = 0;
-
-	if (pid < 0)
-		mask.pid = 0;
-
-	index = vaddr >> PAGE_SHIFT;
-	index &= (1 << cpu->client.tlbcache_bits) - 1;
-
-	set = &cpu->client.tlbcache[index];
-
-	for (i = 0; i < TLBC_WAYS; i++) {
-		printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
-		         "inv pid %d tag.pid %d set->tag %lx mask %lx\n",
-		         set->tag[i].pid, tag.pid, set->tag[i].tag, mask.tag);
-
-		if (((tag.tag ^ set->tag[i].tag) & mask.tag) == 0)
-			set->tag[i].valid = 0;
-	}
-}
-
 static int guest_set_tlbcache(register_t mas0, register_t mas1,
                               register_t mas2, register_t mas3flags,
                               unsigned long rpn, register_t mas8,
                               register_t guest_mas3flags)
 {
-	tlbcset_t *set;
-	tlbcentry_t *entry;
+	tlbcentry_t entry;
 	uintptr_t vaddr = mas2 & MAS2_EPN;
 	tlbctag_t tag = make_tag(vaddr, MAS1_GETTID(mas1),
 	                         (mas1 & MAS1_TS) >> MAS1_TS_SHIFT);
-	unsigned int way;
+	uintptr_t oldvaddr;
+	unsigned int oldpid;
+	unsigned int esel = TLBC_GET_ESEL(mas0);
 	int ret;
 
 	assert(!(mas0 & MAS0_TLBSEL1));
 
-	ret = find_gtlb_entry(vaddr, tag, &set, &way);
-
 	if (unlikely(!(mas1 & MAS1_VALID)))
 		tag.valid = 0;
 
-	if (ret && tag.valid &&
-	    unlikely(way != MAS0_GET_TLB0ESEL(mas0))) {
-		printlog(LOGTYPE_EMU, LOGLEVEL_ERROR,
-		         "existing: tag 0x%08lx entry 0x%08x 0x%08x way %d\n",
-		         set->tag[way].tag, set->entry[way].mas3,
-		         set->entry[way].pad, way);
-
-		return ERR_BUSY;
-	}
+	entry.pad = 0;
+	entry.mas2 = mas2;
+	entry.mas3 = (uint32_t)(rpn << PAGE_SHIFT) | mas3flags;
+	entry.mas7 = rpn >> (32 - PAGE_SHIFT);
+	entry.tsize = 1;
+	entry.mas8 = mas8 >> 30;
+	entry.gmas3 = guest_mas3flags;
 
-	way = MAS0_GET_TLB0ESEL(mas0) & (TLBC_WAYS - 1);
+	ret = tlbcache_insert(vaddr, tag, esel, &entry, &oldvaddr, &oldpid);
+	if (ret < 0)
+		return ret;
 
 	printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE,
-	         "setting TLB0 for 0x%08lx (%#lx), way %d\n", vaddr, rpn, way);
+	         "setting TLB0 for 0x%08lx (%#lx), way %d\n", vaddr, rpn,
+	         (int)(esel & (cpu->client.tlbcache_ways - 1)));
 
-	/* If we're replacing a valid entry, invalidate it. */
-	if (set->tag[way].valid) {
-		int tagshift = cpu->client.tlbcache_bits + PAGE_SHIFT;
-		register_t mask = (1 << tagshift) - 1;
-		register_t oldvaddr = (vaddr & mask) |
-		                      (set->tag[way].vaddr << tagshift);
-
-		set->tag[way].valid = 0;
-		mtspr(SPR_MAS6, set->tag[way].pid << MAS6_SPID_SHIFT);
+	/* The evicted translation may still be in the hardware TLB. */
+	if (ret) {
+		mtspr(SPR_MAS6, oldpid << MAS6_SPID_SHIFT);
 		tlb_inv_addr(oldvaddr);
 	}
 
-	entry = &set->entry[way];
-	entry->mas2 = mas2;
-	entry->mas3 = (uint32_t)(rpn << PAGE_SHIFT) | mas3flags;
-	entry->mas7 = rpn >> (32 - PAGE_SHIFT);
-	entry->tsize = 1;
-	entry->mas8 = mas8 >> 30;
-	entry->gmas3 = guest_mas3flags;
-
 	get_gcpu()->clean_tlb = 0;
 	get_gcpu()->clean_tlb_pid = -1;
 
-	set->tag[way] = tag;
+	/* The cache may have more ways than the hardware TLB0. */
+	mas0 &= ~MAS0_ESEL_MASK;
+	mas0 |= MAS0_ESEL(esel & (cpu_caps.tlb0_assoc - 1));
 
 	mtspr(SPR_MAS0, mas0);
 	mtspr(SPR_MAS1, mas1);
@@ -470,30 +329,91 @@ static int guest_set_tlbcache(register_t mas0, register_t mas1,
 	return 0;
 }
 
-/** Try to handle a TLB miss with the guest TLB1 array.
+/**
+ * Rebuild the gtlb1 lookup index
  *
- * @param[in] vaddr Virtual (effective) faulting address.
- * @param[in] space 1 if the fault should be filled from AS1, 0 if from AS0.
- * @param[in] pid The value of SPR_PID.
- * @return TLB_MISS_REFLECT, TLB_MISS_HANDLED, or TLB_MISS_MCHECK
+ * Only valid entries are indexed.  Entries that are invalidated later
+ * stay in the index until the next rebuild, so lookups must still
+ * check MAS1[V].
  */
-int guest_tlb1_miss(register_t vaddr, unsigned int space, unsigned int pid)
+static void gtlb1_index_update(gcpu_t *gcpu)
 {
-	gcpu_t *gcpu = get_gcpu();
-	unsigned long epn = vaddr >> PAGE_SHIFT;
+	unsigned long maxend = 0;
+	unsigned int n = 0;
 	int i;
 
 	for (i = 0; i < TLB1_GSIZE; i++) {
 		tlb_entry_t *entry = &gcpu->gtlb1[i];
+		unsigned long epn = entry->mas2 >> PAGE_SHIFT;
+		int j;
+
+		if (!(entry->mas1 & MAS1_VALID))
+			continue;
+
+		/* Insertion sort by starting EPN */
+		for (j = n; j > 0; j--) {
+			tlb_entry_t *prev = &gcpu->gtlb1[gcpu->gtlb1_sorted[j - 1]];
+
+			if ((prev->mas2 >> PAGE_SHIFT) <= epn)
+				break;
+
+			gcpu->gtlb1_sorted[j] = gcpu->gtlb1_sorted[j - 1];
+		}
+
+		gcpu->gtlb1_sorted[j] = i;
+		n++;
+	}
+
+	for (i = 0; i < (int)n; i++) {
+		tlb_entry_t *entry = &gcpu->gtlb1[gcpu->gtlb1_sorted[i]];
+		unsigned long end = (entry->mas2 >> PAGE_SHIFT) +
+		                    tsize_to_pages(MAS1_GETTSIZE(entry->mas1));
+
+		maxend = max(maxend, end);
+		gcpu->gtlb1_maxend[i] = maxend;
+	}
+
+	gcpu->gtlb1_nsorted = n;
+}
+
+/**
+ * Find the gtlb1 entry that translates an address
+ *
+ * @param[in] gcpu  guest CPU whose gtlb1 is searched
+ * @param[in] epn   effective page number
+ * @param[in] space 1 if AS1, 0 if AS0
+ * @param[in] pid   PID of the access
+ * @return the gtlb1 entry number, or -1 if none matches
+ *
+ * A binary search finds the last entry starting at or below epn; from
+ * there, only entries whose running maximum end is above epn can
+ * contain it.
+ */
+static int gtlb1_lookup(gcpu_t *gcpu, unsigned long epn,
+                        unsigned int space, unsigned int pid)
+{
+	int lo = 0, hi = gcpu->gtlb1_nsorted;
+	int i;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		tlb_entry_t *entry = &gcpu->gtlb1[gcpu->gtlb1_sorted[mid]];
+
+		if ((entry->mas2 >> PAGE_SHIFT) > epn)
+			hi = mid;
+		else
+			lo = mid + 1;
+	}
+
+	for (i = lo - 1; i >= 0 && gcpu->gtlb1_maxend[i] > epn; i--) {
+		int num = gcpu->gtlb1_sorted[i];
+		tlb_entry_t *entry = &gcpu->gtlb1[num];
 		unsigned long entryepn = entry->mas2 >> PAGE_SHIFT;
-		unsigned long grpn, rpn, baserpn, attr;
 		unsigned int entrypid = MAS1_GETTID(entry->mas1);
-		unsigned int tsize = MAS1_GETTSIZE(entry->mas1);
-		unsigned int mapsize, mappages, index, tsize_rpn, offset = 0;
 
 		printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
 		         "checking %x/%lx/%lx for %lx/%d/%d\n",
-		         i, entry->mas1, entry->mas2, vaddr, space, pid);
+		         num, entry->mas1, entry->mas2, epn, space, pid);
 
 		if (!(entry->mas1 & MAS1_VALID))
 			continue;
@@ -501,74 +421,133 @@ int guest_tlb1_miss(register_t vaddr, unsigned int space, unsigned int pid)
 			continue;
 		if (entrypid && pid != entrypid)
 			continue;
-		if (entryepn > epn)
-			continue;
-		if (entryepn + tsize_to_pages(tsize) <= epn)
+		if (entryepn + tsize_to_pages(MAS1_GETTSIZE(entry->mas1)) <= epn)
 			continue;
 
-		if (entry->mas1 & MAS1_IND)
-			offset = MAS3_GETSPSIZE(entry->mas3) + 7;
+		return num;
+	}
 
-		grpn = (entry->mas3 >> PAGE_SHIFT) | (entry->mas7 << (32 - PAGE_SHIFT));
+	return -1;
+}
 
-		grpn += (epn - entryepn) >> offset;
+/** Try to handle a TLB miss with the guest TLB1 array.
+ *
+ * @param[in] vaddr Virtual (effective) faulting address.
+ * @param[in] space 1 if the fault should be filled from AS1, 0 if from AS0.
+ * @param[in] pid The value of SPR_PID.
+ * @return TLB_MISS_REFLECT, TLB_MISS_HANDLED, or TLB_MISS_MCHECK
+ */
+int guest_tlb1_miss(register_t vaddr, unsigned int space, unsigned int pid)
+{
+	gcpu_t *gcpu = get_gcpu();
+	unsigned long epn = vaddr >> PAGE_SHIFT;
+	int i;
 
-		rpn = vptbl_xlate(gcpu->guest->gphys, grpn, &attr, PTE_PHYS_LEVELS, 0);
+	i = gtlb1_lookup(gcpu, epn, space, pid);
+	if (i < 0)
+		return TLB_MISS_REFLECT;
 
-		if (unlikely(!(attr & PTE_VALID)))
-			return TLB_MISS_MCHECK;
+	tlb_entry_t *entry = &gcpu->gtlb1[i];
+	unsigned long entryepn = entry->mas2 >> PAGE_SHIFT;
+	unsigned long grpn, rpn, attr;
+	unsigned int tsize = MAS1_GETTSIZE(entry->mas1);
+	unsigned int mapsize, mappages, index, tsize_rpn, offset = 0;
 
-		tsize_rpn = tsize - offset;
+	if (entry->mas1 & MAS1_IND)
+		offset = MAS3_GETSPSIZE(entry->mas3) + 7;
 
-		tsize_rpn = min(tsize_rpn, attr >> PTE_SIZE_SHIFT);
-		rpn = rpn & ~(tsize_to_pages_roundup(tsize_rpn) - 1);
+	grpn = (entry->mas3 >> PAGE_SHIFT) | (entry->mas7 << (32 - PAGE_SHIFT));
 
-		mapsize = tsize_rpn + offset;
-		mappages = tsize_to_pages(mapsize);
+	grpn += (epn - entryepn) >> offset;
 
-		epn &= ~(mappages - 1);
+	rpn = vptbl_xlate(gcpu->guest->gphys, grpn, &attr, PTE_PHYS_LEVELS, 0);
 
-		disable_int();
-		save_mas(gcpu);
+	if (unlikely(!(attr & PTE_VALID)))
+		return TLB_MISS_MCHECK;
 
-		index = alloc_tlb1(i, 1);
+	tsize_rpn = tsize - offset;
 
-		tlb1_set_entry(index, epn << PAGE_SHIFT,
-		               ((phys_addr_t)rpn) << PAGE_SHIFT, mapsize,
-		               MAS1_IPROT | (entry->mas1 & MAS1_IND)
-		                | (space ? MAS1_TS : 0),
-		               entry->mas2, (entry->mas3 & ~MAS3_RPN)
-				& (attr & PTE_MAS3_MASK),
-		               pid, MAS8_GTS | gcpu->lpid);
+	tsize_rpn = min(tsize_rpn, attr >> PTE_SIZE_SHIFT);
+	rpn = rpn & ~(tsize_to_pages_roundup(tsize_rpn) - 1);
 
-		restore_mas(gcpu);
-		enable_int();
+	mapsize = tsize_rpn + offset;
+	mappages = tsize_to_pages(mapsize);
 
-		printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE,
-		         "guest_tlb1_miss: inserting %d %lx %lx %d %lx %lx %d %d\n",
-		         index, epn, rpn, mapsize, entry->mas2,
-		         entry->mas3 & ~MAS3_RPN, pid, space);
-		return TLB_MISS_HANDLED;
-	}
+	epn &= ~(mappages - 1);
 
-	return TLB_MISS_REFLECT;
+	disable_int();
+	save_mas(gcpu);
+
+	index = alloc_tlb1(i, 1);
+
+	tlb1_set_entry(index, epn << PAGE_SHIFT,
+	               ((phys_addr_t)rpn) << PAGE_SHIFT, mapsize,
+	               MAS1_IPROT | (entry->mas1 & MAS1_IND)
+	                | (space ? MAS1_TS : 0),
+	               entry->mas2, (entry->mas3 & ~MAS3_RPN)
+			& (attr & PTE_MAS3_MASK),
+	               pid, MAS8_GTS | gcpu->lpid);
+
+	restore_mas(gcpu);
+	enable_int();
+
+	printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE,
+	         "guest_tlb1_miss: inserting %d %lx %lx %d %lx %lx %d %d\n",
+	         index, epn, rpn, mapsize, entry->mas2,
+	         entry->mas3 & ~MAS3_RPN, pid, space);
+	return TLB_MISS_HANDLED;
 }
 
-void dtlb_miss_fast(void);
-void itlb_miss_fast(void);
+/* There is a variant of the TLB miss fast path for each supported
+ * associativity, indexed by log2(ways).
+ */
+void dtlb_miss_fast_2(void);
+void itlb_miss_fast_2(void);
+void dtlb_miss_fast_4(void);
+void itlb_miss_fast_4(void);
+void dtlb_miss_fast_8(void);
+void itlb_miss_fast_8(void);
+
+static void (*const dtlb_miss_fast[])(void) = {
+	[1] = dtlb_miss_fast_2,
+	[2] = dtlb_miss_fast_4,
+	[3] = dtlb_miss_fast_8,
+};
+
+static void (*const itlb_miss_fast[])(void) = {
+	[1] = itlb_miss_fast_2,
+	[2] = itlb_miss_fast_4,
+	[3] = itlb_miss_fast_8,
+};
 
-void tlbcache_init(void)
+/**
+ * Set up the TLB0 cache for this CPU
+ *
+ * @param[in] ways number of ways, one of 2, 4, or 8
+ * @param[in] bits number of index bits, from TLBC_MIN_IDX_BITS
+ *                 to TLBC_MAX_IDX_BITS
+ */
+void tlbcache_init(unsigned int ways, unsigned int bits)
 {
-	cpu->client.tlbcache_bits = 12;
-	cpu->client.tlbcache =
-		alloc(sizeof(tlbcset_t) << cpu->client.tlbcache_bits, PAGE_SIZE);
+	unsigned int way_bits = count_lsb_zeroes(ways);
+
+	assert(ways >= TLBC_MIN_WAYS && ways <= TLBC_MAX_WAYS);
+	assert(ways == 1U << way_bits);
+	assert(bits >= TLBC_MIN_IDX_BITS && bits <= TLBC_MAX_IDX_BITS);
+
+	cpu->client.tlbcache_ways = ways;
+	cpu->client.tlbcache_way_bits = way_bits;
+	cpu->client.tlbcache_bits = bits;
+	cpu->client.tlbcache = alloc(TLBC_SIZE(ways, bits), PAGE_SIZE);
+	cpu->client.tlbcache_pidmap =
+		alloc(TLBC_PIDMAP_SIZE(cpu->client.tlbcache_bits), sizeof(long));
 
 	cpu->client.tlbcache_enable = 1;
 
 	mtspr(SPR_SPRG3, ((uintptr_t)cpu->client.tlbcache) |
 	                 cpu->client.tlbcache_bits);
-	mtspr(SPR_IVOR13, (uintptr_t)dtlb_miss_fast);
-	mtspr(SPR_IVOR14, (uintptr_t)itlb_miss_fast);
+	mtspr(SPR_IVOR13, (uintptr_t)dtlb_miss_fast[way_bits]);
+	mtspr(SPR_IVOR14, (uintptr_t)itlb_miss_fast[way_bits]);
 }
 
 /** Check whether an ISI should be reflected as an ISI, or a machine check.
@@ -633,6 +612,8 @@ void guest_set_tlb1(unsigned int entry, unsigned long mas1,
 	gcpu->gtlb1[entry].mas3 = (uint32_t)(grpn << PAGE_SHIFT) | mas3flags;
 	gcpu->gtlb1[entry].mas7 = grpn >> (32 - PAGE_SHIFT);
 
+	gtlb1_index_update(gcpu);
+
 	if (!(mas1 & MAS1_VALID))
 		return;
 
@@ -908,7 +889,7 @@ void guest_inv_tlb(register_t ivax, int pid, int ind, int flags)
 				else
 					guest_inv_tlb0_pid(pid);
 			} else {
-				guest_inv_tlb0_va(va, pid);
+				tlbcache_inv_va(va, pid);
 			}
 		}
 
@@ -1090,7 +1071,7 @@ int guest_tlb_search_mas(uintptr_t va)
 		unsigned int way;
 
 		if (find_gtlb_entry(va, tag, &set, &way)) {
-			gtlb0_to_mas(set - cpu->client.tlbcache, way, gcpu);
+			gtlb0_to_mas(tlbc_set_index(cpu, set), way, gcpu);
 			return 0;
 		}
 	}
@@ -1368,6 +1349,72 @@ out:
 	return ret;
 }
 
+/* Point a temporary TLB1 entry at a physical range.  Bulk copies and
+ * repeated small copies (e.g. one per scatter/gather entry) usually hit
+ * the window that is already mapped, so the tlbwe is skipped when the
+ * entry already holds the mapping.
+ *
+ * The windows stay at 16MiB.  Each hardware thread gets two of them,
+ * carved from the shared valloc area in init.c, and owns only the two
+ * TEMPTLB entries.  A 1GiB or 4GiB window would need that much naturally
+ * aligned virtual space per thread, and more windows would take TLB1
+ * entries from the guest range.  Remapping the next window ahead of the
+ * copy gains nothing either: a tlbwe is cheap next to a 16MiB memcpy,
+ * and there is no second agent on the core to overlap it with.
+ */
+static void set_temp_tlb(int tlbentry, void *vpage, phys_addr_t paddr,
+                         int tsize, register_t mas2flags, register_t mas3flags)
+{
+	unsigned int idx = tlbentry - TEMPTLB1;
+	register_t saved;
+
+	if (idx >= 2) {
+		tlb1_set_entry_safe(tlbentry, (unsigned long)vpage, paddr, tsize,
+		                    MAS1_IPROT, mas2flags, mas3flags, 0, TLB_MAS8_HV);
+		return;
+	}
+
+	/* An interrupt handler could remap the entry in between. */
+	saved = disable_int_save();
+
+	if (cpu->client.temp_tlb[idx].tsize != tsize ||
+	    cpu->client.temp_tlb[idx].vaddr != (uintptr_t)vpage ||
+	    cpu->client.temp_tlb[idx].paddr != paddr ||
+	    cpu->client.temp_tlb[idx].mas2 != mas2flags ||
+	    cpu->client.temp_tlb[idx].mas3 != mas3flags) {
+		tlb1_set_entry_safe(tlbentry, (unsigned long)vpage, paddr, tsize,
+		                    MAS1_IPROT, mas2flags, mas3flags, 0, TLB_MAS8_HV);
+
+		cpu->client.temp_tlb[idx].vaddr = (uintptr_t)vpage;
+		cpu->client.temp_tlb[idx].paddr = paddr;
+		cpu->client.temp_tlb[idx].mas2 = mas2flags;
+		cpu->client.temp_tlb[idx].mas3 = mas3flags;
+		cpu->client.temp_tlb[idx].tsize = tsize;
+	}
+
+	restore_int(saved);
+}
+
+/** Invalidate a temporary TLB1 entry
+ *
+ * @param[in] tlbentry TEMPTLB1 or TEMPTLB2
+ *
+ * Use this rather than tlb1_clear_entry(), so that the next
+ * map_gphys() or map_phys() rewrites the entry.
+ */
+void clear_temp_tlb(int tlbentry)
+{
+	unsigned int idx = tlbentry - TEMPTLB1;
+	register_t saved = disable_int_save();
+
+	tlb1_clear_entry(tlbentry);
+
+	if (idx < 2)
+		cpu->client.temp_tlb[idx].tsize = 0;
+
+	restore_int(saved);
+}
+
 /** Temporarily map guest physical memory into a hypervisor virtual address
  *
  * @param[in]  tlbentry TLB1 entry index to use
@@ -1408,14 +1455,46 @@ void *map_gphys(int tlbentry, pte_t *tbl, phys_addr_t addr,
 	if (len)
 		*len = bytesize - offset;
 
-	tlb1_set_entry_safe(tlbentry, (unsigned long)vpage,
-	                    physaddr & ~((phys_addr_t)bytesize - 1),
-	                    tsize, MAS1_IPROT, TLB_MAS2_MEM, TLB_MAS3_KERN,
-	                    0, TLB_MAS8_HV);
+	set_temp_tlb(tlbentry, vpage, physaddr & ~((phys_addr_t)bytesize - 1),
+	             tsize, TLB_MAS2_MEM, TLB_MAS3_KERN);
 
 	return vpage + offset;
 }
 
+/** Translate a guest physical address for a DMA engine
+ *
+ * @param[in]  tbl Guest page table to translate with
+ * @param[in]  addr Guest physical address
+ * @param[out] len Bytes from addr to the end of its mapping, at most 1GiB
+ * @param[in]  write if non-zero, fail if write access is not allowed
+ * @return the real physical address, or -1 if addr is not mapped
+ */
+phys_addr_t xlate_gphys(pte_t *tbl, phys_addr_t addr, size_t *len, int write)
+{
+	unsigned long attr;
+	unsigned long rpn;
+	size_t offset, bytesize;
+	int tsize;
+
+	rpn = vptbl_xlate(tbl, addr >> PAGE_SHIFT, &attr, PTE_PHYS_LEVELS, 0);
+
+	if (!(attr & PTE_VALID) || (attr & PTE_VF))
+		return (phys_addr_t)-1;
+	if (write && !(attr & PTE_UW))
+		return (phys_addr_t)-1;
+
+	tsize = attr >> PTE_SIZE_SHIFT;
+	if (tsize > TLB_TSIZE_1G)
+		tsize = TLB_TSIZE_1G;
+
+	bytesize = tsize_to_pages(tsize) << PAGE_SHIFT;
+	offset = addr & (bytesize - 1);
+	*len = bytesize - offset;
+
+	return (((phys_addr_t)rpn << PAGE_SHIFT) &
+	        ~((phys_addr_t)bytesize - 1)) + offset;
+}
+
 /** Copy from a hypervisor virtual address to a guest physical address
  *
  * @param[in] tbl Guest physical page table
@@ -1428,6 +1507,7 @@ void *map_gphys(int tlbentry, pte_t *tbl, phys_addr_t addr,
 size_t copy_to_gphys(pte_t *tbl, phys_addr_t dest, void *src, size_t len,
                      int cache_sync)
 {
+	register_t start = bench_start();
 	size_t ret = 0;
 
 	while (len > 0) {
@@ -1453,6 +1533,7 @@ size_t copy_to_gphys(pte_t *tbl, phys_addr_t dest, void *src, size_t len,
 		len -= chunk;
 	}
 
+	bench_stop_bytes(start, bm_copy_gphys, ret);
 	return ret;
 }
 
@@ -1466,6 +1547,7 @@ size_t copy_to_gphys(pte_t *tbl, phys_addr_t dest, void *src, size_t len,
  */
 size_t zero_to_gphys(pte_t *tbl, phys_addr_t dest, size_t len, int cache_sync)
 {
+	register_t start = bench_start();
 	size_t ret = 0;
 
 	while (len > 0) {
@@ -1490,6 +1572,7 @@ size_t zero_to_gphys(pte_t *tbl, phys_addr_t dest, size_t len, int cache_sync)
 		len -= chunk;
 	}
 
+	bench_stop_bytes(start, bm_copy_gphys, ret);
 	return ret;
 }
 
@@ -1504,6 +1587,7 @@ size_t zero_to_gphys(pte_t *tbl, phys_addr_t dest, size_t len, int cache_sync)
  */
 size_t copy_from_gphys(pte_t *tbl, void *dest, phys_addr_t src, size_t len)
 {
+	register_t start = bench_start();
 	size_t ret = 0;
 
 	while (len > 0) {
@@ -1526,6 +1610,7 @@ size_t copy_from_gphys(pte_t *tbl, void *dest, phys_addr_t src, size_t len)
 		len -= chunk;
 	}
 
+	bench_stop_bytes(start, bm_copy_gphys, ret);
 	return ret;
 }
 
@@ -1541,6 +1626,7 @@ size_t copy_from_gphys(pte_t *tbl, void *dest, phys_addr_t src, size_t len)
 size_t copy_between_gphys(pte_t *dtbl, phys_addr_t dest,
                           pte_t *stbl, phys_addr_t src, size_t len)
 {
+	register_t start = bench_start();
 	size_t schunk = 0, dchunk = 0, chunk, ret = 0;
 
 	/* Initializiations not needed, but GCC is stupid. */
@@ -1606,6 +1692,7 @@ size_t copy_between_gphys(pte_t *dtbl, phys_addr_t dest,
 		schunk -= chunk;
 	}
 
+	bench_stop_bytes(start, bm_copy_gphys, ret);
 	return ret;
 }
 
@@ -1705,9 +1792,8 @@ void *map_phys(int tlbentry, phys_addr_t paddr, void *vpage,
 	bytesize = tsize_to_pages(tsize) << PAGE_SHIFT;
 	offset = paddr & (bytesize - 1);
 
-	tlb1_set_entry_safe(tlbentry, (unsigned long)vpage,
-	                    paddr & ~((phys_addr_t)bytesize - 1),
-	                    tsize, MAS1_IPROT, mas2flags, mas3flags, 0, TLB_MAS8_HV);
+	set_temp_tlb(tlbentry, vpage, paddr & ~((phys_addr_t)bytesize - 1),
+	             tsize, mas2flags, mas3flags);
 
 	*len = min(bytesize - offset, *len);
 	return vpage + offset;
@@ -1779,7 +1865,7 @@ phys_addr_t zero_to_phys(phys_addr_t dest, phys_addr_t len)
 		len -= chunk;
 	}
 
-	tlb1_clear_entry(TEMPTLB1);
+	clear_temp_tlb(TEMPTLB1);
 	return ret;
 }
 
@@ -1795,6 +1881,7 @@ phys_addr_t zero_to_phys(phys_addr_t dest, phys_addr_t len)
 size_t copy_phys_to_gphys(pte_t *dtbl, phys_addr_t dest,
                           phys_addr_t src, size_t len, int cache_sync)
 {
+	register_t start = bench_start();
 	size_t schunk = 0, dchunk = 0, chunk, ret = 0;
 
 	/* Initializiations not needed, but GCC is stupid. */
@@ -1844,6 +1931,7 @@ size_t copy_phys_to_gphys(pte_t *dtbl, phys_addr_t dest,
 		schunk -= chunk;
 	}
 
+	bench_stop_bytes(start, bm_copy_gphys, ret);
 	return ret;
 }
 
@@ -1882,7 +1970,7 @@ int guest_tlb_read_vcpu(tlb_entry_t *gmas, uint32_t *flags, gcpu_t *gcpu)
 	unsigned int tlb;
 
 	if (cpu->client.tlbcache_enable) {
-		tlb0_nways = TLBC_WAYS;
+		tlb0_nways = cpu->client.tlbcache_ways;
 		tlb0_nentries = 1 << (cpu->client.tlbcache_bits);
 	} else {
 		tlb0_nways = cpu_caps.tlb0_assoc;
@@ -1900,7 +1988,7 @@ int guest_tlb_read_vcpu(tlb_entry_t *gmas, uint32_t *flags, gcpu_t *gcpu)
 		} else {
 			tlb_index = ((gmas->mas2 >> PAGE_SHIFT) &
 				(tlb0_nentries - 1));
-			way = (MAS0_GET_TLB0ESEL(gmas->mas0) + 1) &
+			way = (TLBC_GET_ESEL(gmas->mas0) + 1) &
 				(tlb0_nways - 1);
 			if (!way)
 				++tlb_index;
@@ -0,0 +1,333 @@
+/** @file
+ * Guest TLB0 software cache
+ *
+ * This file only maintains the cache contents.  Anything that touches
+ * the hardware TLB or MAS registers is done by the callers in tlb.c, so
+ * that this file can also be built into the host-side simulator in
+ * tools/tlbcache-sim.
+ */
+
+/*
+ * Copyright (C) 2008-2012 Freescale Semiconductor, Inc.
+ * Author: Scott Wood <scottwood@freescale.com>
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <percpu.h>
+#include <paging.h>
+#include <errors.h>
+#include <tlbcache.h>
+
+static unsigned long *get_pidmap(unsigned int pid)
+{
+	unsigned int longs = (1 << cpu->client.tlbcache_bits) / LONG_BITS;
+
+	return &cpu->client.tlbcache_pidmap[(pid % TLBC_PID_BUCKETS) * longs];
+}
+
+/**
+ * Find a TLB cache entry, or a slot suitable for use
+ *
+ * @param[in]  vaddr Virtual (effective) address
+ * @param[in]  tag   TLB tag to find
+ * @param[out] setp  TLB set containing entry
+ * @param[out] way   way within the set
+ *
+ * If a translation for the address exists in the cache, then setp/way is
+ * filled in appropriately, and the return value is non-zero.
+ *
+ * Otherwise, setp and way are filled in with a suitable slot for adding
+ * such a translation.  Evicting the current contents of the slot
+ * is the responsibility of the caller.
+ */
+int find_gtlb_entry(uintptr_t vaddr, tlbctag_t tag,
+                    tlbcset_t **setp, unsigned int *way)
+{
+	tlbcset_t *set;
+	tlbctag_t mask;
+	int index;
+	unsigned int i;
+
+	printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
+	         "find vaddr %lx tag %lx\n", vaddr, tag.tag);
+
+	mask.tag = ~0UL;
+	mask.pid = 0;
+
+	index = vaddr >> PAGE_SHIFT;
+	index &= (1 << cpu->client.tlbcache_bits) - 1;
+
+	*setp = set = tlbc_get_set(cpu, index);
+
+	for (i = 0; i < cpu->client.tlbcache_ways; i++) {
+		tlbctag_t *settag = tlbc_tag(set, i);
+		int pid = settag->pid;
+
+		printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
+		         "pid %d tag.pid %d set->tag %lx mask %lx\n",
+		         pid, tag.pid, settag->tag, mask.tag);
+
+		if (pid != tag.pid && tag.pid != 0 && pid != 0)
+			continue;
+
+		if (((tag.tag ^ settag->tag) & mask.tag) == 0 &&
+		    tlbc_entry(cpu, set, i)->gen == cpu->client.tlbcache_gen) {
+			*way = i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Check for a TLB0 cache entry that conflicts with a new TLB1 entry.
+ *
+ * @param[in]  epn   Effective page number
+ * @param[in]  tsize Size of the TLB1 mapping
+ * @param[in]  pid   PID of mapping
+ * @param[in]  space zero if AS0, 1 if AS1
+ * @return non-zero if a conflicting entry was found
+ */
+int check_tlb1_conflict(uintptr_t epn, unsigned int tsize,
+                        unsigned int pid, unsigned int space)
+{
+ 	uintptr_t pages = tsize_to_pages(tsize);
+ 	int mask = (1 << cpu->client.tlbcache_bits) - 1;
+	unsigned int cache_entries = min(pages, 1 << cpu->client.tlbcache_bits);
+	unsigned int index = epn & mask;
+	unsigned int end = index + cache_entries;
+
+	uintptr_t tag_start = epn >> cpu->client.tlbcache_bits;
+	uintptr_t tag_end = (epn + pages - 1) >> cpu->client.tlbcache_bits;
+
+	for (; index < end; index++) {
+		tlbcset_t *set = tlbc_get_set(cpu, index & mask);
+		unsigned int way;
+
+		for (way = 0; way < cpu->client.tlbcache_ways; way++) {
+			tlbctag_t *tag = tlbc_tag(set, way);
+
+			if (!tlbc_valid(cpu, set, way))
+				continue;
+
+			if (tag->vaddr < tag_start || tag->vaddr > tag_end)
+				continue;
+
+			if (pid != 0 && pid != tag->pid)
+				continue;
+
+			if (space != tag->space)
+				continue;
+
+			printlog(LOGTYPE_EMU, LOGLEVEL_ERROR,
+			         "check_tlb1_conflict: tag 0x%08lx entry 0x%08x 0x%08x way %d\n",
+			         tag->tag, tlbc_entry(cpu, set, way)->mas3,
+			         tlbc_entry(cpu, set, way)->pad, way);
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Insert a translation into the TLB cache
+ *
+ * @param[in]  vaddr    Virtual (effective) address
+ * @param[in]  tag      Tag of the new translation; if tag.valid is clear,
+ *                      the slot is simply invalidated
+ * @param[in]  esel     Way requested by the guest (MAS0[ESEL])
+ * @param[in]  entry    Payload of the new translation
+ * @param[out] oldvaddr Address of the translation that was evicted
+ * @param[out] oldpid   PID of the translation that was evicted
+ * @return ERR_BUSY if the translation is already cached in another way,
+ *   1 if a valid translation was evicted (which the caller must remove
+ *   from the hardware TLB), or 0 otherwise.
+ */
+int tlbcache_insert(uintptr_t vaddr, tlbctag_t tag, unsigned int esel,
+                    const tlbcentry_t *entry,
+                    uintptr_t *oldvaddr, unsigned int *oldpid)
+{
+	tlbcset_t *set;
+	tlbctag_t search = tag;
+	tlbcentry_t *setentry;
+	unsigned int way;
+	int ret, evicted = 0;
+
+	esel &= cpu->client.tlbcache_ways - 1;
+
+	search.valid = 1;
+	ret = find_gtlb_entry(vaddr, search, &set, &way);
+
+	if (ret && tag.valid && unlikely(way != esel)) {
+		printlog(LOGTYPE_EMU, LOGLEVEL_ERROR,
+		         "existing: tag 0x%08lx entry 0x%08x 0x%08x way %d\n",
+		         tlbc_tag(set, way)->tag, tlbc_entry(cpu, set, way)->mas3,
+		         tlbc_entry(cpu, set, way)->pad, way);
+
+		return ERR_BUSY;
+	}
+
+	/* Drop any entries in the set that predate the last invalidate all,
+	 * so that they cannot match in the TLB miss handler alongside a
+	 * new duplicate of the same translation.
+	 */
+	for (way = 0; way < cpu->client.tlbcache_ways; way++)
+		if (!tlbc_valid(cpu, set, way))
+			tlbc_tag(set, way)->valid = 0;
+
+	way = esel;
+
+	/* If we're replacing a valid entry, invalidate it. */
+	if (tlbc_tag(set, way)->valid) {
+		int tagshift = cpu->client.tlbcache_bits + PAGE_SHIFT;
+		uintptr_t mask = (1 << tagshift) - 1;
+
+		*oldvaddr = (vaddr & mask) |
+		            ((uintptr_t)tlbc_tag(set, way)->vaddr << tagshift);
+		*oldpid = tlbc_tag(set, way)->pid;
+
+		tlbc_tag(set, way)->valid = 0;
+		evicted = 1;
+	}
+
+	setentry = tlbc_entry(cpu, set, way);
+	*setentry = *entry;
+	setentry->gen = cpu->client.tlbcache_gen;
+	*tlbc_tag(set, way) = tag;
+
+	if (tag.valid) {
+		unsigned int index = tlbc_set_index(cpu, set);
+
+		get_pidmap(tag.pid)[index / LONG_BITS] |= 1UL << (index % LONG_BITS);
+	}
+
+	return evicted;
+}
+
+/**
+ * Invalidate every translation in the TLB cache
+ *
+ * This normally just starts a new generation.  The cache is only
+ * cleared when the generation number wraps around.
+ */
+void tlbcache_inv_all(void)
+{
+	cpu->client.tlbcache_gen = (cpu->client.tlbcache_gen + 1) %
+	                           TLBC_GENERATIONS;
+	if (cpu->client.tlbcache_gen != 0)
+		return;
+
+	memset(cpu->client.tlbcache, 0,
+	       TLBC_SIZE(cpu->client.tlbcache_ways, cpu->client.tlbcache_bits));
+	memset(cpu->client.tlbcache_pidmap, 0,
+	       TLBC_PIDMAP_SIZE(cpu->client.tlbcache_bits));
+}
+
+/**
+ * Invalidate all translations in the TLB cache with a given PID
+ *
+ * @param[in] pid PID to invalidate
+ *
+ * Only the sets marked in the PID's bucket bitmap are visited.  Bits
+ * are set when a translation is inserted, but are only cleared here (or
+ * by tlbcache_inv_all()), once a set is found to hold no valid
+ * translation for any PID in the bucket.
+ */
+void tlbcache_inv_pid(unsigned int pid)
+{
+	unsigned long *map = get_pidmap(pid);
+	unsigned int longs = (1 << cpu->client.tlbcache_bits) / LONG_BITS;
+	unsigned int bucket = pid % TLBC_PID_BUCKETS;
+	unsigned int i, j;
+
+	for (i = 0; i < longs; i++) {
+		unsigned long pending = map[i];
+
+		while (pending) {
+			unsigned int bit = count_lsb_zeroes(pending);
+			tlbcset_t *set = tlbc_get_set(cpu, i * LONG_BITS + bit);
+			int keep = 0;
+
+			pending &= ~(1UL << bit);
+
+			for (j = 0; j < cpu->client.tlbcache_ways; j++) {
+				tlbctag_t *tag = tlbc_tag(set, j);
+
+				if (!tlbc_valid(cpu, set, j))
+					continue;
+
+				if (tag->pid == pid)
+					tag->valid = 0;
+				else if (tag->pid % TLBC_PID_BUCKETS == bucket)
+					keep = 1;
+			}
+
+			if (!keep)
+				map[i] &= ~(1UL << bit);
+		}
+	}
+}
+
+/**
+ * Invalidate the translations in the TLB cache for an address
+ *
+ * @param[in] vaddr Virtual (effective) address
+ * @param[in] pid   PID to invalidate, or -1 for any PID
+ *
+ * Both address spaces are invalidated.
+ */
+void tlbcache_inv_va(uintptr_t vaddr, int pid)
+{
+	tlbcset_t *set;
+	tlbctag_t tag = make_tag(vaddr, pid < 0 ? 0 : pid, 0);
+	tlbctag_t mask;
+	int index;
+	unsigned int i;
+
+	printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
+	         "inv vaddr %lx pid %d\n", vaddr, pid);
+
+	mask.tag = ~0UL;
+	mask.space = 0;
+
+	if (pid < 0)
+		mask.pid = 0;
+
+	index = vaddr >> PAGE_SHIFT;
+	index &= (1 << cpu->client.tlbcache_bits) - 1;
+
+	set = tlbc_get_set(cpu, index);
+
+	for (i = 0; i < cpu->client.tlbcache_ways; i++) {
+		tlbctag_t *settag = tlbc_tag(set, i);
+
+		printlog(LOGTYPE_GUEST_MMU, LOGLEVEL_VERBOSE + 1,
+		         "inv pid %d tag.pid %d set->tag %lx mask %lx\n",
+		         settag->pid, tag.pid, settag->tag, mask.tag);
+
+		if (((tag.tag ^ settag->tag) & mask.tag) == 0)
+			settag->valid = 0;
+	}
+}
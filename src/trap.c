@@ -166,17 +166,34 @@ void guest_doorbell(trapframe_t *regs)
 	regs->srr1 = gsrr1;
 
 	/* check for pending virtual interrupts */
-	if (gcpu->gdbell_pending & GCPU_PEND_VIRQ) {
+	if (gcpu->gdbell_pending & (GCPU_PEND_VIRQ | GCPU_PEND_POSTED)) {
 		if (mpic_coreint) {
-			irq = vpic_iack();
+			irq = NULL;
+			if (gcpu->gdbell_pending & GCPU_PEND_VIRQ)
+				irq = vpic_iack();
+
 			if (irq) {
 				vmpic_interrupt_t *vmirq = irq->priv;
 				mtspr(SPR_GEPR, vmirq->handle);
 			} else {
-				goto no_virq;
+				/* Cleared before looking, so that a post
+				 * after the look flags it again.
+				 */
+				atomic_and(&gcpu->gdbell_pending,
+				           ~GCPU_PEND_POSTED);
+
+				if (!vpic_posted(gcpu))
+					goto no_virq;
+
+				mtspr(SPR_GEPR, VPIC_POST_VECTOR);
 			}
+		} else {
+			/* The guest looks at its posting page on any
+			 * external interrupt.
+			 */
+			atomic_and(&gcpu->gdbell_pending, ~GCPU_PEND_POSTED);
 		}
-		
+
 		regs->srr0 = gcpu->ivpr | gcpu->ivor[EXC_EXT_INT];
 		regs->srr1 = gsrr1 & (MSR_CE | MSR_ME | MSR_DE | MSR_GS | MSR_UCLE | MSR_RI);
 #ifdef CONFIG_LIBOS_64BIT
@@ -517,8 +534,10 @@ void tlb_miss(trapframe_t *regs)
 
 			if (guest || (epc & EPC_EGS)) {
 				ret = guest_tlb1_miss(vaddr, space, pid);
-				if (likely(ret == TLB_MISS_HANDLED))
+				if (likely(ret == TLB_MISS_HANDLED)) {
+					set_stat(bm_stat_tlb1_refill, regs);
 					return;
+				}
 			}
 
 			if (guest) {
@@ -35,6 +35,8 @@
 #include <percpu.h>
 #include <devtree.h>
 #include <errors.h>
+#include <slab.h>
+#include <thread.h>
 
 #define VMPIC_ADDR_CELLS 0
 #define VMPIC_INTR_CELLS 2
@@ -58,10 +60,15 @@ static void vmpic_init_irq(vmpic_interrupt_t *vmirq)
 		irq->ops->set_config(irq, vmirq->config);
 	if (irq->ops->set_delivery_type)
 		irq->ops->set_delivery_type(irq, TYPE_NORM);
+
+	vmirq->pinned = 0;
 }
 
 static void vmpic_prereset_handle(handle_t *h, int stop)
 {
+	/* The next boot of the partition chooses for itself. */
+	h->intr->pinned = 0;
+
 	if (vmpic_is_claimed(h->intr))
 		interrupt_reset(h->intr->irq);
 }
@@ -77,12 +84,14 @@ static handle_ops_t vmpic_handle_ops = {
 	.postreset = vmpic_postreset_handle,
 };
 
+SLAB_POOL(vmpic_irq_pool, vmpic_interrupt_t, 32);
+
 vmpic_interrupt_t *vmpic_alloc_handle(guest_t *guest, interrupt_t *irq,
                                       int config, int standby)
 {
 	assert(!irq->priv || standby);
 
-	vmpic_interrupt_t *vmirq = alloc_type(vmpic_interrupt_t);
+	vmpic_interrupt_t *vmirq = slab_alloc(&vmpic_irq_pool);
 	if (!vmirq) {
 		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
 		         "%s: out of memory\n", __func__);
@@ -106,7 +115,7 @@ vmpic_interrupt_t *vmpic_alloc_handle(guest_t *guest, interrupt_t *irq,
 
 	vmirq->handle = alloc_guest_handle(guest, &vmirq->user);
 	if (vmirq->handle < 0) {
-		free(vmirq);
+		slab_free(&vmpic_irq_pool, vmirq);
 		return NULL;
 	}
 
@@ -234,6 +243,351 @@ int vmpic_alloc_mpic_handle(dev_owner_t *owner, interrupt_t *irq, int standby)
 	return vmirq->handle;
 }
 
+static const char *balance_policy_names[] = {
+	[balance_none] = "none",
+	[balance_spread] = "spread",
+	[balance_isolate] = "isolate",
+};
+
+const char *vmpic_balance_policy_name(balance_policy_t policy)
+{
+	return balance_policy_names[policy];
+}
+
+/** Find the vcpu an interrupt is currently routed to
+ *
+ * @param[in] vmirq the interrupt
+ * @return the partition-relative vcpu number, or -1 if unknown
+ */
+int vmpic_irq_target(vmpic_interrupt_t *vmirq)
+{
+	guest_t *guest = vmirq->guest;
+	interrupt_t *irq = vmirq->irq;
+	uint32_t pcpu_mask;
+	unsigned int i;
+
+	if (!irq->ops->get_cpu_dest_mask)
+		return -1;
+
+	if (irq->ops == &vpic_ops)
+		return count_lsb_zeroes(irq->ops->get_cpu_dest_mask(irq));
+
+	pcpu_mask = irq->ops->get_cpu_dest_mask(irq);
+
+	for (i = 0; i < guest->cpucnt; i++)
+		if (pcpu_mask & (1 << guest->gcpus[i]->cpu->coreid))
+			return i;
+
+	return -1;
+}
+
+/* Most busy sources that are moved in one balancing pass */
+#define BALANCE_MAX_HOT 32
+
+/* Most doublings of the sampling interval while nothing is busy */
+#define BALANCE_MAX_BACKOFF 4
+
+/* Greedily move the busiest physical interrupts to the least loaded
+ * vcpus.  Interrupts the guest routed itself, and those below the
+ * threshold, stay where they are and only count towards the load of
+ * their vcpu.
+ *
+ * The plan is made from unlocked reads.  Each move then takes
+ * vmpic_lock, as hcall_int_set_config() does, and is dropped if the
+ * guest has routed the interrupt in the meantime.
+ */
+static void vmpic_rebalance(vmpic_balance_t *bal)
+{
+	guest_t *guest = bal->guest;
+	vmpic_interrupt_t *hot[BALANCE_MAX_HOT];
+	unsigned long load[CONFIG_LIBOS_MAX_CPUS] = {};
+	unsigned int first = 0, nhot = 0;
+	unsigned int i, j;
+
+	if (bal->policy == balance_isolate && guest->cpucnt > 1)
+		first = 1;
+
+	for (i = 0; i < MAX_HANDLES; i++) {
+		handle_t *h = guest->handles[i];
+		vmpic_interrupt_t *vmirq;
+		interrupt_t *irq;
+		int cur;
+
+		if (!h || !h->intr)
+			continue;
+
+		vmirq = h->intr;
+		irq = vmirq->irq;
+
+		if (irq->ops == &vpic_ops || !vmpic_is_claimed(vmirq) ||
+		    !irq->ops->set_cpu_dest_mask)
+			continue;
+
+		cur = vmpic_irq_target(vmirq);
+		if (cur < 0)
+			continue;
+
+		if (vmirq->pinned || vmirq->rate < bal->threshold ||
+		    nhot == BALANCE_MAX_HOT) {
+			load[cur] += vmirq->rate;
+			continue;
+		}
+
+		/* keep hot[] sorted, busiest first */
+		for (j = nhot++; j > 0 && hot[j - 1]->rate < vmirq->rate; j--)
+			hot[j] = hot[j - 1];
+
+		hot[j] = vmirq;
+	}
+
+	for (i = 0; i < nhot; i++) {
+		vmpic_interrupt_t *vmirq = hot[i];
+		interrupt_t *irq = vmirq->irq;
+		int cur = vmpic_irq_target(vmirq);
+		unsigned int best = first;
+		register_t saved;
+		int ret;
+
+		if (cur < 0)
+			continue;
+
+		for (j = first + 1; j < guest->cpucnt; j++)
+			if (load[j] < load[best])
+				best = j;
+
+		/* Moving costs a cache refill on the new vcpu, so only do it
+		 * when it buys a real improvement.
+		 */
+		if (cur >= (int)first && load[cur] <= load[best] + vmirq->rate / 2)
+			best = cur;
+
+		load[best] += vmirq->rate;
+
+		if ((int)best == cur)
+			continue;
+
+		saved = spin_lock_intsave(&vmpic_lock);
+
+		if (vmirq->pinned || !vmpic_is_claimed(vmirq) ||
+		    vmpic_irq_target(vmirq) != cur)
+			ret = -1;
+		else
+			ret = irq->ops->set_cpu_dest_mask(irq,
+				1 << guest->gcpus[best]->cpu->coreid);
+
+		spin_unlock_intsave(&vmpic_lock, saved);
+
+		if (ret < 0)
+			continue;
+
+		bal->moves++;
+
+		printlog(LOGTYPE_IRQ, LOGLEVEL_DEBUG,
+		         "vmpic: %s: handle %d (%lu/s) from vcpu %d to %u\n",
+		         guest->name, vmirq->handle, vmirq->rate, cur, best);
+	}
+}
+
+/* Sample every interrupt's EOI rate since the last pass, and balance
+ * on it.  The first pass after the partition starts only takes the
+ * counts to measure from.
+ *
+ * @return nonzero if any interrupt was at or above the threshold
+ */
+static int vmpic_balance_pass(vmpic_balance_t *bal)
+{
+	guest_t *guest = bal->guest;
+	uint64_t now = get_tb();
+	uint64_t elapsed = now - bal->last_sample;
+	uint64_t freq = dt_get_timebase_freq();
+	int first = !bal->last_sample;
+	int busy = 0;
+	unsigned int i;
+
+	bal->last_sample = now;
+
+	for (i = 0; i < MAX_HANDLES; i++) {
+		handle_t *h = guest->handles[i];
+		vmpic_interrupt_t *vmirq;
+		unsigned long count;
+
+		if (!h || !h->intr)
+			continue;
+
+		vmirq = h->intr;
+		count = vmirq->count;
+		vmirq->rate = first ? 0 : (uint64_t)(count - vmirq->last_count) *
+		                          freq / elapsed;
+		vmirq->last_count = count;
+
+		if (vmirq->rate >= bal->threshold)
+			busy = 1;
+	}
+
+	if (!first && bal->policy != balance_none)
+		vmpic_rebalance(bal);
+
+	return busy;
+}
+
+static void vmpic_balance_wake(hv_timer_t *timer)
+{
+	vmpic_balance_t *bal = to_container(timer, vmpic_balance_t, timer);
+
+	bal->timer_pending = 0;
+	unblock(bal->thread);
+}
+
+/* Sleep the balancer thread for the given number of timebase ticks */
+static void vmpic_balance_sleep(vmpic_balance_t *bal, uint64_t ticks)
+{
+	bal->timer_pending = 1;
+	hv_timer_add(&bal->timer, get_tb() + ticks);
+
+	/* vmpic_balance_start() also wakes the thread, so wait for the
+	 * timer itself -- it must not be added again while it is pending.
+	 */
+	while (1) {
+		prepare_to_block();
+
+		if (!bal->timer_pending)
+			break;
+
+		block();
+	}
+}
+
+/* A paused partition keeps being sampled, with nothing to count. */
+static int vmpic_balance_active(guest_t *guest)
+{
+	return guest->state == guest_running || guest->state == guest_paused;
+}
+
+/* The balancer runs in a thread, so that it can take vmpic_lock for
+ * each move rather than run unlocked from the FIT interrupt.  While
+ * nothing is busy it samples less often, up to BALANCE_MAX_BACKOFF
+ * doublings of the interval.  Once the partition stops, it blocks
+ * without a timer until vmpic_balance_start() wakes it.
+ */
+static void vmpic_balance_thread(trapframe_t *regs, void *arg)
+{
+	vmpic_balance_t *bal = arg;
+
+	while (1) {
+		prepare_to_block();
+
+		if (!vmpic_balance_active(bal->guest)) {
+			bal->last_sample = 0;
+			bal->idle = 0;
+			block();
+			continue;
+		}
+
+		if (vmpic_balance_pass(bal))
+			bal->idle = 0;
+		else if (bal->idle < BALANCE_MAX_BACKOFF)
+			bal->idle++;
+
+		vmpic_balance_sleep(bal, bal->interval << bal->idle);
+	}
+}
+
+/** Start sampling and balancing a partition's interrupts
+ *
+ * Called when the partition starts.  The balancer thread stops by
+ * itself once the partition is stopped.
+ */
+void vmpic_balance_start(guest_t *guest)
+{
+	vmpic_balance_t *bal = guest->irq_balance;
+
+	if (bal)
+		unblock(bal->thread);
+}
+
+static uint32_t get_balance_param(guest_t *guest, const char *name,
+                                  uint32_t def)
+{
+	dt_prop_t *prop = dt_get_prop(guest->partition, name, 0);
+
+	if (!prop)
+		return def;
+
+	if (prop->len != 4 || !*(const uint32_t *)prop->data) {
+		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+		         "%s: guest %s: invalid %s property\n",
+		         __func__, guest->name, name);
+		return def;
+	}
+
+	return *(const uint32_t *)prop->data;
+}
+
+/* Read the partition's interrupt balancing configuration:
+ * "irq-balance" names the policy, "irq-balance-interval" the sampling
+ * period in milliseconds, and "irq-balance-threshold" the rate, in
+ * interrupts per second, above which a source is worth moving.
+ *
+ * Rates are counted from EOI hcalls, so a partition with
+ * mpic-direct-eoi, whose EOIs go straight to the MPIC, cannot be
+ * balanced.
+ */
+static void vmpic_balance_init(guest_t *guest)
+{
+	dt_prop_t *prop = dt_get_prop(guest->partition, "irq-balance", 0);
+	vmpic_balance_t *bal;
+	balance_policy_t policy;
+	uint32_t ms;
+
+	if (!prop)
+		return;
+
+	for (policy = balance_none; policy <= balance_isolate; policy++) {
+		if (!strcmp(prop->data, balance_policy_names[policy]))
+			break;
+	}
+
+	if (policy > balance_isolate) {
+		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+		         "%s: guest %s: unknown irq-balance policy %s\n",
+		         __func__, guest->name, (const char *)prop->data);
+		return;
+	}
+
+	if (guest->mpic_direct_eoi) {
+		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+		         "%s: guest %s: irq-balance ignored with mpic-direct-eoi\n",
+		         __func__, guest->name);
+		return;
+	}
+
+	bal = alloc_type(vmpic_balance_t);
+	if (!bal) {
+		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+		         "%s: out of memory\n", __func__);
+		return;
+	}
+
+	ms = get_balance_param(guest, "irq-balance-interval", 100);
+
+	bal->guest = guest;
+	bal->policy = policy;
+	bal->interval = (uint64_t)dt_get_timebase_freq() * ms / 1000;
+	bal->threshold = get_balance_param(guest, "irq-balance-threshold", 1000);
+	bal->timer.fn = vmpic_balance_wake;
+
+	bal->thread = new_thread("irq-balance", vmpic_balance_thread, bal, 1);
+	if (!bal->thread) {
+		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+		         "%s: guest %s: failed to create balancer thread\n",
+		         __func__, guest->name);
+		free(bal);
+		return;
+	}
+
+	guest->irq_balance = bal;
+}
+
 /**
  * @param[in] pointer to guest device tree
  *
@@ -253,6 +607,8 @@ void vmpic_partition_init(guest_t *guest)
 	};
 #endif
 
+	vmpic_balance_init(guest);
+
 	/* find the vmpic node */
 	vmpic = dt_get_subnode(guest->devices, "vmpic", 1);
 	if (!vmpic)
@@ -372,7 +728,8 @@ void hcall_int_set_config(trapframe_t *regs)
 	uint32_t lcpu_dest = regs->gpregs[6];
 	uint32_t lcpu_mask = 1 << lcpu_dest;
 	interrupt_t *irq;
-	int ret = 0;
+	register_t saved;
+	int ret = 0, cur;
 
 	// FIXME: race against handle closure
 	if (handle >= MAX_HANDLES || !guest->handles[handle]) {
@@ -399,6 +756,10 @@ void hcall_int_set_config(trapframe_t *regs)
 
 	irq = vmirq->irq;
 
+	/* Serializes the retarget with the balancer's moves */
+	saved = spin_lock_intsave(&vmpic_lock);
+	cur = vmpic_irq_target(vmirq);
+
 	if (irq->ops->set_priority)
 		if (irq->ops->set_priority(irq, priority) < 0)
 			goto out_err;
@@ -419,11 +780,19 @@ void hcall_int_set_config(trapframe_t *regs)
 		if (irq->ops->set_delivery_type(irq, TYPE_NORM))
 			goto out_err;
 	
+	/* Restating the current destination -- perhaps one the balancer
+	 * chose -- as guests do when changing priority, isn't a choice.
+	 */
+	if (cur != (int)lcpu_dest)
+		vmirq->pinned = 1;
+
+	spin_unlock_intsave(&vmpic_lock, saved);
 	regs->gpregs[3] = 0;  /* success */
 
 	return;
 
 out_err:
+	spin_unlock_intsave(&vmpic_lock, saved);
 	regs->gpregs[3] = EV_INVALID_STATE;
 }
 
@@ -576,6 +945,7 @@ void hcall_int_eoi(trapframe_t *regs)
 
 	interrupt_t *irq = vmirq->irq;
 	irq->ops->eoi(irq);
+	atomic_add(&vmirq->count, 1);
 	regs->gpregs[3] = 0;  /* success */
 }
 
@@ -33,11 +33,17 @@
 #include <libos/core-regs.h>
 #include <libos/bitops.h>
 #include <libos/errors.h>
+#include <libos/alloc.h>
 
+#include <string.h>
+
+#include <atomic.h>
 #include <vpic.h>
 #include <vmpic.h>
 #include <doorbell.h>
 #include <events.h>
+#include <devtree.h>
+#include <paging.h>
 
 /**
  * virtual interrupts / vpic overview
@@ -61,14 +67,41 @@
  *    Reflecting virtual interrupts to the cpu
  *      -reflecting interrupts is done in the guest doorbell
  *       handler
- *      -if there is no active interrupt and the interrupt is 
- *       not masked it moves into the active state
+ *      -the highest priority pending interrupt that is not
+ *       masked moves into the active state, if its priority is
+ *       above that of any interrupt already active on the vcpu
  *      -it remains active until EOI.
- *      -only one virtual interrupt (per guest) can be active
- *       at a time.
+ *      -so a higher priority interrupt can preempt a lower
+ *       priority one, and at most one virtual interrupt per
+ *       priority can be active on a vcpu at a time.
  *
  *    EOI clears the pending and active state of the interrupt.
  *
+ *    Posting interrupts
+ *      -if the partition has a "vpic-posting" property, each vcpu
+ *       gets a page (vpic_post_page_t) mapped at that guest
+ *       physical address plus vcpu number times the page size,
+ *       described to the guest by "fsl,hv-vpic-posting" in the
+ *       vmpic node.
+ *      -once the guest sets enable in its page, edge triggered
+ *       interrupts without an EOI callback are not made pending;
+ *       the bit for their vmpic handle is set in posted[], then
+ *       the bit for that word in summary, and only if summary was
+ *       empty is the vcpu sent a virtual interrupt.  With coreint
+ *       the vector is VPIC_POST_VECTOR if nothing else is
+ *       pending.
+ *      -that interrupt is flagged by GCPU_PEND_POSTED rather than
+ *       GCPU_PEND_VIRQ, as no iack will clear it.  It is cleared
+ *       when the external interrupt is reflected, or with coreint
+ *       when VPIC_POST_VECTOR is.
+ *      -the guest clears summary, then each word of posted[] it
+ *       named, with atomic swaps, and handles the bits it got.
+ *       Posted interrupts need no iack or EOI hcall, and do not
+ *       take part in vpic priorities.
+ *      -everything else is delivered as before, and need_iack is
+ *       set when it is, so the guest only makes an iack hcall when
+ *       need_iack was set.
+ *
  */
 
 void dbell_to_gdbell_glue(trapframe_t *regs)
@@ -76,96 +109,213 @@ void dbell_to_gdbell_glue(trapframe_t *regs)
 	send_local_guest_doorbell();
 }
 
+static vpic_post_page_t *vpic_post_page(gcpu_t *gcpu)
+{
+	void *post = gcpu->guest->vpic.post;
+
+	if (!post)
+		return NULL;
+
+	return post + gcpu->gcpu_num * PAGE_SIZE;
+}
+
 static void send_vint(gcpu_t *gcpu)
 {
+	vpic_post_page_t *page = vpic_post_page(gcpu);
+
+	if (page) {
+		page->need_iack = 1;
+		smp_lwsync();
+	}
+
 	printlog(LOGTYPE_IRQ, LOGLEVEL_VERBOSE,
 	         "sending vint to cpu%d\n", gcpu->cpu->coreid);
 	atomic_or(&gcpu->gdbell_pending, GCPU_PEND_VIRQ);
 	setevent(gcpu, EV_ASSERT_VINT);
 }
 
-static void set_virq_pending(vpic_interrupt_t *virq, gcpu_t *gcpu)
+static inline int highest_prio(uint32_t mask)
 {
-	gcpu->vpic.pending[virq->irqnum / LONG_BITS] |=
-					1UL << (virq->irqnum % LONG_BITS);
+	return 31 - count_msb_zeroes_32(mask);
+}
 
-	virq->pending = 1;
+/* Priority of the highest priority interrupt active on gcpu, or -1 */
+static int active_prio(gcpu_t *gcpu)
+{
+	uint32_t mask = gcpu->vpic.prio_active;
+
+	return mask ? highest_prio(mask) : -1;
 }
 
-static void set_virq_active(vpic_interrupt_t *virq, gcpu_t *gcpu)
+static void set_gcpu_pending_virq(vpic_interrupt_t *virq, gcpu_t *gcpu)
 {
-	gcpu->vpic.active[virq->irqnum / LONG_BITS] |=
-					1UL << (virq->irqnum % LONG_BITS);
-	virq->active = 1;
+	vpic_cpu_t *vc = &gcpu->vpic;
+	unsigned int word = virq->irqnum / LONG_BITS;
+	int prio = virq->priority;
+
+	vc->pending[prio][word] |= 1UL << (virq->irqnum % LONG_BITS);
+	vc->summary[prio] |= 1UL << word;
+	vc->prio_pending |= 1 << prio;
 }
 
-static void clear_virq_pending(vpic_interrupt_t *virq, gcpu_t *gcpu)
+static void clear_gcpu_pending_virq(vpic_interrupt_t *virq, gcpu_t *gcpu)
+{
+	vpic_cpu_t *vc = &gcpu->vpic;
+	unsigned int word = virq->irqnum / LONG_BITS;
+	int prio = virq->priority;
+
+	vc->pending[prio][word] &= ~(1UL << (virq->irqnum % LONG_BITS));
+	if (vc->pending[prio][word])
+		return;
+
+	vc->summary[prio] &= ~(1UL << word);
+	if (!vc->summary[prio])
+		vc->prio_pending &= ~(1 << prio);
+}
+
+static void set_virq_pending(vpic_interrupt_t *virq, gcpu_t *gcpu)
 {
+	set_gcpu_pending_virq(virq, gcpu);
+	virq->pending = 1;
+}
 
-	gcpu->vpic.pending[virq->irqnum / LONG_BITS] &=
-					~(1UL << (virq->irqnum % LONG_BITS));
+static void clear_virq_pending(vpic_interrupt_t *virq, gcpu_t *gcpu)
+{
+	clear_gcpu_pending_virq(virq, gcpu);
 	virq->pending = 0;
 }
 
+static void set_virq_active(vpic_interrupt_t *virq, gcpu_t *gcpu)
+{
+	int prio = virq->priority;
+
+	assert(!gcpu->vpic.active[prio]);
+
+	gcpu->vpic.active[prio] = virq;
+	gcpu->vpic.prio_active |= 1 << prio;
+	virq->active_prio = prio;
+	virq->active = 1;
+}
+
 static void clear_virq_active(vpic_interrupt_t *virq, gcpu_t *gcpu)
 {
-	gcpu->vpic.active[virq->irqnum / LONG_BITS] &=
-					~(1UL << (virq->irqnum % LONG_BITS));
+	int prio = virq->active_prio;
+
+	if (gcpu->vpic.active[prio] == virq) {
+		gcpu->vpic.active[prio] = NULL;
+		gcpu->vpic.prio_active &= ~(1 << prio);
+	}
+
 	virq->active = 0;
 }
 
 static int virq_pending(vpic_interrupt_t *virq, gcpu_t *gcpu)
 {
-	return gcpu->vpic.pending[virq->irqnum / LONG_BITS] &
+	return gcpu->vpic.pending[virq->priority][virq->irqnum / LONG_BITS] &
 					(1UL << (virq->irqnum % LONG_BITS));
 }
 
-
-static void clear_gcpu_pending_virq(uint8_t irqnum, gcpu_t *gcpu)
+/* Is there a pending interrupt that would preempt everything that
+ * is active on gcpu?
+ */
+static int gcpu_virq_deliverable(gcpu_t *gcpu)
 {
-	gcpu->vpic.pending[irqnum / LONG_BITS] &= ~(1UL << (irqnum%LONG_BITS));
-}
+	uint32_t mask = gcpu->vpic.prio_pending;
 
+	return mask && highest_prio(mask) > active_prio(gcpu);
+}
 
-static int gcpu_virq_active(gcpu_t *gcpu)
+/* Take a vpic lock, counting how often another core already held it. */
+static register_t vpic_lock(uint32_t *lock, unsigned long *contended)
 {
-	for (unsigned int i = 0; i < MAX_VINT_INDEX; i++) {
-		if (gcpu->vpic.active[i])
-			return 1;
-	}
+#ifdef CONFIG_STATISTICS
+	if (*(volatile uint32_t *)lock)
+		atomic_add(contended, 1);
+#endif
 
-	return 0;
+	return spin_lock_intsave(lock);
 }
 
-static int gcpu_virq_pending(gcpu_t *gcpu)
+static gcpu_t *virq_dest(vpic_interrupt_t *virq, uint32_t destcpu)
 {
-	for (unsigned int i = 0; i < MAX_VINT_INDEX; i++) {
-		if (gcpu->vpic.pending[i])
-			return 1;
-	}
+	guest_t *guest = virq->guest;
+	unsigned int cpu_num;
 
-	return 0;
+	assert(destcpu);
+	cpu_num = count_lsb_zeroes(destcpu);
+	assert(cpu_num < guest->cpucnt);
+
+	return guest->gcpus[cpu_num];
 }
 
+/* Lock the vcpu that virq is routed to, which protects the
+ * interrupt's pending and enable state.  Retargeting changes destcpu
+ * only while holding the old destination's lock, so once destcpu is
+ * seen unchanged under the lock, it stays that way.
+ */
+static gcpu_t *lock_virq_dest(vpic_interrupt_t *virq, register_t *save)
+{
+	for (;;) {
+		uint32_t destcpu = virq->destcpu;
+		gcpu_t *gcpu = virq_dest(virq, destcpu);
 
+		*save = vpic_lock(&gcpu->vpic.lock, &gcpu->vpic.lock_contended);
+		if (likely(virq->destcpu == destcpu))
+			return gcpu;
 
-static void __vpic_assert_vint(vpic_interrupt_t *virq)
+		spin_unlock_intsave(&gcpu->vpic.lock, *save);
+	}
+}
+
+/* Deliver virq through gcpu's posting page, if the guest has enabled
+ * it and the interrupt needs no EOI.  Returns nonzero if posted.
+ */
+static int post_virq(vpic_interrupt_t *virq, gcpu_t *gcpu)
 {
-	uint32_t cpumask, destcpu;
-	guest_t *guest = virq->guest;
+	vpic_post_page_t *page = vpic_post_page(gcpu);
+	vmpic_interrupt_t *vmirq = virq->irq.priv;
+	unsigned int word;
 
-	cpumask = virq->destcpu;
-	assert(cpumask);
-	destcpu = count_lsb_zeroes(cpumask);
-	assert(destcpu < guest->cpucnt);
+	if (!page || !page->enable || !vmirq)
+		return 0;
+
+	if ((virq->config & IRQ_LEVEL) || virq->eoi_callback)
+		return 0;
+
+	word = vmirq->handle / 32;
+	assert(word < VPIC_POST_WORDS);
+
+	atomic_fetch_or32(&page->posted[word], 1 << (vmirq->handle % 32));
+	smp_lwsync();
+
+	if (!atomic_fetch_or32(&page->summary, 1 << word)) {
+		atomic_or(&gcpu->gdbell_pending, GCPU_PEND_POSTED);
+		setevent(gcpu, EV_ASSERT_VINT);
+	}
+
+	gcpu->vpic.posted++;
+	return 1;
+}
+
+/* Called with gcpu, the destination of virq, locked. */
+static void __vpic_assert_vint(vpic_interrupt_t *virq, gcpu_t *gcpu)
+{
+	if (virq->enable && post_virq(virq, gcpu)) {
+		virq->pending = 0;
+		return;
+	}
 
-	gcpu_t *gcpu = guest->gcpus[destcpu];
 	virq->pending = 1;
 
 	if (!virq_pending(virq, gcpu)) {
 		if (virq->enable) {
 			set_virq_pending(virq, gcpu);
-			send_vint(gcpu);
+
+			/* Otherwise it is sent on EOI of whatever
+			 * it can't preempt.
+			 */
+			if (virq->priority > active_prio(gcpu))
+				send_vint(gcpu);
 		} else {
 			printlog(LOGTYPE_IRQ, LOGLEVEL_VERBOSE,
 			         "VPIC IRQ %p disabled\n", virq);
@@ -179,81 +329,78 @@ static void __vpic_assert_vint(vpic_interrupt_t *virq)
 void vpic_assert_vint(vpic_interrupt_t *virq)
 {
 	register_t save;
-	guest_t *guest = virq->guest;
+	gcpu_t *gcpu;
 
 	printlog(LOGTYPE_IRQ, LOGLEVEL_VERBOSE, "assert virq %p\n", virq);
 
-	save = spin_lock_intsave(&guest->vpic.lock);
+	gcpu = lock_virq_dest(virq, &save);
 
 	if (!virq->pending)
-		__vpic_assert_vint(virq);
+		__vpic_assert_vint(virq, gcpu);
 	else
 		printlog(LOGTYPE_IRQ, LOGLEVEL_VERBOSE,
 		         "VPIC IRQ %p already pending\n", virq);
 
-	spin_unlock_intsave(&guest->vpic.lock, save);
+	spin_unlock_intsave(&gcpu->vpic.lock, save);
 }
 
 void vpic_deassert_vint(vpic_interrupt_t *virq)
 {
 	register_t save;
-	guest_t *guest = virq->guest;
+	gcpu_t *gcpu;
 
 	printlog(LOGTYPE_IRQ, LOGLEVEL_VERBOSE, "deassert virq %p\n", virq);
 
-	save = spin_lock_intsave(&guest->vpic.lock);
+	gcpu = lock_virq_dest(virq, &save);
 	virq->pending = 0;
-	spin_unlock_intsave(&guest->vpic.lock, save);
+	spin_unlock_intsave(&gcpu->vpic.lock, save);
 }
 
 static vpic_interrupt_t *get_pending_virq(void)
 {
 	gcpu_t *gcpu = get_gcpu();
-	guest_t *guest = gcpu->guest;
-	unsigned int irq = 0;
+	vpic_cpu_t *vc = &gcpu->vpic;
+	unsigned int word, irq;
+	int prio;
 
-	for (unsigned int i = 0; i < MAX_VINT_INDEX; i++, irq += LONG_BITS) {
-		if (gcpu->vpic.pending[i]) {
-			irq += count_lsb_zeroes(gcpu->vpic.pending[i]);
-			return &guest->vpic.ints[irq];
-		}
-	}
+	if (!vc->prio_pending)
+		return NULL;
+
+	prio = highest_prio(vc->prio_pending);
+	word = count_lsb_zeroes(vc->summary[prio]);
+	irq = word * LONG_BITS + count_lsb_zeroes(vc->pending[prio][word]);
 
-	return NULL;
+	return &gcpu->guest->vpic.ints[irq];
 }
 
 static vpic_interrupt_t *get_active_virq(void)
 {
 	gcpu_t *gcpu = get_gcpu();
-	guest_t *guest = gcpu->guest;
-	unsigned int irq = 0;
-
-	for (unsigned int i = 0; i < MAX_VINT_INDEX; i++, irq += LONG_BITS) {
-		if (gcpu->vpic.active[i]) {
-			irq += count_lsb_zeroes(gcpu->vpic.active[i]);
-			return &guest->vpic.ints[irq];
-		}
-	}
+	int prio = active_prio(gcpu);
 
-	return NULL;
+	return prio < 0 ? NULL : gcpu->vpic.active[prio];
 }
 
-
 static vpic_interrupt_t *__vpic_iack(void)
 {
 	vpic_interrupt_t *virq;
 	gcpu_t *gcpu = get_gcpu();
+	int prio = active_prio(gcpu);
 
-	virq = get_active_virq();
-	if (virq)
-		return virq;
-
-	/* look for a pending interrupt that is not masked */
+	/* look for a pending interrupt that is not masked, and
+	 * that preempts whatever is active.
+	 */
 	virq = get_pending_virq();
-	while (virq) {
+	while (virq && virq->priority > prio) {
 		if (!virq->pending || !virq->enable) {
 			/* IRQ was de-asserted, or is masked. */
-			clear_gcpu_pending_virq(virq->irqnum, gcpu);
+			clear_gcpu_pending_virq(virq, gcpu);
+		} else if (virq->active) {
+			/* A level interrupt, or a re-asserted edge, that
+			 * was raised above its own active priority.  It
+			 * can't be acked twice; vpic_eoi() requeues it.
+			 */
+			clear_gcpu_pending_virq(virq, gcpu);
 		} else {
 			if (virq->destcpu & (1 << gcpu->gcpu_num)) {
 				/* int now moves to active state */
@@ -266,31 +413,29 @@ static vpic_interrupt_t *__vpic_iack(void)
 			}
 			
 			/* Tsk, tsk.  The guest changed the destcpu mask
-			 * while the interrupt was pending. Clear it and
-			 * reissue it if it's still active.
+			 * while the interrupt was pending.
+			 * vpic_irq_set_destcpu() has already reissued it
+			 * to the new destination, so just drop it here.
 			 */
-			if (virq->pending) {
-				clear_gcpu_pending_virq(virq->irqnum, gcpu);
-				__vpic_assert_vint(virq);
-			}
+			clear_gcpu_pending_virq(virq, gcpu);
 		}
 
 		virq = get_pending_virq();
 	}
 
-	return NULL;
+	return get_active_virq();
 }
 
 interrupt_t *vpic_iack(void)
 {
 	gcpu_t *gcpu = get_gcpu();
-	guest_t *guest = gcpu->guest;
 	vpic_interrupt_t *virq;
 
-	register_t save = spin_lock_intsave(&guest->vpic.lock);
+	register_t save = vpic_lock(&gcpu->vpic.lock,
+	                            &gcpu->vpic.lock_contended);
 	atomic_and(&gcpu->gdbell_pending, ~(GCPU_PEND_VIRQ));
 	virq = __vpic_iack();
-	spin_unlock_intsave(&guest->vpic.lock, save);
+	spin_unlock_intsave(&gcpu->vpic.lock, save);
 
 	printlog(LOGTYPE_IRQ, LOGLEVEL_VERBOSE, "vpic iack: %p\n", virq);
 
@@ -310,34 +455,34 @@ void vpic_assert_vint_txq(queue_t *q)
 static void vpic_irq_mask(interrupt_t *irq)
 {
 	vpic_interrupt_t *virq = to_container(irq, vpic_interrupt_t, irq);
-	guest_t *guest = virq->guest;
+	register_t save;
+	gcpu_t *gcpu = lock_virq_dest(virq, &save);
 
-	register_t save = spin_lock_intsave(&guest->vpic.lock);
 	printlog(LOGTYPE_IRQ, LOGLEVEL_VERBOSE, "vpic mask: %p\n", virq);
 	virq->enable = 0;
 
 	if (irq->parent)
 		interrupt_mask(irq->parent);
 
-	spin_unlock_intsave(&guest->vpic.lock, save);
+	spin_unlock_intsave(&gcpu->vpic.lock, save);
 }
 
 static void vpic_irq_unmask(interrupt_t *irq)
 {
 	vpic_interrupt_t *virq = to_container(irq, vpic_interrupt_t, irq);
-	guest_t *guest = virq->guest;
-	register_t save = spin_lock_intsave(&guest->vpic.lock);
+	register_t save;
+	gcpu_t *gcpu = lock_virq_dest(virq, &save);
 
 	virq->enable = 1;
 	printlog(LOGTYPE_IRQ, LOGLEVEL_VERBOSE, "vpic unmask: %p\n", virq);
 	
 	if (virq->pending)
-		__vpic_assert_vint(virq);
+		__vpic_assert_vint(virq, gcpu);
 
 	if (irq->parent && irq->parent->ops->is_disabled(irq->parent))
 		interrupt_unmask(irq->parent);
 	
-	spin_unlock_intsave(&guest->vpic.lock, save);
+	spin_unlock_intsave(&gcpu->vpic.lock, save);
 }
 
 static int vpic_irq_is_disabled(interrupt_t *irq)
@@ -350,12 +495,31 @@ static int vpic_irq_set_destcpu(interrupt_t *irq, uint32_t destcpu)
 {
 	vpic_interrupt_t *virq = to_container(irq, vpic_interrupt_t, irq);
 	guest_t *guest = virq->guest;
+	gcpu_t *gcpu;
 	register_t save;
 
 	assert(destcpu != 0 && (destcpu & ((1 << guest->cpucnt) - 1)));
 	
-	save = spin_lock_intsave(&guest->vpic.lock);
+	save = vpic_lock(&guest->vpic.lock, &guest->vpic.lock_contended);
+
+	/* Take the interrupt off its old destination... */
+	gcpu = virq_dest(virq, virq->destcpu);
+	spin_lock(&gcpu->vpic.lock);
+
+	if (virq_pending(virq, gcpu))
+		clear_gcpu_pending_virq(virq, gcpu);
+
 	virq->destcpu = destcpu;
+	spin_unlock(&gcpu->vpic.lock);
+
+	/* ...and reissue it to the new one if it's still asserted. */
+	gcpu = virq_dest(virq, destcpu);
+	spin_lock(&gcpu->vpic.lock);
+
+	if (virq->pending)
+		__vpic_assert_vint(virq, gcpu);
+
+	spin_unlock(&gcpu->vpic.lock);
 	spin_unlock_intsave(&guest->vpic.lock, save);
 
 	return 0;
@@ -376,29 +540,76 @@ void vpic_unmask_parent(vpic_interrupt_t *virq)
 static void vpic_eoi(interrupt_t *irq)
 {
 	vpic_interrupt_t *virq = to_container(irq, vpic_interrupt_t, irq);
-	guest_t *guest = virq->guest;
 	gcpu_t *gcpu = get_gcpu();
-	register_t save = spin_lock_intsave(&guest->vpic.lock);
+	register_t save = vpic_lock(&gcpu->vpic.lock,
+	                            &gcpu->vpic.lock_contended);
 
-	assert(gcpu->guest == guest);
+	assert(gcpu->guest == virq->guest);
 
 	printlog(LOGTYPE_IRQ, LOGLEVEL_VERBOSE, "vpic eoi: %p\n", virq);
 
 	if (!virq->active) {
-		spin_unlock_intsave(&guest->vpic.lock, save);
+		spin_unlock_intsave(&gcpu->vpic.lock, save);
 		return;
 	}
 
 	clear_virq_active(virq, gcpu);
 
-	/* check if more vints are pending */
-	if (!gcpu_virq_active(gcpu) && gcpu_virq_pending(gcpu))
+	/* Still asserted, but dropped by __vpic_iack() while active */
+	if (virq->pending && virq->enable &&
+	    (virq->destcpu & (1 << gcpu->gcpu_num)) &&
+	    !virq_pending(virq, gcpu))
+		set_gcpu_pending_virq(virq, gcpu);
+
+	/* check if more vints can now be delivered */
+	if (gcpu_virq_deliverable(gcpu))
 		send_vint(gcpu);
 
 	if (virq->eoi_callback)
 		virq->eoi_callback(virq);
 
+	spin_unlock_intsave(&gcpu->vpic.lock, save);
+}
+
+static int vpic_irq_set_priority(interrupt_t *irq, int priority)
+{
+	vpic_interrupt_t *virq = to_container(irq, vpic_interrupt_t, irq);
+	guest_t *guest = virq->guest;
+	gcpu_t *gcpu;
+	register_t save;
+
+	if (priority < 0 || priority >= VPIC_PRIOS)
+		return ERR_INVALID;
+
+	/* The guest lock keeps the interrupt from being retargeted,
+	 * so it can only be pending on its current destination.
+	 */
+	save = vpic_lock(&guest->vpic.lock, &guest->vpic.lock_contended);
+	gcpu = virq_dest(virq, virq->destcpu);
+	spin_lock(&gcpu->vpic.lock);
+
+	if (virq_pending(virq, gcpu)) {
+		/* Requeue the interrupt at its new priority */
+		clear_gcpu_pending_virq(virq, gcpu);
+		virq->priority = priority;
+		set_gcpu_pending_virq(virq, gcpu);
+
+		if (gcpu_virq_deliverable(gcpu))
+			send_vint(gcpu);
+	} else {
+		virq->priority = priority;
+	}
+
+	spin_unlock(&gcpu->vpic.lock);
 	spin_unlock_intsave(&guest->vpic.lock, save);
+
+	return 0;
+}
+
+static int vpic_irq_get_priority(interrupt_t *irq)
+{
+	vpic_interrupt_t *virq = to_container(irq, vpic_interrupt_t, irq);
+	return virq->priority;
 }
 
 static uint32_t vpic_irq_get_destcpu(interrupt_t *irq)
@@ -410,13 +621,13 @@ static uint32_t vpic_irq_get_destcpu(interrupt_t *irq)
 static int vpic_irq_is_active(interrupt_t *irq)
 {
 	vpic_interrupt_t *virq = to_container(irq, vpic_interrupt_t, irq);
-	guest_t *guest = virq->guest;
 	register_t save;
+	gcpu_t *gcpu;
 	int ret;
 
-	save = spin_lock_intsave(&guest->vpic.lock);
+	gcpu = lock_virq_dest(virq, &save);
 	ret = (virq->pending && virq->enable) || virq->active;
-	spin_unlock_intsave(&guest->vpic.lock, save);
+	spin_unlock_intsave(&gcpu->vpic.lock, save);
 
 	return ret;
 }
@@ -429,17 +640,147 @@ int_ops_t vpic_ops = {
 	.set_cpu_dest_mask = vpic_irq_set_destcpu,
 	.get_cpu_dest_mask = vpic_irq_get_destcpu,
 	.is_active = vpic_irq_is_active,
+	.set_priority = vpic_irq_set_priority,
+	.get_priority = vpic_irq_get_priority,
 };
 
+/** Set up the partition's interrupt posting pages
+ *
+ * The "vpic-posting" property of the partition node gives the
+ * page-aligned guest physical address of one page per vcpu.
+ */
+void vpic_init_posting(guest_t *guest)
+{
+	dt_prop_t *prop = dt_get_prop(guest->partition, "vpic-posting", 0);
+	const uint32_t *addr;
+	phys_addr_t gaddr;
+	unsigned long grpn, rpn;
+	uint32_t postspec[3];
+	dt_node_t *vmpic;
+	void *post;
+
+	if (!prop)
+		return;
+
+	if (prop->len != 8)
+		goto bad;
+
+	addr = prop->data;
+	gaddr = ((phys_addr_t)addr[0] << 32) | addr[1];
+	if (gaddr & (PAGE_SIZE - 1))
+		goto bad;
+
+	vmpic = dt_get_subnode(guest->devices, "vmpic", 0);
+	if (!vmpic)
+		return;
+
+	post = alloc(guest->cpucnt * PAGE_SIZE, PAGE_SIZE);
+	if (!post)
+		goto nomem;
+
+	grpn = gaddr >> PAGE_SHIFT;
+	rpn = virt_to_phys(post) >> PAGE_SHIFT;
+
+	vptbl_map(guest->gphys, grpn, rpn, guest->cpucnt,
+	          PTE_ALL, PTE_PHYS_LEVELS);
+	vptbl_map(guest->gphys_rev, rpn, grpn, guest->cpucnt,
+	          PTE_ALL, PTE_PHYS_LEVELS);
+
+	postspec[0] = gaddr >> 32;
+	postspec[1] = gaddr;
+	postspec[2] = VPIC_POST_VECTOR;
+
+	if (dt_set_prop(vmpic, "fsl,hv-vpic-posting", postspec,
+	                sizeof(postspec)) < 0)
+		goto nomem;
+
+	printlog(LOGTYPE_IRQ, LOGLEVEL_DEBUG,
+	         "%s: guest %s: posting pages at %llx\n",
+	         __func__, guest->name, (unsigned long long)gaddr);
+
+	guest->vpic.post = post;
+	return;
+
+bad:
+	printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+	         "%s: guest %s: vpic-posting must be a page-aligned 64-bit address\n",
+	         __func__, guest->name);
+	return;
+
+nomem:
+	printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+	         "%s: guest %s: out of memory\n", __func__, guest->name);
+}
+
+/* Posting starts out disabled each time the partition boots. */
+void vpic_reset_posting(guest_t *guest)
+{
+	if (guest->vpic.post)
+		memset(guest->vpic.post, 0, guest->cpucnt * PAGE_SIZE);
+}
+
+/* Are there posted interrupts that the guest has not collected? */
+int vpic_posted(gcpu_t *gcpu)
+{
+	vpic_post_page_t *page = vpic_post_page(gcpu);
+
+	return page && page->enable && page->summary;
+}
+
+/* Number of virtual interrupts for the partition, from its
+ * "vpic-irqs" property.
+ */
+static int vpic_irq_count(guest_t *guest)
+{
+	dt_prop_t *prop;
+	uint32_t count;
+
+	prop = dt_get_prop(guest->partition, "vpic-irqs", 0);
+	if (!prop)
+		return DEFAULT_VINT_CNT;
+
+	if (prop->len != 4) {
+		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+		         "%s: guest %s: invalid vpic-irqs property\n",
+		         __func__, guest->name);
+		return DEFAULT_VINT_CNT;
+	}
+
+	count = *(const uint32_t *)prop->data;
+	if (count < 1 || count > MAX_VINT_CNT) {
+		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+		         "%s: guest %s: vpic-irqs must be 1-%d\n",
+		         __func__, guest->name, MAX_VINT_CNT);
+		return DEFAULT_VINT_CNT;
+	}
+
+	return count;
+}
+
 vpic_interrupt_t *vpic_alloc_irq(guest_t *guest, int config)
 {
 	register_t save;
 	vpic_interrupt_t *virq = NULL;
-	int irq;
+	vpic_interrupt_t *ints = NULL;
+	int irq, count = 0;
+
+	if (!guest->vpic.ints) {
+		count = vpic_irq_count(guest);
+		ints = alloc(count * sizeof(vpic_interrupt_t),
+		             __alignof__(vpic_interrupt_t));
+		if (!ints)
+			return NULL;
+	}
 
-	save = spin_lock_intsave(&guest->vpic.lock);
+	save = vpic_lock(&guest->vpic.lock, &guest->vpic.lock_contended);
 
-	if (guest->vpic.alloc_next < MAX_VINT_CNT) {
+	if (!guest->vpic.ints) {
+		guest->vpic.ints = ints;
+		guest->vpic.max_ints = count;
+		ints = NULL;
+	}
+
+	if (guest->vpic.alloc_next < guest->vpic.max_ints) {
 		irq = guest->vpic.alloc_next++;
 		virq = &guest->vpic.ints[irq];
 
@@ -451,6 +792,15 @@ vpic_interrupt_t *vpic_alloc_irq(guest_t *guest, int config)
 	}
 
 	spin_unlock_intsave(&guest->vpic.lock,save);
+
+	if (ints)
+		free(ints);
+
+	if (!virq)
+		printlog(LOGTYPE_IRQ, LOGLEVEL_ERROR,
+		         "%s: guest %s: out of virtual interrupts\n",
+		         __func__, guest->name);
+
 	return virq;
 }
 
@@ -27,6 +27,7 @@
 
 #include <libos/libos.h>
 #include <libos/epapr_hcalls.h>
+#include <libos/fsl_hcalls.h>
 #include <libos/core-regs.h>
 #include <libos/trapframe.h>
 #include <libos/bitops.h>
@@ -188,6 +189,261 @@ static int test_partial_write(uint32_t rhandle, uint32_t shandle,
 	return 0;
 }
 
+/* Drain whatever is waiting on a handle, with interrupts masked */
+static void drain(uint32_t rhandle)
+{
+	unsigned int count;
+	char buf[16];
+
+	do {
+		count = sizeof(buf);
+		ev_byte_channel_receive(rhandle, &count, buf);
+	} while (count);
+}
+
+#define RING_SIZE 64
+
+/* Layout of a registered ring: a header followed by the tx and rx areas */
+typedef struct {
+	uint32_t tx_prod, tx_cons, rx_prod, rx_cons;
+	uint32_t reserved[4];
+	char tx[RING_SIZE];
+	char rx[RING_SIZE];
+} __attribute__((aligned(32))) bc_ring_t;
+
+static bc_ring_t ring;
+
+static unsigned int bc_ring_register(unsigned int handle, uint32_t size,
+                                     phys_addr_t addr)
+{
+	register uintptr_t r11 __asm__("r11");
+	register uintptr_t r3 __asm__("r3");
+	register uintptr_t r4 __asm__("r4");
+	register uintptr_t r5 __asm__("r5");
+	register uintptr_t r6 __asm__("r6");
+
+	r11 = FH_HCALL_TOKEN(21);
+	r3 = handle;
+	r4 = size;
+	r5 = (uint32_t)addr;
+	r6 = (uint64_t)addr >> 32;
+
+	__asm__ __volatile__("sc 1"
+		: "+r" (r11), "+r" (r3), "+r" (r4), "+r" (r5), "+r" (r6)
+		: : EV_HCALL_CLOBBERS4);
+
+	return r3;
+}
+
+static unsigned int bc_ring_kick(unsigned int handle, uint32_t *tx_left,
+                                 uint32_t *rx_pending)
+{
+	register uintptr_t r11 __asm__("r11");
+	register uintptr_t r3 __asm__("r3");
+	register uintptr_t r4 __asm__("r4");
+	register uintptr_t r5 __asm__("r5");
+
+	r11 = FH_HCALL_TOKEN(22);
+	r3 = handle;
+
+	__asm__ __volatile__("sc 1"
+		: "+r" (r11), "+r" (r3), "=r" (r4), "=r" (r5)
+		: : EV_HCALL_CLOBBERS3);
+
+	*tx_left = r4;
+	*rx_pending = r5;
+	return r3;
+}
+
+/* Send more than one register-based hcall's worth through a ring on
+ * shandle, and receive it on rhandle; then the reverse.
+ */
+static int test_ring(uint32_t shandle, uint32_t rhandle)
+{
+	const char *str = "ring data, more than sixteen bytes long!"; /* 40 */
+	unsigned int len = strlen(str), count, got = 0;
+	uint32_t status, tx_left, rx_pending;
+	char buf[48];
+
+	status = bc_ring_register(shandle, RING_SIZE, virt_to_phys(&ring));
+	if (status) {
+		printf("ERROR: ring register failed, status %d\n", status);
+		return 1;
+	}
+
+	memcpy(ring.tx, str, len);
+	ring.tx_prod = len;
+
+	status = bc_ring_kick(shandle, &tx_left, &rx_pending);
+	if (status || tx_left || rx_pending || ring.tx_cons != len) {
+		printf("ERROR: ring kick status %d, tx left %d, rx pending %d, "
+		       "tx cons %d\n", status, tx_left, rx_pending, ring.tx_cons);
+		return 1;
+	}
+
+	while (got < len) {
+		count = 16;
+		status = ev_byte_channel_receive(rhandle, &count, buf + got);
+		if (status || !count)
+			break;
+
+		got += count;
+	}
+
+	if (got != len || memcmp(buf, str, len)) {
+		printf("ERROR: received %d of %d bytes sent through ring\n",
+		       got, len);
+		return 1;
+	}
+
+	printf(" > Ring send (%d char): PASSED\n", len);
+
+	count = 16;
+	status = ev_byte_channel_send(rhandle, &count, str);
+	count = 4;
+	status += ev_byte_channel_send(rhandle, &count, str + 16);
+	if (status) {
+		printf("ERROR: send to ring failed\n");
+		return 1;
+	}
+
+	status = bc_ring_kick(shandle, &tx_left, &rx_pending);
+	if (status || rx_pending != 20 || ring.rx_prod != 20 ||
+	    memcmp(ring.rx, str, 20)) {
+		printf("ERROR: ring kick status %d, rx pending %d, rx prod %d\n",
+		       status, rx_pending, ring.rx_prod);
+		return 1;
+	}
+
+	ring.rx_cons = ring.rx_prod;
+
+	printf(" > Ring receive (20 char): PASSED\n");
+
+	status = bc_ring_register(shandle, 0, 0);
+	if (status || bc_ring_kick(shandle, &tx_left, &rx_pending) != EV_EINVAL) {
+		printf("ERROR: ring unregister failed\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Most descriptors one vectored hcall takes */
+#define BYTE_CHAN_VEC_MAX 64
+
+/* Descriptor for the vectored send and receive hcalls */
+typedef struct {
+	uint64_t buf;
+	uint32_t handle;
+	uint32_t len;
+	uint32_t status;
+	uint32_t reserved;
+} bc_vec_t;
+
+static unsigned int bc_vec(unsigned int num, bc_vec_t *vec, int send,
+                           uint32_t *total)
+{
+	register uintptr_t r11 __asm__("r11");
+	register uintptr_t r3 __asm__("r3");
+	register uintptr_t r4 __asm__("r4");
+	register uintptr_t r5 __asm__("r5");
+	phys_addr_t addr = virt_to_phys(vec);
+
+	r11 = FH_HCALL_TOKEN(send ? 23 : 24);
+	r3 = num;
+	r4 = (uint32_t)addr;
+	r5 = (uint64_t)addr >> 32;
+
+	__asm__ __volatile__("sc 1"
+		: "+r" (r11), "+r" (r3), "+r" (r4), "+r" (r5)
+		: : EV_HCALL_CLOBBERS3);
+
+	*total = r4;
+	return r3;
+}
+
+static int check_vec(const char *what, bc_vec_t *vec, const uint32_t *len,
+                     const uint32_t *status, int num)
+{
+	for (int i = 0; i < num; i++) {
+		if (vec[i].len != len[i] || vec[i].status != status[i]) {
+			printf("ERROR: %s descriptor %d: len %d status %d, "
+			       "expected len %d status %d\n", what, i,
+			       vec[i].len, vec[i].status, len[i], status[i]);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Send and receive batches mixing good descriptors, a bad handle,
+ * and a descriptor the queue can only partly satisfy.
+ */
+static int test_vec(uint32_t shandle, uint32_t rhandle)
+{
+	static const uint32_t send_len[3] = { 4, 0, 4 };
+	static const uint32_t recv_len[3] = { 8, 0, 4 };
+	static const uint32_t status[3] = { 0, EV_EINVAL, 0 };
+	const char *str = "byte-channel:-A!";	/* 16 chars*/
+	static bc_vec_t vec[3];
+	unsigned int count;
+	uint32_t ret, total;
+	char buf[32];
+
+	/* fill up byte-channel, then make room for 8 bytes */
+	count = 1;
+	while (ev_byte_channel_send(shandle, &count, str) != EV_EAGAIN);
+
+	count = 8;
+	if (ev_byte_channel_receive(rhandle, &count, buf) || count != 8) {
+		printf("ERROR: could not make room in byte-channel\n");
+		return 1;
+	}
+
+	vec[0] = (bc_vec_t){ virt_to_phys((void *)str), shandle, 4 };
+	vec[1] = (bc_vec_t){ virt_to_phys((void *)str), 0xffff, 16 };
+	vec[2] = (bc_vec_t){ virt_to_phys((void *)(str + 4)), shandle, 16 };
+
+	ret = bc_vec(3, vec, 1, &total);
+	if (ret || total != 8 || check_vec("sendv", vec, send_len, status, 3)) {
+		printf("ERROR: sendv status %d, total %d\n", ret, total);
+		return 1;
+	}
+
+	printf(" > Vectored send (%d char): PASSED\n", total);
+
+	drain(rhandle);
+
+	count = 12;
+	if (ev_byte_channel_send(shandle, &count, str) || count != 12) {
+		printf("ERROR: send for receivev failed\n");
+		return 1;
+	}
+
+	vec[0] = (bc_vec_t){ virt_to_phys(buf), rhandle, 8 };
+	vec[1] = (bc_vec_t){ virt_to_phys(buf), 0xffff, 16 };
+	vec[2] = (bc_vec_t){ virt_to_phys(buf + 8), rhandle, 16 };
+
+	ret = bc_vec(3, vec, 0, &total);
+	if (ret || total != 12 ||
+	    check_vec("receivev", vec, recv_len, status, 3) ||
+	    memcmp(buf, str, 12)) {
+		printf("ERROR: receivev status %d, total %d\n", ret, total);
+		return 1;
+	}
+
+	printf(" > Vectored receive (%d char): PASSED\n", total);
+
+	ret = bc_vec(BYTE_CHAN_VEC_MAX + 1, vec, 1, &total);
+	if (ret != EV_EINVAL) {
+		printf("ERROR: sendv of too many descriptors returned %d\n", ret);
+		return 1;
+	}
+
+	return 0;
+}
+
 static void dump_dev_tree(void)
 {
 #ifdef DEBUG
@@ -429,6 +685,17 @@ void libos_client_entry(unsigned long devtree_ptr)
 	if (test_partial_write(handle[1], handle[0], 0, 0))
 		goto bad;
 
+	/* registered ring unit test */
+	drain(handle[0]);
+	drain(handle[1]);
+
+	if (test_ring(handle[0], handle[1]))
+		goto bad;
+
+	/* vectored send and receive unit test */
+	if (test_vec(handle[0], handle[1]))
+		goto bad;
+
 	printf("Test Complete\n");
 
 	return;
@@ -0,0 +1,243 @@
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Interrupt posting: a doorbell rung to self is posted to the vcpu's
+ * posting page rather than made pending in the vpic.  Run with coreint
+ * (hv-B), where posts arrive with their own vector, and without
+ * (hv-A), where the guest looks at the page on every external
+ * interrupt.  Once the guest has collected its posts, no further
+ * external interrupts must arrive.
+ */
+
+#include <libos/libos.h>
+#include <libos/alloc.h>
+#include <libos/epapr_hcalls.h>
+#include <libos/core-regs.h>
+#include <libos/trapframe.h>
+#include <libos/bitops.h>
+#include <libos/fsl-booke-tlb.h>
+#include <libfdt.h>
+#include <hvtest.h>
+
+#define PAGE_SIZE 4096
+#define NUM_POSTS 10
+
+/* Layout of a vcpu's posting page */
+typedef struct {
+	uint32_t enable;
+	uint32_t summary;
+	uint32_t need_iack;
+	uint32_t reserved[13];
+	uint32_t posted[32];
+} post_page_t;
+
+static volatile post_page_t *page;
+static uint32_t post_vector;
+static const uint32_t *dbell_irq;
+static volatile int extint_cnt, posted_cnt, unknown_cnt;
+
+static uint32_t swap32(volatile uint32_t *ptr, uint32_t val)
+{
+	uint32_t old;
+
+	asm volatile("1: lwarx %0, 0, %1;"
+	             "stwcx. %2, 0, %1;"
+	             "bne- 1b;"
+	             : "=&r" (old)
+	             : "r" (ptr), "r" (val)
+	             : "cc", "memory");
+
+	return old;
+}
+
+static void collect_posted(void)
+{
+	uint32_t summary = swap32(&page->summary, 0);
+
+	while (summary) {
+		int word = count_lsb_zeroes(summary);
+		uint32_t bits = swap32(&page->posted[word], 0);
+
+		summary &= ~(1 << word);
+
+		if (word == *dbell_irq / 32 &&
+		    (bits & (1 << (*dbell_irq % 32)))) {
+			posted_cnt++;
+			bits &= ~(1 << (*dbell_irq % 32));
+		}
+
+		if (bits)
+			unknown_cnt++;
+	}
+}
+
+void ext_int_handler(trapframe_t *frameptr)
+{
+	unsigned int vector;
+
+	extint_cnt++;
+
+	if (coreint) {
+		vector = mfspr(SPR_EPR);
+		if (vector == post_vector) {
+			collect_posted();
+			return;
+		}
+
+		unknown_cnt++;
+		ev_int_eoi(vector);
+		return;
+	}
+
+	if (swap32(&page->need_iack, 0)) {
+		ev_int_iack(0, &vector);
+		unknown_cnt++;
+		ev_int_eoi(vector);
+	}
+
+	collect_posted();
+}
+
+static const uint32_t *get_prop(const char *compat, const char *prop,
+                                int *len)
+{
+	int off = fdt_node_offset_by_compatible(fdt, -1, compat);
+
+	if (off < 0)
+		return NULL;
+
+	return fdt_getprop(fdt, off, prop, len);
+}
+
+static int map_post_page(void)
+{
+	const uint32_t *spec;
+	phys_addr_t addr;
+	void *vaddr;
+	int len;
+
+	spec = get_prop("epapr,hv-pic", "fsl,hv-vpic-posting", &len);
+	if (!spec || len != 12) {
+		printf("no fsl,hv-vpic-posting in vmpic node\n");
+		return -1;
+	}
+
+	/* This is vcpu 0, so its page is the first. */
+	addr = ((phys_addr_t)spec[0] << 32) | spec[1];
+	post_vector = spec[2];
+
+	vaddr = valloc(PAGE_SIZE, PAGE_SIZE);
+	if (!vaddr) {
+		printf("valloc failed\n");
+		return -1;
+	}
+
+	tlb1_set_entry(1, (unsigned long)vaddr, addr, TLB_TSIZE_4K, MAS1_IPROT,
+	               TLB_MAS2_MEM, TLB_MAS3_KERN, 0, 0);
+
+	page = vaddr;
+	return 0;
+}
+
+/* Give stray interrupts a chance to show up */
+static void settle(void)
+{
+	uint64_t start = get_tb();
+
+	while (get_tb() - start < 0x100000)
+		;
+}
+
+void libos_client_entry(unsigned long devtree_ptr)
+{
+	const uint32_t *dbell_handle;
+	int i, cnt;
+
+	init(devtree_ptr);
+
+	printf("vpic posting test (%s)\n", coreint ? "coreint" : "legacy");
+
+	if (map_post_page())
+		goto bad;
+
+	dbell_irq = get_prop("epapr,hv-receive-doorbell", "interrupts", NULL);
+	dbell_handle = get_prop("epapr,hv-send-doorbell", "hv-handle", NULL);
+	if (!dbell_irq || !dbell_handle) {
+		printf("Couldn't get doorbell handles\n");
+		goto bad;
+	}
+
+	/* Only edge triggered interrupts are posted. */
+	ev_int_set_config(*dbell_irq, 0, 15, 0);
+	ev_int_set_mask(*dbell_irq, 0);
+
+	page->enable = 1;
+	enable_extint();
+
+	for (i = 0; i < NUM_POSTS; i++) {
+		ev_doorbell_send(*dbell_handle);
+
+		while (posted_cnt == i)
+			;
+	}
+
+	if (posted_cnt != NUM_POSTS || unknown_cnt) {
+		printf(" > posted doorbells: %d of %d, %d unknown: FAILED\n",
+		       posted_cnt, NUM_POSTS, unknown_cnt);
+		goto bad;
+	}
+
+	printf(" > posted doorbells (%d): PASSED\n", posted_cnt);
+
+	/* Nothing is left to deliver, so no external interrupt may
+	 * follow -- in particular, without coreint, no iack is made to
+	 * clear the vcpu's pending flag.
+	 */
+	cnt = extint_cnt;
+	settle();
+
+	if (extint_cnt != cnt) {
+		printf(" > %d more external interrupts after collection: FAILED\n",
+		       extint_cnt - cnt);
+		goto bad;
+	}
+
+	printf(" > no interrupts once collected: PASSED\n");
+
+	/* Posting again after the quiet period still works. */
+	ev_doorbell_send(*dbell_handle);
+	settle();
+
+	if (posted_cnt != NUM_POSTS + 1) {
+		printf(" > post after collection: FAILED\n");
+		goto bad;
+	}
+
+	printf(" > post after collection: PASSED\n");
+	printf("Test Complete\n");
+	return;
+
+bad:
+	printf("Test Failed\n");
+}
@@ -0,0 +1,583 @@
+/** @file
+ * Host-side loopback test for the byte channel multiplexer
+ *
+ * Builds src/bcmux.c natively, connects a number of simulated guest
+ * byte channels to one multiplexed stream, and plays the part of the
+ * host-side mux server at the other end.  Data is checked in both
+ * directions, and the time spent in the multiplexer is measured along
+ * with how evenly the stream is shared between channels.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <time.h>
+
+/* Pull in the statics (mux_complex_init(), the callbacks) as well. */
+#include "../../src/bcmux.c"
+
+int sim_loglevel = LOGLEVEL_ERROR;
+cpu_t *cpu;
+dt_node_t *config_tree;
+
+static cpu_t sim_cpu;
+static size_t queue_size = 4096;
+
+/* Stand-ins for the parts of byte_chan.c and devtree.c that bcmux.c
+ * links against.
+ */
+void *slab_alloc(slab_pool_t *pool)
+{
+	return calloc(1, pool->objsize);
+}
+
+void slab_free(slab_pool_t *pool, void *obj)
+{
+	free(obj);
+}
+
+/* free() is redirected here by the libos/alloc.h stand-in. */
+void sim_free(void *ptr)
+{
+	(free)(ptr);
+}
+
+byte_chan_t *byte_chan_alloc(void)
+{
+	byte_chan_t *bc = calloc(1, sizeof(byte_chan_t));
+
+	if (!bc || queue_init(&bc->q[0], queue_size) ||
+	    queue_init(&bc->q[1], queue_size)) {
+		perror("byte_chan_alloc");
+		exit(1);
+	}
+
+	bc->handles[0].tx = &bc->q[0];
+	bc->handles[0].rx = &bc->q[1];
+	bc->handles[1].tx = &bc->q[1];
+	bc->handles[1].rx = &bc->q[0];
+	return bc;
+}
+
+byte_chan_handle_t *byte_chan_claim(byte_chan_t *bc)
+{
+	for (int i = 0; i < 2; i++) {
+		if (!bc->handles[i].attached) {
+			bc->handles[i].attached = 1;
+			return &bc->handles[i];
+		}
+	}
+
+	return NULL;
+}
+
+int byte_chan_attach_chardev(byte_chan_t *bc, chardev_t *cd)
+{
+	return ERR_INVALID;
+}
+
+byte_chan_t *other_attach_byte_chan(dt_node_t *bcnode, dt_node_t *onode)
+{
+	return NULL;
+}
+
+dt_prop_t *dt_get_prop(dt_node_t *node, const char *name, int search_parent)
+{
+	return NULL;
+}
+
+dt_node_t *dt_lookup_phandle(dt_node_t *tree, uint32_t phandle)
+{
+	return NULL;
+}
+
+int dt_node_is_compatible(dt_node_t *node, const char *compat)
+{
+	return 0;
+}
+
+int dt_for_each_compatible(dt_node_t *tree, const char *compat,
+                           int (*callback)(dt_node_t *node, void *arg),
+                           void *arg)
+{
+	return 0;
+}
+
+/* Per-channel state.  Each direction carries the same deterministic
+ * pattern, which includes the escape and start-of-frame characters.
+ */
+typedef struct chan {
+	byte_chan_handle_t *guest;
+	unsigned long tx_gen;   /* bytes generated by the guest */
+	unsigned long tx_got;   /* bytes decoded by the host */
+	unsigned long rx_gen;   /* bytes generated by the host */
+	unsigned long rx_got;   /* bytes received by the guest */
+} chan_t;
+
+static chan_t *chans;
+static int num_chans = 32;
+static unsigned long errors;
+
+static uint8_t pattern(int ch, unsigned long off)
+{
+	return off * 7 + ch * 13;
+}
+
+static void check(int ch, unsigned long *off, uint8_t c)
+{
+	if (c != pattern(ch, *off) && errors++ < 10)
+		fprintf(stderr, "channel %d offset %lu: got 0x%02x, expected 0x%02x\n",
+		        ch, *off, c, pattern(ch, *off));
+
+	(*off)++;
+}
+
+/* Host-side decoder for the stream from the multiplexer */
+typedef struct decoder {
+	int framed;
+	int esc;
+	int chan;
+	int state;
+	int left;
+	int acked;
+	unsigned long wire;
+} decoder_t;
+
+static void decode(decoder_t *d, uint8_t c)
+{
+	d->wire++;
+
+	if (d->framed) {
+		switch (d->state) {
+		case RX_FRAME_SOF:
+			if (c != MUX_FRAME_SOF && errors++ < 10)
+				fprintf(stderr, "expected start of frame, got 0x%02x\n", c);
+
+			d->state = RX_FRAME_CHANNEL;
+			return;
+
+		case RX_FRAME_CHANNEL:
+			d->chan = c < num_chans ? c : -1;
+			d->state = RX_FRAME_LEN;
+			return;
+
+		case RX_FRAME_LEN:
+			d->left = c;
+			d->state = c ? RX_FRAME_PAYLOAD : RX_FRAME_SOF;
+			return;
+
+		case RX_FRAME_PAYLOAD:
+			if (!--d->left)
+				d->state = RX_FRAME_SOF;
+			break;
+		}
+	} else if (d->esc) {
+		d->esc = 0;
+
+		if (c == TX_RESET)
+			return;
+
+		if (c == FRAMED_REQ) {
+			d->framed = 1;
+			d->acked = 1;
+			d->state = RX_FRAME_SOF;
+			return;
+		}
+
+		if (c >= CHAN0_MUX_CHAR) {
+			d->chan = c - CHAN0_MUX_CHAR < num_chans ?
+			          c - CHAN0_MUX_CHAR : -1;
+			return;
+		}
+	} else if (c == CH_SWITCH_ESCAPE) {
+		d->esc = 1;
+		return;
+	}
+
+	if (d->chan < 0) {
+		if (errors++ < 10)
+			fprintf(stderr, "data 0x%02x for no channel\n", c);
+		return;
+	}
+
+	check(d->chan, &chans[d->chan].tx_got, c);
+}
+
+/* Encode up to len bytes of a channel's data for the multiplexer.
+ * Returns the number of wire bytes placed in buf.
+ */
+static size_t encode(chan_t *ch, int num, int framed, size_t len,
+                     uint8_t *buf)
+{
+	size_t n = 0;
+
+	if (framed) {
+		buf[n++] = MUX_FRAME_SOF;
+		buf[n++] = num;
+		buf[n++] = len;
+
+		while (len--)
+			buf[n++] = pattern(num, ch->rx_gen++);
+
+		return n;
+	}
+
+	buf[n++] = CH_SWITCH_ESCAPE;
+	buf[n++] = CHAN0_MUX_CHAR + num;
+
+	while (len--) {
+		uint8_t c = pattern(num, ch->rx_gen++);
+
+		if (c == CH_SWITCH_ESCAPE)
+			buf[n++] = c;
+
+		buf[n++] = c;
+	}
+
+	return n;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Jain's fairness index: 1 when all channels got the same share,
+ * 1/n when one channel got everything.
+ */
+static double fairness(unsigned long *x, int n)
+{
+	double sum = 0, sumsq = 0;
+
+	for (int i = 0; i < n; i++) {
+		sum += x[i];
+		sumsq += (double)x[i] * x[i];
+	}
+
+	return sumsq ? sum * sum / (n * sumsq) : 1;
+}
+
+/* Channels from first on are compared for fairness; channel 0 is
+ * left out when it is given a different weight or workload.
+ */
+static void report(const char *dir, unsigned long *got, unsigned long wire,
+                   double secs, int first)
+{
+	unsigned long total = 0, lo = ~0UL, hi = 0;
+
+	for (int i = 0; i < num_chans; i++) {
+		total += got[i];
+
+		if (i >= first) {
+			lo = min(lo, got[i]);
+			hi = max(hi, got[i]);
+		}
+	}
+
+	printf("%s: %lu payload bytes, %lu wire bytes (%.1f%% overhead)\n",
+	       dir, total, wire, total ? 100.0 * (wire - total) / total : 0);
+	printf("%s: %.3f ms in mux, %.2f Mchars/s\n",
+	       dir, secs * 1000, secs ? total / secs / 1e6 : 0);
+	printf("%s: per channel min %lu max %lu, fairness %.3f\n",
+	       dir, lo, hi, fairness(got + first, num_chans - first));
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+	        "Usage: bcmux-sim [options]\n"
+	        "\n"
+	        "  -c <n>      number of channels (default 32)\n"
+	        "  -r <n>      rounds in each direction (default 2000)\n"
+	        "  -u <bytes>  wire bytes the host moves per round (default 512)\n"
+	        "  -l <bytes>  run length the host sends per channel (default 64)\n"
+	        "  -q <bytes>  size of each queue (default 4096)\n"
+	        "  -f          ask the multiplexer for framed mode\n"
+	        "  -a          with -f, ask while the stream is full\n"
+	        "  -F          configure the multiplexer for framed mode\n"
+	        "  -i          make channel 0 an interactive console\n"
+	        "  -w <n>      weight of channel 0 (default 1)\n"
+	        "  -v          print multiplexer debug messages\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int rounds = 2000, negotiate = 0, configured = 0, ack_wait = 0;
+	int interactive = 0, weight = 1;
+	unsigned long lines = 0, lat_total = 0, lat_max = 0;
+	unsigned long line_end = 0;
+	int line_round = -1;
+	size_t per_round = 512, run = 64;
+	byte_chan_t *uart;
+	byte_chan_handle_t *host;
+	mux_complex_t *mux;
+	decoder_t dec = {};
+	unsigned long *got, wire = 0;
+	uint8_t *buf;
+	double t, secs;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:r:u:l:q:fFaiw:vh")) != -1) {
+		switch (opt) {
+		case 'c':
+			num_chans = atoi(optarg);
+			break;
+		case 'r':
+			rounds = atoi(optarg);
+			break;
+		case 'u':
+			per_round = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			run = strtoul(optarg, NULL, 0);
+			break;
+		case 'q':
+			queue_size = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			negotiate = 1;
+			break;
+		case 'F':
+			configured = 1;
+			break;
+		case 'a':
+			ack_wait = 1;
+			break;
+		case 'i':
+			interactive = 1;
+			break;
+		case 'w':
+			weight = atoi(optarg);
+			break;
+		case 'v':
+			sim_loglevel = LOGLEVEL_DEBUG;
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc || num_chans < 1 || num_chans > MAX_MUX_CHANNELS ||
+	    rounds < 1 || run < 1 || run > MUX_FRAME_MAX ||
+	    per_round < 2 * run + MUX_FRAME_HDR || queue_size < per_round ||
+	    (interactive && num_chans < 2)) {
+		usage();
+		return 1;
+	}
+
+	cpu = &sim_cpu;
+	chans = calloc(num_chans, sizeof(chan_t));
+	got = calloc(num_chans, sizeof(unsigned long));
+	buf = malloc(queue_size);
+	if (!chans || !got || !buf) {
+		perror("malloc");
+		return 1;
+	}
+
+	uart = byte_chan_alloc();
+	mux = mux_complex_init(uart);
+	host = byte_chan_claim(uart);
+	mux->framed = mux->rx_framed = dec.framed = configured;
+
+	for (int i = 0; i < num_chans; i++) {
+		byte_chan_t *bc = byte_chan_alloc();
+
+		if (mux_complex_add(mux, bc, i)) {
+			fprintf(stderr, "mux_complex_add failed\n");
+			return 1;
+		}
+
+		chans[i].guest = byte_chan_claim(bc);
+	}
+
+	if (mux_complex_set_weight(mux, 0, weight)) {
+		fprintf(stderr, "bad weight %d\n", weight);
+		return 1;
+	}
+
+	if (negotiate && !configured) {
+		static const uint8_t req[] = { CH_SWITCH_ESCAPE, FRAMED_REQ };
+
+		/* Fill the stream with channel resets, which the decoder
+		 * skips, leaving no room for the acknowledgement.
+		 */
+		if (ack_wait) {
+			while (queue_get_space(host->rx) >= 2) {
+				queue_writechar(host->rx, CH_SWITCH_ESCAPE);
+				queue_writechar(host->rx, TX_RESET);
+			}
+		}
+
+		queue_write(host->tx, req, sizeof(req));
+		queue_notify_consumer(host->tx, 0);
+
+		if (ack_wait && (mux->framed || !mux->framed_ack)) {
+			fprintf(stderr, "framed mode entered with no room to acknowledge\n");
+			return 1;
+		}
+
+		/* Reading makes room, and lets a held acknowledgement out. */
+		while (!dec.acked && queue_readchar(host->rx, 1) >= 0) {
+			decode(&dec, queue_readchar(host->rx, 0));
+			queue_notify_producer(host->rx);
+		}
+
+		if (!dec.acked) {
+			fprintf(stderr, "framed mode not acknowledged\n");
+			return 1;
+		}
+	}
+
+	printf("%s mode, %d channels, %d rounds, %zu wire bytes per round\n",
+	       configured ? "framed (configured)" :
+	       negotiate ? "framed (negotiated)" : "unframed",
+	       num_chans, rounds, per_round);
+
+	if (interactive || weight != 1)
+		printf("channel 0: %s, weight %d\n",
+		       interactive ? "interactive" : "backlogged", weight);
+
+	/* Guests to host: every channel is kept backlogged, and the host
+	 * drains the stream at a fixed rate, as a UART would.  An
+	 * interactive channel 0 instead writes a short line whenever the
+	 * previous one has been delivered, and the rounds it takes to
+	 * arrive are recorded.
+	 */
+	secs = 0;
+	dec.wire = 0;
+
+	for (int r = 0; r < rounds; r++) {
+		if (interactive && line_round >= 0 &&
+		    chans[0].tx_got >= line_end) {
+			unsigned long lat = r - line_round;
+
+			lat_total += lat;
+			lat_max = max(lat_max, lat);
+			lines++;
+			line_round = -1;
+		}
+
+		for (int i = 0; i < num_chans; i++) {
+			chan_t *ch = &chans[i];
+			size_t space = queue_get_space(ch->guest->tx);
+			size_t n;
+
+			if (interactive && i == 0) {
+				if (line_round >= 0)
+					continue;
+
+				space = min(space, (size_t)16);
+				line_end = ch->tx_gen + space;
+				line_round = r;
+			}
+
+			for (n = 0; n < space; n++)
+				buf[n] = pattern(i, ch->tx_gen + n);
+
+			ch->tx_gen += queue_write(ch->guest->tx, buf, space);
+
+			t = now();
+			queue_notify_consumer(ch->guest->tx, 0);
+			secs += now() - t;
+		}
+
+		int n = queue_read(host->rx, buf, per_round, 0);
+		for (int i = 0; i < n; i++)
+			decode(&dec, buf[i]);
+
+		t = now();
+		queue_notify_producer(host->rx);
+		secs += now() - t;
+	}
+
+	for (int i = 0; i < num_chans; i++)
+		got[i] = chans[i].tx_got;
+
+	report("tx", got, dec.wire, secs, interactive || weight != 1);
+
+	if (interactive)
+		printf("tx: %lu interactive lines, latency avg %.2f max %lu rounds\n",
+		       lines, lines ? (double)lat_total / lines : 0, lat_max);
+	else if (weight != 1) {
+		unsigned long others = 0;
+
+		for (int i = 1; i < num_chans; i++)
+			others += got[i];
+
+		printf("tx: channel 0 got %.2f times the share of the others\n",
+		       others ? (double)got[0] * (num_chans - 1) / others : 0);
+	}
+
+	/* Host to guests: the host sends a run for each channel in turn,
+	 * and each guest drains its channel every round.
+	 */
+	secs = 0;
+	wire = 0;
+
+	for (int r = 0, next = 0; r < rounds; r++) {
+		size_t room = min(per_round, queue_get_space(host->tx));
+
+		while (room >= 2 * run + MUX_FRAME_HDR) {
+			size_t n = encode(&chans[next], next, dec.framed, run, buf);
+
+			queue_write(host->tx, buf, n);
+			room -= n;
+			wire += n;
+			next = (next + 1) % num_chans;
+		}
+
+		t = now();
+		queue_notify_consumer(host->tx, 0);
+		secs += now() - t;
+
+		for (int i = 0; i < num_chans; i++) {
+			chan_t *ch = &chans[i];
+			int n = queue_read(ch->guest->rx, buf, queue_size, 0);
+
+			for (int j = 0; j < n; j++)
+				check(i, &ch->rx_got, buf[j]);
+
+			queue_notify_producer(ch->guest->rx);
+		}
+	}
+
+	for (int i = 0; i < num_chans; i++)
+		got[i] = chans[i].rx_got;
+
+	report("rx", got, wire, secs, 0);
+
+	if (mux->rx_discarded)
+		printf("rx: %d bytes discarded by the multiplexer\n",
+		       mux->rx_discarded);
+
+	printf("%lu data errors\n", errors);
+	return errors || mux->rx_discarded ? 1 : 0;
+}
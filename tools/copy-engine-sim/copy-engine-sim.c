@@ -0,0 +1,617 @@
+/** @file
+ * Host-side test of asynchronous partition copies
+ *
+ * Builds src/copy_engine.c natively, with mock DMA channels (or the
+ * software backend) copying between simulated guest memories.  A
+ * manager partition queues copies the way partman would, and the
+ * results, doorbells, request limits and partition reset handling
+ * are checked.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <ucontext.h>
+
+/* Pull in the statics (the queue, the software backend) as well. */
+#include "../../src/copy_engine.c"
+
+#define MEM_SIZE 0x100000
+#define SG_BASE  0x80000 /* where the manager builds its lists */
+#define MAX_CHANS 8
+
+int sim_loglevel = LOGLEVEL_ERROR;
+uint64_t sim_tb;
+
+static long live_allocs;
+static hv_timer_t *timers;
+static unsigned long errors;
+
+/* Partition to reset the next time a worker sleeps */
+static guest_t *reset_in_copy;
+
+/* The reset runs as a thread of its own, which blocks by switching
+ * back to the worker that started it or resumed it.
+ */
+enum {
+	reset_idle,
+	reset_running,
+	reset_blocked,
+	reset_runnable,
+};
+
+static thread_t reset_thread = { .name = "reset" };
+static thread_t *sim_cur;
+static ucontext_t reset_ctx, return_ctx;
+static char reset_stack[0x10000];
+static guest_t *reset_guest;
+static int reset_state;
+
+/* What copy_engine_reset() left behind when it returned */
+static int busy_after_reset;
+static uint64_t bytes_at_reset;
+
+/* Allocation, counted so that leaks are caught.  free() is redirected
+ * here by the alloc.h stand-in; memory from malloc() is released with
+ * (free)() instead.
+ */
+void *alloc(size_t size, size_t align)
+{
+	void *p;
+
+	if (posix_memalign(&p, align < sizeof(void *) ? sizeof(void *) : align,
+	                   size))
+		return NULL;
+
+	memset(p, 0, size);
+	live_allocs++;
+	return p;
+}
+
+void sim_free(void *ptr)
+{
+	if (ptr)
+		live_allocs--;
+
+	(free)(ptr);
+}
+
+/* Timers and threads */
+void hv_timer_add(hv_timer_t *timer, uint64_t expires)
+{
+	timer->expires = expires;
+	timer->next = timers;
+	timers = timer;
+}
+
+thread_t *new_thread(const char *name,
+                     void (*func)(trapframe_t *regs, void *arg),
+                     void *arg, int prio)
+{
+	thread_t *thread = calloc(1, sizeof(thread_t));
+
+	if (thread)
+		thread->name = name;
+
+	return thread;
+}
+
+thread_t *cur_thread(void)
+{
+	return sim_cur;
+}
+
+static uint64_t bytes_copied(void)
+{
+	uint64_t bytes = 0;
+
+	for (copy_backend_t *be = copy_backends; be; be = be->next)
+		bytes += be->bytes;
+
+	return bytes;
+}
+
+static void run_reset(void)
+{
+	copy_engine_reset(reset_guest);
+
+	busy_after_reset = copy_busy(reset_guest);
+	bytes_at_reset = bytes_copied();
+	reset_state = reset_idle;
+}
+
+static void enter_reset(void)
+{
+	reset_state = reset_running;
+	sim_cur = &reset_thread;
+	swapcontext(&return_ctx, &reset_ctx);
+	sim_cur = NULL;
+}
+
+static void start_reset(guest_t *guest)
+{
+	reset_guest = guest;
+
+	getcontext(&reset_ctx);
+	reset_ctx.uc_stack.ss_sp = reset_stack;
+	reset_ctx.uc_stack.ss_size = sizeof(reset_stack);
+	reset_ctx.uc_link = &return_ctx;
+	makecontext(&reset_ctx, run_reset, 0);
+
+	enter_reset();
+}
+
+static void resume_reset(void)
+{
+	if (reset_state == reset_runnable)
+		enter_reset();
+}
+
+void prepare_to_block(void)
+{
+}
+
+/* The worker sleeps until the earliest timer. */
+void block(void)
+{
+	hv_timer_t **prev, **first = NULL;
+
+	if (sim_cur == &reset_thread) {
+		reset_state = reset_blocked;
+		swapcontext(&reset_ctx, &return_ctx);
+		return;
+	}
+
+	if (reset_in_copy) {
+		guest_t *guest = reset_in_copy;
+
+		reset_in_copy = NULL;
+		start_reset(guest);
+	}
+
+	resume_reset();
+
+	for (prev = &timers; *prev; prev = &(*prev)->next)
+		if (!first || (*prev)->expires < (*first)->expires)
+			first = prev;
+
+	if (first) {
+		hv_timer_t *timer = *first;
+
+		*first = timer->next;
+		if (timer->expires > sim_tb)
+			sim_tb = timer->expires;
+
+		timer->fn(timer);
+	}
+}
+
+void unblock(thread_t *thread)
+{
+	thread->wakeups++;
+
+	if (thread == &reset_thread && reset_state == reset_blocked)
+		reset_state = reset_runnable;
+}
+
+int send_doorbells(struct ipi_doorbell *dbell)
+{
+	dbell->rings++;
+	return 0;
+}
+
+/* Guest memory */
+static size_t clip(pte_t *tbl, phys_addr_t addr, size_t len)
+{
+	if (addr >= tbl->size)
+		return 0;
+
+	return min((uint64_t)len, tbl->size - addr);
+}
+
+size_t copy_from_gphys(pte_t *tbl, void *dest, phys_addr_t src, size_t len)
+{
+	len = clip(tbl, src, len);
+	memcpy(dest, tbl->mem + src, len);
+	return len;
+}
+
+size_t copy_between_gphys(pte_t *dtbl, phys_addr_t dest,
+                          pte_t *stbl, phys_addr_t src, size_t len)
+{
+	len = clip(stbl, src, clip(dtbl, dest, len));
+	memmove(dtbl->mem + dest, stbl->mem + src, len);
+	return len;
+}
+
+/* A mock DMA channel.  It takes ticks_per_kb of simulated time per
+ * KiB, sleeping on the timer wheel as the real driver does.
+ */
+typedef struct mock_chan {
+	copy_backend_t be;
+	char name[16];
+	uint64_t ticks_per_kb;
+} mock_chan_t;
+
+static mock_chan_t chans[MAX_CHANS];
+
+static size_t mock_copy(copy_backend_t *be, pte_t *dtbl, phys_addr_t dest,
+                        pte_t *stbl, phys_addr_t src, size_t len)
+{
+	mock_chan_t *chan = be->priv;
+
+	copy_engine_sleep(be, (len * chan->ticks_per_kb + 1023) / 1024);
+	return copy_between_gphys(dtbl, dest, stbl, src, len);
+}
+
+static pte_t mems[3];
+static guest_t guests[3] = {
+	{ .gphys = &mems[0], .name = "manager" },
+	{ .gphys = &mems[1], .name = "source" },
+	{ .gphys = &mems[2], .name = "target" },
+};
+static guest_t *manager = &guests[0], *source = &guests[1], *target = &guests[2];
+static ipi_doorbell_t done_db;
+
+#define check(cond, fmt, args...) do { \
+	if (!(cond)) { \
+		errors++; \
+		printf("FAIL %s:%d: " fmt "\n", __func__, __LINE__, ##args); \
+	} \
+} while (0)
+
+/* Run every worker until the queue is empty */
+static void drain(void)
+{
+	int ran;
+
+	do {
+		ran = 0;
+		for (copy_backend_t *be = copy_backends; be; be = be->next) {
+			ran |= copy_engine_run(be);
+			resume_reset();
+		}
+	} while (ran);
+}
+
+static int submit(guest_t *caller, struct hcall_sg_list *sg, unsigned int num,
+                  ipi_doorbell_t *done, unsigned int *id)
+{
+	memcpy(caller->gphys->mem + SG_BASE, sg, num * sizeof(*sg));
+	return copy_engine_submit(caller, source, target, SG_BASE, num,
+	                          done, id);
+}
+
+/* Queue requests of random entries, as many at a time as the
+ * per-caller limit allows, and check the target against a shadow
+ * copy built in submission order.
+ */
+static void test_copies(int requests, int entries, size_t entry_size)
+{
+	uint8_t *shadow = malloc(MEM_SIZE);
+	struct hcall_sg_list *sg = calloc(entries, sizeof(*sg));
+	unsigned int ids[COPY_MAX_PENDING];
+	unsigned long rings = done_db.rings;
+	uint64_t bytes = 0, start = sim_tb;
+	int done = 0;
+
+	memcpy(shadow, target->gphys->mem, MEM_SIZE);
+
+	while (done < requests) {
+		int n = 0, ret;
+
+		while (done + n < requests) {
+			for (int i = 0; i < entries; i++) {
+				sg[i].source = rand() % (MEM_SIZE - entry_size);
+				sg[i].target = rand() % (MEM_SIZE - entry_size);
+				sg[i].size = 1 + rand() % entry_size;
+			}
+
+			ret = submit(manager, sg, entries, &done_db, &ids[n]);
+			if (ret == EV_EAGAIN)
+				break;
+
+			check(ret == 0, "submit returned %d", ret);
+			if (ret)
+				goto out;
+
+			for (int i = 0; i < entries; i++) {
+				memmove(shadow + sg[i].target,
+				        source->gphys->mem + sg[i].source,
+				        sg[i].size);
+				bytes += sg[i].size;
+			}
+
+			n++;
+		}
+
+		check(n == COPY_MAX_PENDING || done + n == requests,
+		      "only %d requests queued", n);
+
+		for (int i = 0; i < n; i++)
+			check(copy_engine_status(manager, ids[i]) == EV_EAGAIN,
+			      "request %u not pending", ids[i]);
+
+		drain();
+
+		for (int i = 0; i < n; i++) {
+			ret = copy_engine_status(manager, ids[i]);
+			check(ret == 0, "request %u returned %d", ids[i], ret);
+
+			ret = copy_engine_status(manager, ids[i]);
+			check(ret == EV_EINVAL,
+			      "request %u collected twice: %d", ids[i], ret);
+		}
+
+		done += n;
+	}
+
+	check(done_db.rings - rings == (unsigned long)requests,
+	      "%lu doorbells for %d requests", done_db.rings - rings,
+	      requests);
+	check(!memcmp(shadow, target->gphys->mem, MEM_SIZE),
+	      "target memory differs");
+
+	printf("%d requests, %llu bytes, %llu simulated ticks\n", requests,
+	       (unsigned long long)bytes, (unsigned long long)(sim_tb - start));
+
+out:
+	(free)(shadow);
+	(free)(sg);
+}
+
+static void test_errors(void)
+{
+	struct hcall_sg_list sg = { .source = 0, .target = MEM_SIZE - 16,
+	                            .size = 32 };
+	unsigned long faults = 0;
+	unsigned int id;
+	int ret;
+
+	ret = copy_engine_submit(manager, source, target, SG_BASE, 0,
+	                         NULL, &id);
+	check(ret == EV_EINVAL, "empty list returned %d", ret);
+
+	ret = copy_engine_submit(manager, source, target, SG_BASE,
+	                         COPY_MAX_SG + 1, NULL, &id);
+	check(ret == EV_EINVAL, "long list returned %d", ret);
+
+	ret = copy_engine_submit(manager, source, target, MEM_SIZE - 16, 1,
+	                         NULL, &id);
+	check(ret == EV_EFAULT, "unmapped list returned %d", ret);
+
+	check(copy_engine_status(manager, COPY_MAX_REQS) == EV_EINVAL,
+	      "out of range id accepted");
+
+	/* A copy that runs off the end of the target faults. */
+	ret = submit(manager, &sg, 1, NULL, &id);
+	check(ret == 0, "submit returned %d", ret);
+
+	/* Another partition cannot see the manager's request. */
+	check(copy_engine_status(source, id) == EV_EINVAL,
+	      "request visible to another partition");
+
+	drain();
+
+	for (copy_backend_t *be = copy_backends; be; be = be->next)
+		faults += be->faults;
+
+	ret = copy_engine_status(manager, id);
+	check(ret == EV_EFAULT, "fault returned %d", ret);
+	check(faults == 1, "%lu faults counted", faults);
+
+	/* Each caller may have COPY_MAX_PENDING requests outstanding. */
+	sg.target = 0;
+	for (int i = 0; i < COPY_MAX_PENDING; i++) {
+		ret = submit(manager, &sg, 1, NULL, &id);
+		check(ret == 0, "submit %d returned %d", i, ret);
+	}
+
+	ret = submit(manager, &sg, 1, NULL, &id);
+	check(ret == EV_EAGAIN, "request over the limit returned %d", ret);
+
+	copy_engine_reset(manager);
+	check(!queue_head, "reset left requests queued");
+
+	/* The table is shared between callers. */
+	guest_t extra[4] = {};
+	int queued = 0;
+
+	for (int i = 0; i < 4; i++)
+		extra[i].gphys = manager->gphys;
+
+	for (int i = 0; i < 4 * COPY_MAX_PENDING + 1; i++) {
+		ret = submit(&extra[i % 4], &sg, 1, NULL, &id);
+		if (ret == 0)
+			queued++;
+	}
+
+	check(queued == COPY_MAX_REQS && ret == EV_EAGAIN,
+	      "%d requests queued, last returned %d", queued, ret);
+
+	for (int i = 0; i < 4; i++)
+		copy_engine_reset(&extra[i]);
+}
+
+static void test_reset(void)
+{
+	struct hcall_sg_list sg = { .source = 0, .target = 0, .size = 4096 };
+	unsigned long rings = done_db.rings;
+	unsigned int ids[3];
+	int ret;
+
+	/* Queued requests are dropped. */
+	for (int i = 0; i < 3; i++) {
+		ret = submit(manager, &sg, 1, &done_db, &ids[i]);
+		check(ret == 0, "submit returned %d", ret);
+	}
+
+	copy_engine_reset(manager);
+	check(!queue_head, "reset left requests queued");
+
+	for (int i = 0; i < 3; i++)
+		check(copy_engine_status(manager, ids[i]) == EV_EINVAL,
+		      "request %u survived reset", ids[i]);
+
+	/* A running request is stopped, and its doorbell not rung. */
+	sg.size = 4 * COPY_SOFT_CHUNK;
+	ret = submit(manager, &sg, 1, &done_db, &ids[0]);
+	check(ret == 0, "submit returned %d", ret);
+
+	reset_in_copy = manager;
+	drain();
+
+	check(reset_state == reset_idle, "reset did not finish");
+	check(reset_thread.wakeups == 1, "reset did not wait for its copy");
+	check(!busy_after_reset, "reset returned while its copy was running");
+	check(copy_engine_status(manager, ids[0]) == EV_EINVAL,
+	      "running request survived reset");
+	check(done_db.rings == rings, "doorbell rung after reset");
+
+	/* Another partition's copies to a reset partition fail, and
+	 * nothing is copied into it once the reset is done.  The
+	 * reset comes while the first entry of the first request is
+	 * being copied, so the second entry is never started.
+	 */
+	struct hcall_sg_list two[2] = {
+		{ .source = 0, .target = 0, .size = 4096 },
+		{ .source = 4096, .target = 4096, .size = 4096 },
+	};
+
+	for (int i = 0; i < 3; i++) {
+		ret = submit(manager, two, 2, &done_db, &ids[i]);
+		check(ret == 0, "submit returned %d", ret);
+	}
+
+	reset_in_copy = target;
+	drain();
+
+	check(reset_state == reset_idle, "reset did not finish");
+	check(reset_thread.wakeups == 2, "reset did not wait for the copy");
+	check(!busy_after_reset, "reset returned while a copy was running");
+	check(bytes_copied() == bytes_at_reset,
+	      "%llu bytes copied after reset",
+	      (unsigned long long)(bytes_copied() - bytes_at_reset));
+
+	for (int i = 0; i < 3; i++) {
+		ret = copy_engine_status(manager, ids[i]);
+		check(ret == EV_INVALID_STATE,
+		      "request %u to reset partition returned %d", ids[i], ret);
+	}
+
+	check(done_db.rings - rings == 3, "%lu doorbells for 3 cancelled requests",
+	      done_db.rings - rings);
+}
+
+static void usage(void)
+{
+	printf("usage: copy-engine-sim [-c channels] [-r requests] [-e entries]\n"
+	       "                       [-s size] [-t ticks] [-v]\n");
+}
+
+int main(int argc, char *argv[])
+{
+	int num_chans = 2, requests = 64, entries = 16;
+	size_t entry_size = 16384;
+	uint64_t ticks_per_kb = 16;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:r:e:s:t:vh")) != -1) {
+		switch (opt) {
+		case 'c':
+			num_chans = atoi(optarg);
+			break;
+		case 'r':
+			requests = atoi(optarg);
+			break;
+		case 'e':
+			entries = atoi(optarg);
+			break;
+		case 's':
+			entry_size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			ticks_per_kb = strtoull(optarg, NULL, 0);
+			break;
+		case 'v':
+			sim_loglevel = LOGLEVEL_DEBUG;
+			break;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind != argc || num_chans < 0 || num_chans > MAX_CHANS ||
+	    requests < 1 || entries < 1 || entries > COPY_MAX_SG ||
+	    entry_size < 1 || entry_size > MEM_SIZE / 4) {
+		usage();
+		return 1;
+	}
+
+	for (int i = 0; i < 3; i++) {
+		mems[i].mem = malloc(MEM_SIZE);
+		mems[i].size = MEM_SIZE;
+
+		for (size_t j = 0; j < MEM_SIZE; j++)
+			mems[i].mem[j] = rand();
+	}
+
+	/* Without channels, copy_engine_init() falls back to software. */
+	for (int i = 0; i < num_chans; i++) {
+		mock_chan_t *chan = &chans[i];
+
+		snprintf(chan->name, sizeof(chan->name), "mock%d", i);
+		chan->be.name = chan->name;
+		chan->be.copy = mock_copy;
+		chan->be.chunk = 0x100000;
+		chan->be.priv = chan;
+		chan->ticks_per_kb = ticks_per_kb;
+		copy_engine_register(&chan->be);
+	}
+
+	copy_engine_init();
+
+	test_copies(requests, entries, entry_size);
+	test_errors();
+	test_reset();
+
+	for (copy_backend_t *be = copy_backends; be; be = be->next)
+		printf("%-10s %6lu requests %10llu bytes %4lu faults\n",
+		       be->name, be->requests, (unsigned long long)be->bytes,
+		       be->faults);
+
+	check(!live_allocs, "%ld allocations not freed", live_allocs);
+	check(!timers, "timers left pending");
+
+	if (errors) {
+		printf("%lu errors\n", errors);
+		return 1;
+	}
+
+	return 0;
+}
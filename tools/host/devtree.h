@@ -0,0 +1,61 @@
+/** @file
+ * Host-side stand-in for the hypervisor's devtree.h
+ *
+ * bcmux-sim creates its multiplexers directly rather than from a
+ * config tree, so these are only declared for create_mux().
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef DEVTREE_H
+#define DEVTREE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <libos/chardev.h>
+
+typedef struct dt_prop {
+	const void *data;
+	size_t len;
+} dt_prop_t;
+
+typedef struct dt_node {
+	const char *name;
+	struct dt_node *endpoint;
+	struct mux_complex *bcmux;
+	union {
+		chardev_t *chardev;
+	} dev;
+} dt_node_t;
+
+extern dt_node_t *config_tree;
+
+dt_prop_t *dt_get_prop(dt_node_t *node, const char *name, int search_parent);
+dt_node_t *dt_lookup_phandle(dt_node_t *tree, uint32_t phandle);
+int dt_node_is_compatible(dt_node_t *node, const char *compat);
+int dt_for_each_compatible(dt_node_t *tree, const char *compat,
+                           int (*callback)(dt_node_t *node, void *arg),
+                           void *arg);
+
+#endif
@@ -0,0 +1,56 @@
+/** @file
+ * Host-side stand-in for the hypervisor's errors.h
+ *
+ * The hcall error codes have their ePAPR values; for the internal
+ * ones only their distinctness matters to the simulators.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef ERRORS_H
+#define ERRORS_H
+
+#define ERR_NOMEM      (-1)
+#define ERR_INVALID    (-2)
+#define ERR_BUSY       (-3)
+#define ERR_RANGE      (-4)
+#define ERR_BADTREE    (-5)
+#define ERR_NORESOURCE (-6)
+#define ERR_NOTFOUND   (-7)
+
+#define EV_EPERM           1
+#define EV_ENOENT          2
+#define EV_EIO             3
+#define EV_EAGAIN          4
+#define EV_ENOMEM          5
+#define EV_EFAULT          6
+#define EV_ENODEV          7
+#define EV_EINVAL          8
+#define EV_INTERNAL        9
+#define EV_CONFIG          10
+#define EV_INVALID_STATE   11
+#define EV_UNIMPLEMENTED   12
+#define EV_BUFFER_OVERFLOW 13
+
+#endif
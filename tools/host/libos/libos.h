@@ -0,0 +1,141 @@
+/** @file
+ * Host-side stand-in for libos/libos.h
+ *
+ * The simulators are single-threaded, so locks only record whether
+ * they are held, and the timebase is a counter the simulator advances.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBOS_H
+#define LIBOS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <sys/types.h>
+
+/* The TLB cache tag must fill a whole pointer-sized word. */
+#if __SIZEOF_POINTER__ == 8 && !defined(CONFIG_LIBOS_64BIT)
+#define CONFIG_LIBOS_64BIT 1
+#endif
+
+/* register_t comes from <sys/types.h> */
+typedef uint64_t phys_addr_t;
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+
+#define min(x, y) ({ \
+	typeof(x) _x = (x); \
+	typeof(y) _y = (y); \
+	_x < _y ? _x : _y; \
+})
+
+#define max(x, y) ({ \
+	typeof(x) _x = (x); \
+	typeof(y) _y = (y); \
+	_x > _y ? _x : _y; \
+})
+
+#define to_container(p, type, member) \
+	((type *)((char *)(p) - offsetof(type, member)))
+
+#define prefetch_store(addr) __builtin_prefetch((addr), 1)
+
+#define LOGTYPE_MISC      0
+#define LOGTYPE_BYTE_CHAN 1
+#define LOGTYPE_BCMUX     2
+#define LOGTYPE_GUEST_MMU 3
+#define LOGTYPE_EMU       4
+
+#define LOGLEVEL_ALWAYS   0
+#define LOGLEVEL_ERROR    1
+#define LOGLEVEL_NORMAL   4
+#define LOGLEVEL_DEBUG    8
+#define LOGLEVEL_VERBOSE  12
+
+extern int sim_loglevel;
+
+#define printlog(type, level, fmt, args...) do { \
+	if ((level) <= sim_loglevel) \
+		fprintf(stderr, fmt, ##args); \
+} while (0)
+
+#define smp_mbar() __sync_synchronize()
+#define smp_sync() __sync_synchronize()
+#define smp_lwsync() __sync_synchronize()
+
+extern uint64_t sim_tb;
+
+static inline uint64_t get_tb(void)
+{
+	return sim_tb;
+}
+
+/* A simulator runs as a single partition, whose LPID it sets. */
+#define SPR_LPIDR 0
+extern unsigned long sim_lpid;
+#define mfspr(spr) (sim_lpid)
+
+static inline register_t disable_int_save(void)
+{
+	return 0;
+}
+
+static inline void restore_int(register_t saved)
+{
+}
+
+static inline void spin_lock(uint32_t *lock)
+{
+	assert(!*lock);
+	*lock = 1;
+}
+
+static inline void spin_unlock(uint32_t *lock)
+{
+	assert(*lock);
+	*lock = 0;
+}
+
+static inline int spin_lock_held(uint32_t *lock)
+{
+	return *lock != 0;
+}
+
+static inline register_t spin_lock_intsave(uint32_t *lock)
+{
+	spin_lock(lock);
+	return 0;
+}
+
+static inline void spin_unlock_intsave(uint32_t *lock, register_t saved)
+{
+	spin_unlock(lock);
+}
+
+#endif
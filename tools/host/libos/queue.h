@@ -0,0 +1,63 @@
+/** @file
+ * Host-side stand-in for libos/queue.h
+ *
+ * Implemented in host/queue.c with the same calling conventions as
+ * the libos queue: reads and writes return the number of bytes moved,
+ * and readchar/writechar return -1 when the queue is empty/full.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef LIBOS_QUEUE_H
+#define LIBOS_QUEUE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+typedef struct queue {
+	uint8_t *buf;
+	size_t size;
+	size_t head, tail;   /* free-running; head is written, tail read */
+
+	void *consumer, *producer;
+	void (*data_avail)(struct queue *q, int blocking);
+	void (*space_avail)(struct queue *q);
+} queue_t;
+
+int queue_init(queue_t *q, size_t size);
+void queue_destroy(queue_t *q);
+
+size_t queue_get_avail(queue_t *q);
+size_t queue_get_space(queue_t *q);
+int queue_empty(queue_t *q);
+
+int queue_write(queue_t *q, const uint8_t *buf, size_t len);
+int queue_read(queue_t *q, uint8_t *buf, size_t len, int peek);
+int queue_writechar(queue_t *q, uint8_t c);
+int queue_readchar(queue_t *q, int peek);
+
+void queue_notify_consumer(queue_t *q, int blocking);
+void queue_notify_producer(queue_t *q);
+
+#endif
@@ -0,0 +1,56 @@
+/** @file
+ * Host-side stand-in for the hypervisor's paging.h
+ *
+ * A simulated guest physical address space is one flat buffer, so a
+ * "page table" is just the buffer and its size.  Copies stop at the
+ * end of the buffer, as the real ones stop at an unmapped page.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PAGING_H
+#define PAGING_H
+
+#include <libos/libos.h>
+
+#define PAGE_SIZE 4096U
+#define PAGE_SHIFT 12
+
+#define TLB_TSIZE_4K 2
+
+static inline unsigned long tsize_to_pages(unsigned int tsize)
+{
+	return 1UL << (tsize - TLB_TSIZE_4K);
+}
+
+typedef struct pte {
+	uint8_t *mem;
+	size_t size;
+} pte_t;
+
+size_t copy_from_gphys(pte_t *tbl, void *dest, phys_addr_t src, size_t len);
+size_t copy_between_gphys(pte_t *dtbl, phys_addr_t dest,
+                          pte_t *stbl, phys_addr_t src, size_t len);
+
+#endif
@@ -0,0 +1,66 @@
+/** @file
+ * Host-side stand-in for the hypervisor's percpu.h
+ *
+ * Only provides the fields that the simulated sources use.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef PERCPU_H
+#define PERCPU_H
+
+#include <libos/libos.h>
+
+#define LONG_BITS (sizeof(long) * 8)
+#define count_lsb_zeroes(x) __builtin_ctzl(x)
+
+typedef struct trapframe trapframe_t;
+
+struct tlbcset;
+struct gcpu;
+
+typedef struct guest {
+	unsigned int cpucnt;
+	struct pte *gphys;
+	const char *name;
+	struct thread *copy_waiter;
+} guest_t;
+
+typedef struct client_cpu {
+	struct tlbcset *tlbcache;
+	unsigned int tlbcache_bits;
+	unsigned int tlbcache_ways;
+	unsigned int tlbcache_way_bits;
+	unsigned long *tlbcache_pidmap;
+	unsigned int tlbcache_gen;
+} client_cpu_t;
+
+typedef struct cpu {
+	int crashing;
+	client_cpu_t client;
+} cpu_t;
+
+extern cpu_t *cpu;
+
+#endif
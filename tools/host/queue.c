@@ -0,0 +1,134 @@
+/** @file
+ * Host-side implementation of the libos queue interface
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <libos/queue.h>
+#include <errors.h>
+
+int queue_init(queue_t *q, size_t size)
+{
+	memset(q, 0, sizeof(queue_t));
+
+	q->buf = malloc(size);
+	if (!q->buf)
+		return ERR_NOMEM;
+
+	q->size = size;
+	return 0;
+}
+
+void queue_destroy(queue_t *q)
+{
+	free(q->buf);
+	q->buf = NULL;
+}
+
+size_t queue_get_avail(queue_t *q)
+{
+	return q->head - q->tail;
+}
+
+size_t queue_get_space(queue_t *q)
+{
+	return q->size - queue_get_avail(q);
+}
+
+int queue_empty(queue_t *q)
+{
+	return q->head == q->tail;
+}
+
+int queue_write(queue_t *q, const uint8_t *buf, size_t len)
+{
+	size_t n = queue_get_space(q);
+	size_t off = q->head % q->size;
+	size_t first;
+
+	if (len < n)
+		n = len;
+
+	first = q->size - off;
+	if (first > n)
+		first = n;
+
+	memcpy(q->buf + off, buf, first);
+	memcpy(q->buf, buf + first, n - first);
+	q->head += n;
+
+	return n;
+}
+
+int queue_read(queue_t *q, uint8_t *buf, size_t len, int peek)
+{
+	size_t n = queue_get_avail(q);
+	size_t off = q->tail % q->size;
+	size_t first;
+
+	if (len < n)
+		n = len;
+
+	first = q->size - off;
+	if (first > n)
+		first = n;
+
+	memcpy(buf, q->buf + off, first);
+	memcpy(buf + first, q->buf, n - first);
+
+	if (!peek)
+		q->tail += n;
+
+	return n;
+}
+
+int queue_writechar(queue_t *q, uint8_t c)
+{
+	return queue_write(q, &c, 1) == 1 ? 0 : -1;
+}
+
+int queue_readchar(queue_t *q, int peek)
+{
+	uint8_t c;
+
+	if (queue_read(q, &c, 1, peek) != 1)
+		return -1;
+
+	return c;
+}
+
+void queue_notify_consumer(queue_t *q, int blocking)
+{
+	if (q->data_avail)
+		q->data_avail(q, blocking);
+}
+
+void queue_notify_producer(queue_t *q)
+{
+	if (q->space_avail)
+		q->space_avail(q);
+}
@@ -0,0 +1,53 @@
+/** @file
+ * Host-side stand-in for the hypervisor's thread.h
+ *
+ * Worker threads are not actually run; the simulator calls
+ * copy_engine_run() itself.  block() stands for the time the worker
+ * spends asleep, and advances the timebase to the next timer.  A
+ * partition reset started from a worker's sleep runs in a context of
+ * its own, so that it can block until the worker leaves its copies.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef THREAD_H
+#define THREAD_H
+
+#include <percpu.h>
+
+typedef struct thread {
+	const char *name;
+	int blocked;
+	unsigned long wakeups;
+} thread_t;
+
+thread_t *cur_thread(void);
+thread_t *new_thread(const char *name,
+                     void (*func)(trapframe_t *regs, void *arg),
+                     void *arg, int prio);
+void prepare_to_block(void);
+void block(void);
+void unblock(thread_t *thread);
+
+#endif
@@ -0,0 +1,585 @@
+/** @file
+ * Trace-driven simulator and microbenchmark for the guest TLB0 cache
+ *
+ * Links the hypervisor's src/tlbcache.c into a native program, and replays
+ * recorded (or synthetic) sequences of guest tlbwe, tlbivax/tlbilx, and
+ * TLB miss events against it.  For each trace, the hit rate and the host
+ * cost of lookups and invalidations are reported, which allows sizing
+ * the cache without a board.
+ */
+/*
+ * Copyright (C) 2012 Freescale Semiconductor, Inc.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR "AS IS" AND ANY EXPRESS OR
+ * IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES
+ * OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED.  IN
+ * NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL,
+ * SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED
+ * TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING
+ * NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+ * SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* Trace format: one event per line, numbers in C syntax, '#' comments.
+ *
+ *   w <vaddr> <pid> <as> <esel> <rpn>  guest tlbwe to TLB0, MAS1[V] set
+ *   x <vaddr> <pid> <as> <esel>        guest tlbwe to TLB0, MAS1[V] clear
+ *   m <vaddr> <pid> <as>               TLB miss (fast path lookup)
+ *   i <vaddr> <pid>                    invalidate by address (pid -1: any)
+ *   p <pid>                            invalidate by PID
+ *   a                                  invalidate all
+ *   c <epn> <tsize> <pid> <as>         TLB1 write conflict check
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#include <percpu.h>
+#include <paging.h>
+#include <errors.h>
+#include <tlbcache.h>
+
+/* The conflict ops make tlbcache.c log errors on purpose. */
+int sim_loglevel = LOGLEVEL_ALWAYS;
+cpu_t *cpu;
+unsigned long sim_lpid = 1;
+
+static cpu_t sim_cpu;
+static unsigned char *next_victim;
+static int fill_on_miss;
+static int verbose;
+
+typedef enum {
+	op_write,
+	op_write_inval,
+	op_miss,
+	op_inv_va,
+	op_inv_pid,
+	op_inv_all,
+	op_conflict,
+	num_ops
+} op_type_t;
+
+static const char *op_names[num_ops] = {
+	"tlbwe",
+	"tlbwe (invalid)",
+	"miss lookup",
+	"inv by address",
+	"inv by PID",
+	"inv all",
+	"tlb1 conflict",
+};
+
+typedef struct op {
+	op_type_t type;
+	unsigned long vaddr, rpn;
+	int pid;
+	unsigned int space, esel;
+} op_t;
+
+typedef struct trace {
+	op_t *ops;
+	size_t num, max;
+} trace_t;
+
+typedef struct op_stat {
+	unsigned long num;
+	uint64_t ns, min, max;
+} op_stat_t;
+
+typedef struct results {
+	op_stat_t op[num_ops];
+	unsigned long hits, fills, evictions, busy, conflicts;
+} results_t;
+
+static long timer_overhead;
+
+static inline uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void calibrate(void)
+{
+	long best = -1;
+
+	for (int i = 0; i < 10000; i++) {
+		uint64_t start = now_ns();
+		long diff = now_ns() - start;
+
+		if (best < 0 || diff < best)
+			best = diff;
+	}
+
+	timer_overhead = best;
+}
+
+static int parse_line(char *line, op_t *op, const char *file, int lineno)
+{
+	char *argv[7];
+	unsigned long val[6];
+	int argc = 0, need;
+	char *p = strchr(line, '#');
+
+	if (p)
+		*p = 0;
+
+	for (p = strtok(line, " \t\r\n"); p && argc < 7;
+	     p = strtok(NULL, " \t\r\n"))
+		argv[argc++] = p;
+
+	if (argc == 0)
+		return 0;
+
+	memset(op, 0, sizeof(op_t));
+
+	if (strlen(argv[0]) != 1)
+		goto bad;
+
+	switch (argv[0][0]) {
+	case 'w':
+		op->type = op_write;
+		need = 5;
+		break;
+	case 'x':
+		op->type = op_write_inval;
+		need = 4;
+		break;
+	case 'm':
+		op->type = op_miss;
+		need = 3;
+		break;
+	case 'i':
+		op->type = op_inv_va;
+		need = 2;
+		break;
+	case 'p':
+		op->type = op_inv_pid;
+		need = 1;
+		break;
+	case 'a':
+		op->type = op_inv_all;
+		need = 0;
+		break;
+	case 'c':
+		op->type = op_conflict;
+		need = 4;
+		break;
+	default:
+		goto bad;
+	}
+
+	if (argc - 1 != need)
+		goto bad;
+
+	for (int i = 0; i < need; i++) {
+		char *end;
+
+		errno = 0;
+		val[i] = strtoul(argv[i + 1], &end, 0);
+		if (errno || *end)
+			goto bad;
+	}
+
+	switch (op->type) {
+	case op_write:
+		op->rpn = val[4];
+		/* fall through */
+	case op_write_inval:
+		op->esel = val[3];
+		/* fall through */
+	case op_miss:
+		op->space = val[2];
+		/* fall through */
+	case op_inv_va:
+		op->vaddr = val[0] & ~(PAGE_SIZE - 1UL);
+		op->pid = (int)val[1];
+		break;
+	case op_inv_pid:
+		op->pid = val[0];
+		break;
+	case op_conflict:
+		op->vaddr = val[0];
+		op->rpn = val[1];
+		op->pid = val[2];
+		op->space = val[3];
+		break;
+	default:
+		break;
+	}
+
+	return 1;
+
+bad:
+	fprintf(stderr, "%s:%d: malformed trace event\n", file, lineno);
+	return -1;
+}
+
+static int load_trace(const char *file, trace_t *trace)
+{
+	char line[256];
+	int lineno = 0;
+	FILE *f;
+
+	if (!strcmp(file, "-"))
+		f = stdin;
+	else
+		f = fopen(file, "r");
+
+	if (!f) {
+		perror(file);
+		return -1;
+	}
+
+	trace->num = 0;
+
+	while (fgets(line, sizeof(line), f)) {
+		op_t op;
+		int ret = parse_line(line, &op, file, ++lineno);
+
+		if (ret < 0)
+			goto err;
+		if (ret == 0)
+			continue;
+
+		if (trace->num == trace->max) {
+			trace->max = trace->max ? trace->max * 2 : 4096;
+			trace->ops = realloc(trace->ops, trace->max * sizeof(op_t));
+			if (!trace->ops) {
+				perror("realloc");
+				goto err;
+			}
+		}
+
+		trace->ops[trace->num++] = op;
+	}
+
+	if (f != stdin)
+		fclose(f);
+
+	return 0;
+
+err:
+	if (f != stdin)
+		fclose(f);
+
+	return -1;
+}
+
+static void sim_reset(void)
+{
+	unsigned int bits = cpu->client.tlbcache_bits;
+
+	memset(cpu->client.tlbcache, 0, TLBC_SIZE(cpu->client.tlbcache_ways, bits));
+	memset(cpu->client.tlbcache_pidmap, 0, TLBC_PIDMAP_SIZE(bits));
+	cpu->client.tlbcache_gen = 0;
+	memset(next_victim, 0, 1 << cpu->client.tlbcache_bits);
+}
+
+static int sim_write(unsigned long vaddr, int pid, unsigned int space,
+                     unsigned int esel, unsigned long rpn, int valid,
+                     results_t *res)
+{
+	tlbcentry_t entry = {};
+	tlbctag_t tag = make_tag(vaddr, pid, space);
+	uintptr_t oldvaddr;
+	unsigned int oldpid;
+	int ret;
+
+	if (!valid)
+		tag.valid = 0;
+
+	entry.mas3 = rpn << PAGE_SHIFT;
+	entry.tsize = 1;
+
+	ret = tlbcache_insert(vaddr, tag, esel, &entry, &oldvaddr, &oldpid);
+	if (ret == ERR_BUSY) {
+		res->busy++;
+	} else if (ret > 0) {
+		res->evictions++;
+
+		if (verbose)
+			printf("  evict %#lx pid %u for %#lx pid %d\n",
+			       (unsigned long)oldvaddr, oldpid, vaddr, pid);
+	}
+
+	return ret;
+}
+
+static void run_op(const op_t *op, results_t *res)
+{
+	tlbcset_t *set;
+	unsigned int way;
+	uint64_t start, diff;
+	long adj;
+	int hit = 0;
+
+	start = now_ns();
+
+	switch (op->type) {
+	case op_write:
+	case op_write_inval:
+		sim_write(op->vaddr, op->pid, op->space, op->esel, op->rpn,
+		          op->type == op_write, res);
+		break;
+
+	case op_miss:
+		hit = find_gtlb_entry(op->vaddr,
+		                      make_tag(op->vaddr, op->pid, op->space),
+		                      &set, &way);
+		break;
+
+	case op_inv_va:
+		tlbcache_inv_va(op->vaddr, op->pid);
+		break;
+
+	case op_inv_pid:
+		tlbcache_inv_pid(op->pid);
+		break;
+
+	case op_inv_all:
+		tlbcache_inv_all();
+		break;
+
+	case op_conflict:
+		res->conflicts += check_tlb1_conflict(op->vaddr, op->rpn,
+		                                      op->pid, op->space);
+		break;
+
+	default:
+		abort();
+	}
+
+	diff = now_ns() - start;
+	adj = (long)diff - timer_overhead;
+	diff = adj > 0 ? adj : 0;
+
+	op_stat_t *st = &res->op[op->type];
+
+	if (st->num == 0 || diff < st->min)
+		st->min = diff;
+	if (diff > st->max)
+		st->max = diff;
+
+	st->ns += diff;
+	st->num++;
+
+	if (op->type != op_miss)
+		return;
+
+	if (hit) {
+		res->hits++;
+		return;
+	}
+
+	/* The guest would reflect the miss and refill it with a tlbwe,
+	 * using the hardware's round-robin next-victim hint.
+	 */
+	if (fill_on_miss) {
+		unsigned int index = (op->vaddr >> PAGE_SHIFT) &
+		                     ((1 << cpu->client.tlbcache_bits) - 1);
+		unsigned int esel = next_victim[index]++ &
+		                     (cpu->client.tlbcache_ways - 1);
+
+		sim_write(op->vaddr, op->pid, op->space, esel,
+		          op->vaddr >> PAGE_SHIFT, 1, res);
+		res->fills++;
+	}
+}
+
+static void report(const char *name, const results_t *res, int repeat)
+{
+	unsigned long lookups = res->op[op_miss].num;
+
+	printf("%s: %lu sets x %u ways (%lu KiB), lpid %lu",
+	       name, 1UL << cpu->client.tlbcache_bits, cpu->client.tlbcache_ways,
+	       (unsigned long)TLBC_SIZE(cpu->client.tlbcache_ways,
+	                                cpu->client.tlbcache_bits) >> 10,
+	       sim_lpid);
+	if (repeat > 1)
+		printf(", %d passes", repeat);
+	printf("\n");
+
+	printf("  lookups %lu, hits %lu, hit rate %.2f%%\n", lookups, res->hits,
+	       lookups ? 100.0 * res->hits / lookups : 0.0);
+	printf("  refills %lu, evictions %lu, duplicate rejects %lu, "
+	       "tlb1 conflicts %lu\n",
+	       res->fills, res->evictions, res->busy, res->conflicts);
+
+	printf("  %-18s %10s %10s %10s %10s\n",
+	       "Event", "Count", "Avg(ns)", "Min(ns)", "Max(ns)");
+
+	for (int i = 0; i < num_ops; i++) {
+		const op_stat_t *st = &res->op[i];
+
+		if (!st->num)
+			continue;
+
+		printf("  %-18s %10lu %10.1f %10llu %10llu\n",
+		       op_names[i], st->num, (double)st->ns / st->num,
+		       (unsigned long long)st->min,
+		       (unsigned long long)st->max);
+	}
+}
+
+/* Synthetic workload loosely modelled on a Linux guest: a set of processes
+ * with their own working sets, a shared kernel working set under PID 0,
+ * context switches, and the occasional process exit (which Linux handles
+ * by flushing the PID before it is reused).
+ */
+static int generate(const char *spec)
+{
+	unsigned long seed, procs, pages, ops;
+	unsigned long cur = 1;
+
+	if (sscanf(spec, "%lu,%lu,%lu,%lu", &seed, &procs, &pages, &ops) != 4 ||
+	    procs == 0 || procs > 255 || pages == 0) {
+		fprintf(stderr, "bad -g spec '%s', need seed,procs,pages,ops\n",
+		        spec);
+		return -1;
+	}
+
+	srandom(seed);
+
+	printf("# synthetic: seed %lu, %lu processes, %lu pages each, %lu ops\n",
+	       seed, procs, pages, ops);
+
+	for (unsigned long i = 0; i < ops; i++) {
+		unsigned long r = random() % 1000;
+		unsigned long page = random() % pages;
+
+		/* Skew accesses toward the start of each working set. */
+		if (random() & 1)
+			page /= 8;
+
+		if (r < 2) {
+			printf("p %lu\n", cur);
+		} else if (r < 20) {
+			cur = 1 + random() % procs;
+		} else if (r < 22) {
+			printf("i %#lx %lu\n", 0x10000000 + (page << PAGE_SHIFT), cur);
+		} else if (r < 200) {
+			printf("m %#lx 0 0\n", 0xc0000000 + (page << PAGE_SHIFT));
+		} else {
+			printf("m %#lx %lu 0\n",
+			       0x10000000 + (page << PAGE_SHIFT), cur);
+		}
+	}
+
+	return 0;
+}
+
+static void usage(void)
+{
+	fprintf(stderr,
+	        "Usage: tlbcache-sim [options] <trace>...\n"
+	        "       tlbcache-sim -g <seed>,<procs>,<pages>,<ops>\n"
+	        "\n"
+	        "  -b <bits>   index bits, i.e. log2 of the number of sets (default 12)\n"
+	        "  -w <ways>   associativity: 2, 4, or 8 (default 4)\n"
+	        "  -l <lpid>   LPID to use in tags (default 1)\n"
+	        "  -f          refill the cache on lookup misses, as the guest would\n"
+	        "  -r <n>      replay each trace n times (default 1)\n"
+	        "  -v          print each eviction\n"
+	        "  -g <spec>   write a synthetic trace to stdout\n"
+	        "\n"
+	        "A trace of '-' is read from stdin.\n");
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int bits = TLBC_DEFAULT_IDX_BITS;
+	unsigned int ways = TLBC_DEFAULT_WAYS;
+	int repeat = 1;
+	trace_t trace = {};
+	void *mem;
+	int opt, ret = 0;
+
+	while ((opt = getopt(argc, argv, "b:w:l:fr:vg:h")) != -1) {
+		switch (opt) {
+		case 'b':
+			bits = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			ways = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			sim_lpid = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fill_on_miss = 1;
+			break;
+		case 'r':
+			repeat = atoi(optarg);
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		case 'g':
+			return generate(optarg) ? 1 : 0;
+		default:
+			usage();
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	if (optind >= argc || bits < TLBC_MIN_IDX_BITS || bits > TLBC_MAX_IDX_BITS ||
+	    ways < TLBC_MIN_WAYS || ways > TLBC_MAX_WAYS || (ways & (ways - 1)) ||
+	    repeat < 1) {
+		usage();
+		return 1;
+	}
+
+	cpu = &sim_cpu;
+	cpu->client.tlbcache_bits = bits;
+	cpu->client.tlbcache_ways = ways;
+	cpu->client.tlbcache_way_bits = __builtin_ctz(ways);
+	next_victim = malloc(1 << bits);
+	cpu->client.tlbcache_pidmap = malloc(TLBC_PIDMAP_SIZE(bits));
+	if (posix_memalign(&mem, PAGE_SIZE, TLBC_SIZE(ways, bits)) ||
+	    !next_victim || !cpu->client.tlbcache_pidmap) {
+		perror("malloc");
+		return 1;
+	}
+
+	cpu->client.tlbcache = mem;
+	calibrate();
+
+	for (int i = optind; i < argc; i++) {
+		results_t res = {};
+
+		if (load_trace(argv[i], &trace)) {
+			ret = 1;
+			continue;
+		}
+
+		sim_reset();
+
+		for (int pass = 0; pass < repeat; pass++)
+			for (size_t j = 0; j < trace.num; j++)
+				run_op(&trace.ops[j], &res);
+
+		report(argv[i], &res, repeat);
+	}
+
+	free(trace.ops);
+	return ret;
+}